@@ -0,0 +1,69 @@
+// alignedallocator.h
+// Copyright Laurence Emms 2017
+
+#ifndef ALIGNED_ALLOCATOR
+#define ALIGNED_ALLOCATOR
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+namespace classifiers
+{
+    // allocator for std::vector storage aligned to Alignment bytes so rows can be loaded with vector instructions
+    template <typename T, size_t Alignment = 64>
+    class AlignedAllocator
+    {
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+
+        template <typename U>
+        struct rebind
+        {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+
+        AlignedAllocator() {}
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T* allocate(const size_t n)
+        {
+            if (n == 0)
+            {
+                return NULL;
+            }
+            void* memory = NULL;
+            if (posix_memalign(&memory, Alignment, n * sizeof(T)) != 0)
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(memory);
+        }
+
+        void deallocate(T* p, const size_t)
+        {
+            std::free(p);
+        }
+    };
+
+    template <typename T, typename U, size_t Alignment>
+    bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+    {
+        return true;
+    }
+
+    template <typename T, typename U, size_t Alignment>
+    bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+    {
+        return false;
+    }
+}
+
+#endif // ALIGNED_ALLOCATOR
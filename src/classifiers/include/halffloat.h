@@ -0,0 +1,118 @@
+// halffloat.h
+// Copyright Laurence Emms 2017
+
+#ifndef HALF_FLOAT
+#define HALF_FLOAT
+
+#include <cstdint>
+#include <cstring>
+
+namespace classifiers
+{
+    // IEEE 754 binary16 conversions, rounding to nearest even
+    inline uint16_t float_to_half_bits(const float value)
+    {
+        uint32_t f = 0;
+        std::memcpy(&f, &value, sizeof(f));
+        const uint16_t sign = static_cast<uint16_t>((f >> 16) & 0x8000);
+        const uint32_t magnitude = f & 0x7fffffff;
+        if (magnitude >= 0x7f800000)
+        {
+            // infinity stays infinity, nan stays a quiet nan
+            return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+        }
+        if (magnitude >= 0x47800000)
+        {
+            return sign | 0x7c00;
+        }
+        const uint32_t exponent = magnitude >> 23;
+        if (exponent < 113)
+        {
+            // subnormal half
+            const uint32_t shift = 126 - exponent;
+            if (shift >= 25)
+            {
+                return sign;
+            }
+            const uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+            uint32_t result = mantissa >> shift;
+            const uint32_t remainder = mantissa & ((1u << shift) - 1);
+            const uint32_t halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (result & 1)))
+            {
+                result++;
+            }
+            return sign | static_cast<uint16_t>(result);
+        }
+        uint32_t result = ((exponent - 112) << 10) | ((magnitude >> 13) & 0x3ff);
+        const uint32_t remainder = magnitude & 0x1fff;
+        // a carry out of the mantissa correctly rounds up into the exponent, up to infinity
+        if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1)))
+        {
+            result++;
+        }
+        return sign | static_cast<uint16_t>(result);
+    }
+
+    inline float half_bits_to_float(const uint16_t bits)
+    {
+        const uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16;
+        const uint32_t exponent = (bits >> 10) & 0x1f;
+        const uint32_t mantissa = bits & 0x3ff;
+        uint32_t f = 0;
+        if (exponent == 0)
+        {
+            // zero or subnormal, mantissa * 2^-24 is exact in float
+            float value = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+            return sign ? -value : value;
+        }
+        else if (exponent == 31)
+        {
+            f = sign | 0x7f800000 | (mantissa << 13);
+        }
+        else
+        {
+            f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+        float value = 0.0f;
+        std::memcpy(&value, &f, sizeof(value));
+        return value;
+    }
+
+    // bfloat16 is the upper half of a float, rounding to nearest even
+    inline uint16_t float_to_bfloat16_bits(const float value)
+    {
+        uint32_t f = 0;
+        std::memcpy(&f, &value, sizeof(f));
+        if ((f & 0x7fffffff) > 0x7f800000)
+        {
+            return static_cast<uint16_t>((f >> 16) | 0x40);
+        }
+        return static_cast<uint16_t>((f + 0x7fff + ((f >> 16) & 1)) >> 16);
+    }
+
+    inline float bfloat16_bits_to_float(const uint16_t bits)
+    {
+        const uint32_t f = static_cast<uint32_t>(bits) << 16;
+        float value = 0.0f;
+        std::memcpy(&value, &f, sizeof(value));
+        return value;
+    }
+
+    // 16 bit weight storage types, they convert to and from float implicitly
+    struct float16
+    {
+        float16(const float value = 0.0f) : bits(float_to_half_bits(value)) {}
+        operator float() const { return half_bits_to_float(bits); }
+        uint16_t bits;
+    };
+
+    struct bfloat16
+    {
+        bfloat16(const float value = 0.0f) : bits(float_to_bfloat16_bits(value)) {}
+        operator float() const { return bfloat16_bits_to_float(bits); }
+        uint16_t bits;
+    };
+}
+
+#endif // HALF_FLOAT
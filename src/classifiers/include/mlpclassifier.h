@@ -12,6 +12,11 @@
 #include <random>
 #include <fstream>
 
+#include "alignedallocator.h"
+#include "halffloat.h"
+#include "optimizer.h"
+#include "sparselayer.h"
+
 namespace classifiers
 {
     template <typename T, typename S = size_t>
@@ -23,8 +28,11 @@ namespace classifiers
         T get_value(const S i, const S j) const;
         S get_rows() const;
         S get_cols() const;
+        // unchecked access to the contiguous cols of row i
+        T* row(const S i);
+        const T* row(const S i) const;
     private:
-        std::vector<T> _weights;
+        std::vector<T, AlignedAllocator<T> > _weights;
         const S _rows;
         const S _cols;
     };
@@ -69,27 +77,103 @@ namespace classifiers
         return _cols;
     }
 
+    template <typename T, typename S>
+    T* WeightLayer<T, S>::row(const S i)
+    {
+        return &_weights[i * _cols];
+    }
+
+    template <typename T, typename S>
+    const T* WeightLayer<T, S>::row(const S i) const
+    {
+        return &_weights[i * _cols];
+    }
+
+    // storage type of the weights
+    enum WeightPrecision
+    {
+        PRECISION_FP32,
+        PRECISION_FP16,
+        PRECISION_BF16
+    };
+
+    bool parse_precision(const std::string& name, WeightPrecision& precision);
+    std::string precision_name(const WeightPrecision precision);
+
     // multi-layer perceptron classifier
     class MLPClassifier
     {
     public:
         MLPClassifier(bool verbose = false);
+        // copies the model, the copy gets a freshly seeded random generator
+        MLPClassifier(const MLPClassifier& other);
         int num_layers() const;
         int layer_size(int layer) const;
         void init(const std::vector<int>& layer_counts, const float learning_rate = 0.1f, const float beta = 1.0f);
-        void train(const std::vector<float>& input, const std::vector<float>& target);
+        // weight scales the learning rate of this sample
+        void train(const std::vector<float>& input, const std::vector<float>& target, const float weight = 1.0f);
         void classify(const std::vector<float>& input, std::vector<float>& output);
         void feed_forward(const std::vector<float>& input);
-        void back_propagation(const std::vector<float>& target);
+        void back_propagation(const std::vector<float>& target, const float weight = 1.0f);
         void get_output_layer(std::vector<float>& output);
+        // 16 bit models are written with their weights as 4 digit hex, about half the size of fp32 text
         void write(std::ofstream& stream) const;
+        // the model is loaded in the precision it was written in
         void read(std::ifstream& stream);
+        // converts the weights, 16 bit weights halve the memory read per inference but can not be trained
+        void set_precision(const WeightPrecision precision);
+        WeightPrecision precision() const;
+        // zeroes the smallest magnitude fraction of each hidden layer's weights, the output layer is kept dense
+        // pruned weights stay zero through later training and the model is written in the sparse format
+        void prune_magnitude(const float sparsity);
+        // zeroes the block_rows x block_cols tiles with the smallest mean magnitude
+        void prune_blocks(const float sparsity, const int block_rows, const int block_cols);
+        // fraction of the weights of a layer that are not pruned
+        float density(const int layer) const;
+        // layers less dense than this use the sparse kernel, 0 always uses the dense kernel
+        void set_sparse_threshold(const float density);
+        bool uses_sparse(const int layer) const;
+        void set_learning_rate(const float learning_rate);
+        // changing the optimizer type discards its accumulated state
+        void set_optimizer(const OptimizerOptions& optimizer);
+        void set_schedule(const LearningRateSchedule& schedule);
+        float current_learning_rate() const;
+        // all weights flattened layer by layer, for averaging models
+        size_t parameter_count() const;
+        void get_parameters(float* parameters) const;
+        void set_parameters(const float* parameters);
+        size_t steps() const;
+        // optimizer state (update count and moment buffers) is stored separately from the model
+        void write_optimizer(std::ofstream& stream) const;
+        bool read_optimizer(std::ifstream& stream);
     private:
+        void reset_optimizer_state();
+        void allocate_optimizer_state();
+        void compile_sparse();
         bool _verbose;
         float _learning_rate;
         float _beta;
+        OptimizerOptions _optimizer;
+        LearningRateSchedule _schedule;
+        size_t _step;
+        // per weight momentum / first moment and second moment, same shape as _weights,
+        // allocated by the first update that needs them
+        std::vector<WeightLayer<float, int>> _first_moment;
+        std::vector<WeightLayer<float, int>> _second_moment;
         std::vector<int> _layer_counts;
+        WeightPrecision _precision;
+        // only the vector of the current precision holds weights
         std::vector<WeightLayer<float, int>> _weights;
+        std::vector<WeightLayer<float16, int>> _weights_fp16;
+        std::vector<WeightLayer<bfloat16, int>> _weights_bf16;
+        // pruning masks, one byte per weight, empty for a dense model
+        std::vector<std::vector<unsigned char>> _masks;
+        int _block_rows;
+        int _block_cols;
+        float _sparse_threshold;
+        // compiled from the masks for inference, discarded when the weights are trained
+        std::vector<SparseLayer> _sparse;
+        std::vector<bool> _use_sparse;
         std::vector<std::vector<float>> _layers;
         std::vector<std::vector<float>> _errors;
         std::random_device _rd;
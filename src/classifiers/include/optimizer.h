@@ -0,0 +1,56 @@
+// optimizer.h
+// Copyright Laurence Emms 2017
+
+#ifndef OPTIMIZER
+#define OPTIMIZER
+
+#include <string>
+
+namespace classifiers
+{
+    enum OptimizerType
+    {
+        OPTIMIZER_SGD,
+        OPTIMIZER_MOMENTUM,
+        OPTIMIZER_NESTEROV,
+        OPTIMIZER_ADAM
+    };
+
+    struct OptimizerOptions
+    {
+        OptimizerOptions();
+        OptimizerType type;
+        float momentum;
+        float beta1;
+        float beta2;
+        float epsilon;
+    };
+
+    enum ScheduleType
+    {
+        SCHEDULE_CONSTANT,
+        SCHEDULE_STEP,
+        SCHEDULE_COSINE
+    };
+
+    // learning rate as a function of the number of updates applied so far
+    // warmup ramps linearly from zero, step multiplies by gamma every step_size updates
+    // and cosine anneals from the base rate to min_rate over total_steps updates
+    struct LearningRateSchedule
+    {
+        LearningRateSchedule();
+        float rate(const float base_rate, const size_t step) const;
+        ScheduleType type;
+        size_t warmup_steps;
+        size_t step_size;
+        float gamma;
+        size_t total_steps;
+        float min_rate;
+    };
+
+    bool parse_optimizer_type(const std::string& name, OptimizerType& type);
+    std::string optimizer_name(const OptimizerType type);
+    bool parse_schedule_type(const std::string& name, ScheduleType& type);
+}
+
+#endif // OPTIMIZER
@@ -0,0 +1,23 @@
+// patchinput.h
+// Copyright Laurence Emms 2017
+
+#ifndef PATCH_INPUT
+#define PATCH_INPUT
+
+#include <list>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace classifiers
+{
+    // copies the luminance of the w x h patch centered on x, y of every frame in the window, newest frame first
+    // training and classification must share this layout or a trained model no longer matches inference
+    void fill_input(std::vector<float>& input_vector,
+                    const std::list<cv::Mat>& frames,
+                    const int x,
+                    const int y,
+                    const int w,
+                    const int h);
+}
+
+#endif // PATCH_INPUT
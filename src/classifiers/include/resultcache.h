@@ -0,0 +1,52 @@
+// resultcache.h
+// Copyright Laurence Emms 2017
+
+#ifndef RESULT_CACHE
+#define RESULT_CACHE
+
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+
+namespace classifiers
+{
+    // 64 bit FNV-1a hashing of raw bytes, files and decoded frames
+    uint64_t hash_bytes(const void* data, const size_t size, const uint64_t seed = 14695981039346656037ULL);
+    uint64_t hash_file(const std::string& path);
+    uint64_t hash_frame(const cv::Mat& frame);
+    uint64_t combine_hash(const uint64_t seed, const uint64_t value);
+
+    struct FrameResult
+    {
+        float output_fraction;
+        float mean_output;
+    };
+
+    // content-addressed store of per-frame classification results
+    // results are keyed on the fingerprint of the frame window fed to the classifier
+    // and stored in one append-only file per model hash inside the cache directory
+    // find and insert are safe to call from multiple threads
+    class ResultCache
+    {
+    public:
+        ResultCache();
+        bool open(const std::string& cache_dir, const uint64_t model_hash);
+        bool is_open() const;
+        bool find(const uint64_t key, FrameResult& result);
+        void insert(const uint64_t key, const FrameResult& result);
+        size_t hits() const;
+        size_t misses() const;
+    private:
+        bool _open;
+        size_t _hits;
+        size_t _misses;
+        mutable std::mutex _mutex;
+        std::unordered_map<uint64_t, FrameResult> _results;
+        std::ofstream _stream;
+    };
+}
+
+#endif // RESULT_CACHE
@@ -0,0 +1,44 @@
+// sparselayer.h
+// Copyright Laurence Emms 2017
+
+#ifndef SPARSE_LAYER
+#define SPARSE_LAYER
+
+#include <vector>
+
+#include "alignedallocator.h"
+
+namespace classifiers
+{
+    template <typename T, typename S>
+    class WeightLayer;
+
+    // the unmasked weights of a pruned layer compressed by output column
+    // with block dimensions the layer is stored as dense block_rows x block_cols tiles instead
+    class SparseLayer
+    {
+    public:
+        SparseLayer();
+        void build(const WeightLayer<float, int>& weights,
+                   const std::vector<unsigned char>& mask,
+                   const int block_rows,
+                   const int block_cols);
+        // output[k] = sum over the stored j of input[j] * weight(j, k) for k in [begin, end)
+        // begin must be a multiple of group_width()
+        void multiply(const float* input, float* output, const int begin, const int end) const;
+        int group_width() const;
+        int cols() const;
+        size_t stored() const;
+    private:
+        int _rows;
+        int _cols;
+        int _block_rows;
+        int _block_cols;
+        // per column (or column block) the range of _indices holding its rows (or row blocks)
+        std::vector<int> _starts;
+        std::vector<int> _indices;
+        std::vector<float, AlignedAllocator<float> > _values;
+    };
+}
+
+#endif // SPARSE_LAYER
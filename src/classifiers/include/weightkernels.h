@@ -0,0 +1,18 @@
+// weightkernels.h
+// Copyright Laurence Emms 2017
+
+#ifndef WEIGHT_KERNELS
+#define WEIGHT_KERNELS
+
+#include "halffloat.h"
+
+namespace classifiers
+{
+    // output[k] = sum over j of input[j] * weights[j * cols + k] for k in [begin, end)
+    // 16 bit weights are widened to float and accumulated in float, using F16C / AVX2 when the cpu has them
+    void multiply_columns(const float* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end);
+    void multiply_columns(const float16* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end);
+    void multiply_columns(const bfloat16* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end);
+}
+
+#endif // WEIGHT_KERNELS
@@ -1,11 +1,202 @@
 // mlpclasifier.cpp
 // Copyright Laurence Emms 2017
 
+#include <algorithm>
+#include <iomanip>
+
 #include "mlpclassifier.h"
+#include "weightkernels.h"
 
 namespace classifiers
 {
-    MLPClassifier::MLPClassifier(bool verbose) : _verbose(verbose), _learning_rate(0.1f), _beta(1.0f), _gen(_rd()), _dist(-1.0, 1.0)
+    namespace
+    {
+        // weights are multiplied in blocks of columns so each thread streams whole rows of its block
+        template <typename T>
+        void forward_layer(const WeightLayer<T, int>& weights, const std::vector<float>& input, std::vector<float>& output, const float beta)
+        {
+            const int rows = weights.get_rows();
+            const int cols = weights.get_cols();
+            const int block = 16;
+            const int blocks = (cols + block - 1) / block;
+#pragma omp parallel for
+            for (int b = 0; b < blocks; ++b)
+            {
+                const int begin = b * block;
+                const int end = std::min(cols, begin + block);
+                multiply_columns(weights.row(0), rows, cols, &input[0], &output[0], begin, end);
+                for (int k = begin; k < end; ++k)
+                {
+                    output[k] = 1.0f / (1.0f + std::exp(-beta * output[k]));
+                }
+            }
+        }
+
+        void forward_sparse(const SparseLayer& weights, const std::vector<float>& input, std::vector<float>& output, const float beta)
+        {
+            const int cols = weights.cols();
+            const int group = weights.group_width();
+            const int groups = (cols + group - 1) / group;
+#pragma omp parallel for
+            for (int g = 0; g < groups; ++g)
+            {
+                const int begin = g * group;
+                const int end = std::min(cols, begin + group);
+                weights.multiply(&input[0], &output[0], begin, end);
+                for (int k = begin; k < end; ++k)
+                {
+                    output[k] = 1.0f / (1.0f + std::exp(-beta * output[k]));
+                }
+            }
+        }
+
+        template <typename To, typename From>
+        void convert_layers(const std::vector<WeightLayer<From, int>>& from, std::vector<WeightLayer<To, int>>& to)
+        {
+            to.clear();
+            for (size_t l = 0; l < from.size(); ++l)
+            {
+                const int rows = from[l].get_rows();
+                const int cols = from[l].get_cols();
+                to.push_back(WeightLayer<To, int>(rows, cols));
+                for (int i = 0; i < rows; ++i)
+                {
+                    const From* source = from[l].row(i);
+                    To* destination = to.back().row(i);
+                    for (int j = 0; j < cols; ++j)
+                    {
+                        destination[j] = To(static_cast<float>(source[j]));
+                    }
+                }
+            }
+        }
+
+        template <typename T>
+        void copy_parameters_out(const std::vector<WeightLayer<T, int>>& layers, float* parameters)
+        {
+            for (size_t l = 0; l < layers.size(); ++l)
+            {
+                const size_t size = static_cast<size_t>(layers[l].get_rows()) * static_cast<size_t>(layers[l].get_cols());
+                for (size_t i = 0; i < size; ++i)
+                {
+                    parameters[i] = static_cast<float>(layers[l].row(0)[i]);
+                }
+                parameters += size;
+            }
+        }
+
+        template <typename T>
+        void copy_parameters_in(const float* parameters, std::vector<WeightLayer<T, int>>& layers)
+        {
+            for (size_t l = 0; l < layers.size(); ++l)
+            {
+                const size_t size = static_cast<size_t>(layers[l].get_rows()) * static_cast<size_t>(layers[l].get_cols());
+                for (size_t i = 0; i < size; ++i)
+                {
+                    layers[l].row(0)[i] = T(parameters[i]);
+                }
+                parameters += size;
+            }
+        }
+
+        template <typename T>
+        void write_bits(std::ofstream& stream, const std::vector<WeightLayer<T, int>>& layers)
+        {
+            std::ios::fmtflags flags = stream.flags();
+            char fill = stream.fill('0');
+            stream << std::hex;
+            for (size_t l = 0; l < layers.size(); ++l)
+            {
+                const size_t size = static_cast<size_t>(layers[l].get_rows()) * static_cast<size_t>(layers[l].get_cols());
+                for (size_t i = 0; i < size; ++i)
+                {
+                    stream << std::setw(4) << layers[l].row(0)[i].bits << " ";
+                }
+                stream << "\n";
+            }
+            stream.fill(fill);
+            stream.flags(flags);
+        }
+
+        template <typename T>
+        void read_bits(std::ifstream& stream, std::vector<WeightLayer<T, int>>& layers)
+        {
+            std::ios::fmtflags flags = stream.flags();
+            stream >> std::hex;
+            for (size_t l = 0; l < layers.size(); ++l)
+            {
+                const size_t size = static_cast<size_t>(layers[l].get_rows()) * static_cast<size_t>(layers[l].get_cols());
+                for (size_t i = 0; i < size; ++i)
+                {
+                    stream >> layers[l].row(0)[i].bits;
+                }
+            }
+            stream.flags(flags);
+        }
+    }
+
+    bool parse_precision(const std::string& name, WeightPrecision& precision)
+    {
+        if (name == "fp32")
+        {
+            precision = PRECISION_FP32;
+        }
+        else if (name == "fp16")
+        {
+            precision = PRECISION_FP16;
+        }
+        else if (name == "bf16")
+        {
+            precision = PRECISION_BF16;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    std::string precision_name(const WeightPrecision precision)
+    {
+        switch (precision)
+        {
+        case PRECISION_FP16:
+            return "fp16";
+        case PRECISION_BF16:
+            return "bf16";
+        default:
+            return "fp32";
+        }
+    }
+
+    MLPClassifier::MLPClassifier(bool verbose) : _verbose(verbose), _learning_rate(0.1f), _beta(1.0f), _step(0), _precision(PRECISION_FP32), _block_rows(0), _block_cols(0), _sparse_threshold(0.3f), _gen(_rd()), _dist(-1.0, 1.0)
+    {
+    }
+
+    MLPClassifier::MLPClassifier(const MLPClassifier& other) :
+        _verbose(other._verbose),
+        _learning_rate(other._learning_rate),
+        _beta(other._beta),
+        _optimizer(other._optimizer),
+        _schedule(other._schedule),
+        _step(other._step),
+        _first_moment(other._first_moment),
+        _second_moment(other._second_moment),
+        _layer_counts(other._layer_counts),
+        _precision(other._precision),
+        _weights(other._weights),
+        _weights_fp16(other._weights_fp16),
+        _weights_bf16(other._weights_bf16),
+        _masks(other._masks),
+        _block_rows(other._block_rows),
+        _block_cols(other._block_cols),
+        _sparse_threshold(other._sparse_threshold),
+        _sparse(other._sparse),
+        _use_sparse(other._use_sparse),
+        _layers(other._layers),
+        _errors(other._errors),
+        _gen(_rd()),
+        _dist(-1.0, 1.0)
     {
     }
 
@@ -33,8 +224,16 @@ namespace classifiers
         }
         _learning_rate = learning_rate;
         _beta = beta;
+        _precision = PRECISION_FP32;
         _layer_counts.clear();
         _weights.clear();
+        _weights_fp16.clear();
+        _weights_bf16.clear();
+        _masks.clear();
+        _block_rows = 0;
+        _block_cols = 0;
+        _sparse.clear();
+        _use_sparse.clear();
         _layers.clear();
         _errors.clear();
 
@@ -64,12 +263,13 @@ namespace classifiers
         {
             _errors.emplace_back(_layer_counts[l], 0.0f);
         }
+        reset_optimizer_state();
     }
 
-    void MLPClassifier::train(const std::vector<float>& input, const std::vector<float>& target)
+    void MLPClassifier::train(const std::vector<float>& input, const std::vector<float>& target, const float weight)
     {
         feed_forward(input);
-        back_propagation(target);
+        back_propagation(target, weight);
     }
 
     void MLPClassifier::classify(const std::vector<float>& input, std::vector<float>& output)
@@ -81,8 +281,7 @@ namespace classifiers
     void MLPClassifier::feed_forward(const std::vector<float>& input)
     {
         // process input layer to hidden layer 0
-        const int rows = _weights[0].get_rows();
-        const int cols = _weights[0].get_cols();
+        const int rows = _layer_counts[0];
         if (input.size() != rows)
         {
             std::cerr << "Error: Input is the wrong size: " << input.size() << " != " << rows << "\n";
@@ -93,28 +292,38 @@ namespace classifiers
         int layers = static_cast<int>(_layer_counts.size());
         for (int l = 1; l < layers; ++l)
         {
-            const int prev_layer_size = _weights[l - 1].get_rows();
-            const int current_layer_size = _weights[l - 1].get_cols();
-#pragma omp parallel for
-            for (int k = 0; k < current_layer_size; ++k)
+            if (uses_sparse(l - 1))
             {
-                _layers[l][k] = 0.0f;
-                for (int j = 0; j < prev_layer_size; ++j)
-                {
-                    _layers[l][k] += _weights[l - 1].get_value(j, k) * _layers[l - 1][j];
-                }
-                _layers[l][k] = 1.0f / (1.0f + std::exp(-_beta * _layers[l][k]));
+                forward_sparse(_sparse[l - 1], _layers[l - 1], _layers[l], _beta);
+                continue;
+            }
+            switch (_precision)
+            {
+            case PRECISION_FP16:
+                forward_layer(_weights_fp16[l - 1], _layers[l - 1], _layers[l], _beta);
+                break;
+            case PRECISION_BF16:
+                forward_layer(_weights_bf16[l - 1], _layers[l - 1], _layers[l], _beta);
+                break;
+            default:
+                forward_layer(_weights[l - 1], _layers[l - 1], _layers[l], _beta);
+                break;
             }
         }
     }
 
-    void MLPClassifier::back_propagation(const std::vector<float>& target)
+    void MLPClassifier::back_propagation(const std::vector<float>& target, const float weight)
     {
         if (target.size() != _layer_counts.back())
         {
             std::cerr << "Target layer is not the correct size: " << target.size() << " != " << _layer_counts.back() << "\n";
             return;
         }
+        if (_precision != PRECISION_FP32)
+        {
+            std::cerr << "Error: " << precision_name(_precision) << " weights can not be trained, convert them to fp32\n";
+            return;
+        }
         int layers = static_cast<int>(_layer_counts.size());
         {
             int l = layers - 1;
@@ -149,22 +358,69 @@ namespace classifiers
             }
         }
 
+        allocate_optimizer_state();
+        if (!_sparse.empty())
+        {
+            _sparse.clear();
+            _use_sparse.clear();
+        }
+        // sample weights scale the gradient, the schedule scales the step
+        const float learning_rate = current_learning_rate();
+        const OptimizerType type = _optimizer.type;
+        const float momentum = _optimizer.momentum;
+        const float beta1 = _optimizer.beta1;
+        const float beta2 = _optimizer.beta2;
+        const float epsilon = _optimizer.epsilon;
+        const float t = static_cast<float>(_step + 1);
+        const float correction1 = 1.0f - std::pow(beta1, t);
+        const float correction2 = 1.0f - std::pow(beta2, t);
         for (int l = layers - 2; l >= 0; --l)
         {
             if (_verbose)
                 std::cout << "updating weights " << l + 1 << "\n";
             int current_layer_size = _layers[l].size();
             int next_layer_size = _layers[l + 1].size();
+            const float* errors = &_errors[l][0];
 #pragma omp parallel for
             for (int j = 0; j < current_layer_size; ++j) // current layer
             {
-                float activation = _layers[l][j];
+                const float scale = weight * _layers[l][j];
+                float* weights = _weights[l].row(j);
+                float* velocity = type != OPTIMIZER_SGD ? _first_moment[l].row(j) : NULL;
+                float* second = type == OPTIMIZER_ADAM ? _second_moment[l].row(j) : NULL;
+                const unsigned char* mask = _masks.empty() ? NULL : &_masks[l][j * next_layer_size];
                 for (int k = 0; k < next_layer_size; ++k) // next layer
                 {
-                    _weights[l].set_value(j, k, _weights[l].get_value(j, k) + _learning_rate * _errors[l][k] * activation);
+                    // pruned weights stay zero
+                    if (mask && !mask[k])
+                    {
+                        continue;
+                    }
+                    // descent direction for this weight
+                    const float delta = errors[k] * scale;
+                    switch (type)
+                    {
+                    case OPTIMIZER_MOMENTUM:
+                        velocity[k] = momentum * velocity[k] + delta;
+                        weights[k] += learning_rate * velocity[k];
+                        break;
+                    case OPTIMIZER_NESTEROV:
+                        velocity[k] = momentum * velocity[k] + delta;
+                        weights[k] += learning_rate * (delta + momentum * velocity[k]);
+                        break;
+                    case OPTIMIZER_ADAM:
+                        velocity[k] = beta1 * velocity[k] + (1.0f - beta1) * delta;
+                        second[k] = beta2 * second[k] + (1.0f - beta2) * delta * delta;
+                        weights[k] += learning_rate * (velocity[k] / correction1) / (std::sqrt(second[k] / correction2) + epsilon);
+                        break;
+                    default:
+                        weights[k] += learning_rate * delta;
+                        break;
+                    }
                 }
             }
         }
+        _step++;
     }
 
     void MLPClassifier::get_output_layer(std::vector<float>& output)
@@ -179,7 +435,18 @@ namespace classifiers
 
     void MLPClassifier::write(std::ofstream& stream) const
     {
-        stream << "nn\n";
+        switch (_precision)
+        {
+        case PRECISION_FP16:
+            stream << (_masks.empty() ? "nn16\n" : "nn16sp\n");
+            break;
+        case PRECISION_BF16:
+            stream << (_masks.empty() ? "nnbf16\n" : "nnbf16sp\n");
+            break;
+        default:
+            stream << (_masks.empty() ? "nn\n" : "nnsp\n");
+            break;
+        }
         int layers = static_cast<int>(_layer_counts.size());
         stream << layers << "\n";
         stream << _learning_rate << "\n";
@@ -189,6 +456,55 @@ namespace classifiers
             stream << _layer_counts[l] << "\n";
         }
 
+        if (_precision != PRECISION_FP32)
+        {
+            if (_precision == PRECISION_FP16)
+            {
+                write_bits(stream, _weights_fp16);
+            }
+            else
+            {
+                write_bits(stream, _weights_bf16);
+            }
+            if (!_masks.empty())
+            {
+                // pruned weights are stored densely, the masks follow as one 0 / 1 string per layer
+                stream << _block_rows << " " << _block_cols << "\n";
+                for (size_t l = 0; l < _masks.size(); ++l)
+                {
+                    for (size_t i = 0; i < _masks[l].size(); ++i)
+                    {
+                        stream << (_masks[l][i] ? '1' : '0');
+                    }
+                    stream << "\n";
+                }
+            }
+            return;
+        }
+        if (!_masks.empty())
+        {
+            // each row as its unpruned count followed by column, weight pairs
+            stream << _block_rows << " " << _block_cols << "\n";
+            for (int l = 0; l < layers - 1; ++l)
+            {
+                const int rows = _weights[l].get_rows();
+                const int cols = _weights[l].get_cols();
+                for (int i = 0; i < rows; ++i)
+                {
+                    const unsigned char* mask = &_masks[l][i * cols];
+                    stream << std::count(mask, mask + cols, 1) << " ";
+                    for (int j = 0; j < cols; ++j)
+                    {
+                        if (mask[j])
+                        {
+                            stream << j << " " << _weights[l].get_value(i, j) << " ";
+                        }
+                    }
+                }
+                stream << "\n";
+            }
+            return;
+        }
         for (int l = 0; l < layers - 1; ++l)
         {
             const int rows = _weights[l].get_rows();
@@ -208,7 +524,17 @@ namespace classifiers
     {
         std::string type;
         stream >> type;
-        if (type != "nn")
+        WeightPrecision precision = PRECISION_FP32;
+        bool sparse = type == "nnsp" || type == "nn16sp" || type == "nnbf16sp";
+        if (type == "nn16" || type == "nn16sp")
+        {
+            precision = PRECISION_FP16;
+        }
+        else if (type == "nnbf16" || type == "nnbf16sp")
+        {
+            precision = PRECISION_BF16;
+        }
+        else if (type != "nn" && !sparse)
         {
             std::cerr << "Error: MLPClassifier is not a neural network.\n";
             return;
@@ -224,8 +550,16 @@ namespace classifiers
         stream >> _learning_rate;
         stream >> _beta;
 
+        _precision = precision;
         _layer_counts.clear();
         _weights.clear();
+        _weights_fp16.clear();
+        _weights_bf16.clear();
+        _masks.clear();
+        _block_rows = 0;
+        _block_cols = 0;
+        _sparse.clear();
+        _use_sparse.clear();
         _layers.clear();
         _errors.clear();
 
@@ -238,10 +572,81 @@ namespace classifiers
 
         for (int l = 0; l < layers - 1; ++l)
         {
-            _weights.push_back(WeightLayer<float, int>(_layer_counts[l], _layer_counts[l + 1]));
+            switch (_precision)
+            {
+            case PRECISION_FP16:
+                _weights_fp16.push_back(WeightLayer<float16, int>(_layer_counts[l], _layer_counts[l + 1]));
+                break;
+            case PRECISION_BF16:
+                _weights_bf16.push_back(WeightLayer<bfloat16, int>(_layer_counts[l], _layer_counts[l + 1]));
+                break;
+            default:
+                _weights.push_back(WeightLayer<float, int>(_layer_counts[l], _layer_counts[l + 1]));
+                break;
+            }
         }
 
-        for (int l = 0; l < layers - 1; ++l)
+        if (_precision != PRECISION_FP32)
+        {
+            if (_precision == PRECISION_FP16)
+            {
+                read_bits(stream, _weights_fp16);
+            }
+            else
+            {
+                read_bits(stream, _weights_bf16);
+            }
+            if (sparse)
+            {
+                stream >> _block_rows >> _block_cols;
+                for (int l = 0; l < layers - 1; ++l)
+                {
+                    const size_t size = static_cast<size_t>(_layer_counts[l]) * _layer_counts[l + 1];
+                    std::string bits;
+                    stream >> bits;
+                    if (bits.size() != size)
+                    {
+                        std::cerr << "Error: Pruning mask for layer " << l << " has " << bits.size() << " entries, expected " << size << "\n";
+                        _masks.clear();
+                        break;
+                    }
+                    _masks.push_back(std::vector<unsigned char>(size, 0));
+                    for (size_t i = 0; i < size; ++i)
+                    {
+                        _masks[l][i] = bits[i] == '1' ? 1 : 0;
+                    }
+                }
+            }
+        }
+        else if (sparse)
+        {
+            stream >> _block_rows >> _block_cols;
+            for (size_t l = 0; l < _weights.size(); ++l)
+            {
+                const int rows = _weights[l].get_rows();
+                const int cols = _weights[l].get_cols();
+                _masks.push_back(std::vector<unsigned char>(static_cast<size_t>(rows) * cols, 0));
+                for (int i = 0; i < rows; ++i)
+                {
+                    int count = 0;
+                    stream >> count;
+                    for (int n = 0; n < count; ++n)
+                    {
+                        int j = 0;
+                        float value = 0.0f;
+                        stream >> j >> value;
+                        if (j < 0 || j >= cols)
+                        {
+                            std::cerr << "Error: Sparse weight column out of range: " << j << "\n";
+                            continue;
+                        }
+                        _masks[l][i * cols + j] = 1;
+                        _weights[l].set_value(i, j, value);
+                    }
+                }
+            }
+        }
+        for (size_t l = 0; !sparse && l < _weights.size(); ++l)
         {
             const int rows = _weights[l].get_rows();
             const int cols = _weights[l].get_cols();
@@ -263,5 +668,394 @@ namespace classifiers
         {
             _errors.emplace_back(_layer_counts[l], 0.0f);
         }
+        reset_optimizer_state();
+        compile_sparse();
+    }
+
+    void MLPClassifier::prune_magnitude(const float sparsity)
+    {
+        if (_precision != PRECISION_FP32)
+        {
+            std::cerr << "Error: Only fp32 weights can be pruned\n";
+            return;
+        }
+        if (_masks.empty())
+        {
+            for (size_t l = 0; l < _weights.size(); ++l)
+            {
+                _masks.push_back(std::vector<unsigned char>(static_cast<size_t>(_weights[l].get_rows()) * _weights[l].get_cols(), 1));
+            }
+        }
+        for (size_t l = 0; l + 1 < _weights.size(); ++l)
+        {
+            const size_t size = _masks[l].size();
+            const size_t pruned = static_cast<size_t>(static_cast<double>(size) * std::max(0.0f, std::min(1.0f, sparsity)));
+            float* weights = _weights[l].row(0);
+            std::vector<size_t> order(size);
+            for (size_t i = 0; i < size; ++i)
+            {
+                order[i] = i;
+            }
+            std::nth_element(order.begin(), order.begin() + pruned, order.end(),
+                             [&](const size_t a, const size_t b)
+                             {
+                                 return std::abs(weights[a]) < std::abs(weights[b]);
+                             });
+            for (size_t i = 0; i < pruned; ++i)
+            {
+                _masks[l][order[i]] = 0;
+                weights[order[i]] = 0.0f;
+            }
+        }
+        compile_sparse();
+    }
+
+    void MLPClassifier::prune_blocks(const float sparsity, const int block_rows, const int block_cols)
+    {
+        if (_precision != PRECISION_FP32)
+        {
+            std::cerr << "Error: Only fp32 weights can be pruned\n";
+            return;
+        }
+        if (block_rows < 1 || block_cols < 1)
+        {
+            std::cerr << "Error: Invalid prune block size " << block_rows << "x" << block_cols << "\n";
+            return;
+        }
+        if (_masks.empty())
+        {
+            for (size_t l = 0; l < _weights.size(); ++l)
+            {
+                _masks.push_back(std::vector<unsigned char>(static_cast<size_t>(_weights[l].get_rows()) * _weights[l].get_cols(), 1));
+            }
+        }
+        _block_rows = block_rows;
+        _block_cols = block_cols;
+        for (size_t l = 0; l + 1 < _weights.size(); ++l)
+        {
+            const int rows = _weights[l].get_rows();
+            const int cols = _weights[l].get_cols();
+            const int row_blocks = (rows + block_rows - 1) / block_rows;
+            const int col_blocks = (cols + block_cols - 1) / block_cols;
+            std::vector<float> scores(static_cast<size_t>(row_blocks) * col_blocks, 0.0f);
+            for (int i = 0; i < rows; ++i)
+            {
+                for (int j = 0; j < cols; ++j)
+                {
+                    scores[(i / block_rows) * col_blocks + j / block_cols] += std::abs(_weights[l].get_value(i, j));
+                }
+            }
+            for (int rb = 0; rb < row_blocks; ++rb)
+            {
+                for (int cb = 0; cb < col_blocks; ++cb)
+                {
+                    const int height = std::min(block_rows, rows - rb * block_rows);
+                    const int width = std::min(block_cols, cols - cb * block_cols);
+                    scores[rb * col_blocks + cb] /= static_cast<float>(height * width);
+                }
+            }
+            const size_t pruned = static_cast<size_t>(static_cast<double>(scores.size()) * std::max(0.0f, std::min(1.0f, sparsity)));
+            std::vector<size_t> order(scores.size());
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                order[i] = i;
+            }
+            std::nth_element(order.begin(), order.begin() + pruned, order.end(),
+                             [&](const size_t a, const size_t b)
+                             {
+                                 return scores[a] < scores[b];
+                             });
+            for (size_t b = 0; b < pruned; ++b)
+            {
+                const int rb = static_cast<int>(order[b]) / col_blocks;
+                const int cb = static_cast<int>(order[b]) % col_blocks;
+                for (int i = rb * block_rows; i < std::min(rows, (rb + 1) * block_rows); ++i)
+                {
+                    for (int j = cb * block_cols; j < std::min(cols, (cb + 1) * block_cols); ++j)
+                    {
+                        _masks[l][i * cols + j] = 0;
+                        _weights[l].set_value(i, j, 0.0f);
+                    }
+                }
+            }
+        }
+        compile_sparse();
+    }
+
+    float MLPClassifier::density(const int layer) const
+    {
+        if (_masks.empty() || layer < 0 || layer >= static_cast<int>(_masks.size()) || _masks[layer].empty())
+        {
+            return 1.0f;
+        }
+        size_t kept = std::count(_masks[layer].begin(), _masks[layer].end(), 1);
+        return static_cast<float>(kept) / static_cast<float>(_masks[layer].size());
+    }
+
+    void MLPClassifier::set_sparse_threshold(const float density)
+    {
+        _sparse_threshold = density;
+        compile_sparse();
+    }
+
+    bool MLPClassifier::uses_sparse(const int layer) const
+    {
+        return _precision == PRECISION_FP32 && layer >= 0 && layer < static_cast<int>(_use_sparse.size()) && _use_sparse[layer];
+    }
+
+    void MLPClassifier::compile_sparse()
+    {
+        _sparse.clear();
+        _use_sparse.clear();
+        if (_masks.empty() || _precision != PRECISION_FP32)
+        {
+            return;
+        }
+        _sparse.resize(_weights.size());
+        _use_sparse.assign(_weights.size(), false);
+        for (size_t l = 0; l < _weights.size(); ++l)
+        {
+            if (density(static_cast<int>(l)) < _sparse_threshold)
+            {
+                _sparse[l].build(_weights[l], _masks[l], _block_rows, _block_cols);
+                _use_sparse[l] = true;
+            }
+        }
+    }
+
+    void MLPClassifier::set_precision(const WeightPrecision precision)
+    {
+        if (precision == _precision)
+        {
+            return;
+        }
+        if (_precision != PRECISION_FP32 && precision != PRECISION_FP32)
+        {
+            set_precision(PRECISION_FP32);
+        }
+        if (_precision == PRECISION_FP16)
+        {
+            convert_layers(_weights_fp16, _weights);
+            _weights_fp16.clear();
+        }
+        else if (_precision == PRECISION_BF16)
+        {
+            convert_layers(_weights_bf16, _weights);
+            _weights_bf16.clear();
+        }
+        else if (precision == PRECISION_FP16)
+        {
+            convert_layers(_weights, _weights_fp16);
+            _weights.clear();
+        }
+        else
+        {
+            convert_layers(_weights, _weights_bf16);
+            _weights.clear();
+        }
+        // moments are rebuilt when training resumes in fp32
+        if (precision != PRECISION_FP32)
+        {
+            _first_moment.clear();
+            _second_moment.clear();
+        }
+        _precision = precision;
+        compile_sparse();
+    }
+
+    WeightPrecision MLPClassifier::precision() const
+    {
+        return _precision;
+    }
+
+    void MLPClassifier::set_learning_rate(const float learning_rate)
+    {
+        _learning_rate = learning_rate;
+    }
+
+    void MLPClassifier::set_optimizer(const OptimizerOptions& optimizer)
+    {
+        bool changed = optimizer.type != _optimizer.type;
+        _optimizer = optimizer;
+        if (changed)
+        {
+            reset_optimizer_state();
+        }
+    }
+
+    void MLPClassifier::set_schedule(const LearningRateSchedule& schedule)
+    {
+        _schedule = schedule;
+    }
+
+    float MLPClassifier::current_learning_rate() const
+    {
+        return _schedule.rate(_learning_rate, _step);
+    }
+
+    size_t MLPClassifier::parameter_count() const
+    {
+        size_t count = 0;
+        for (size_t l = 0; l + 1 < _layer_counts.size(); ++l)
+        {
+            count += static_cast<size_t>(_layer_counts[l]) * static_cast<size_t>(_layer_counts[l + 1]);
+        }
+        return count;
+    }
+
+    void MLPClassifier::get_parameters(float* parameters) const
+    {
+        switch (_precision)
+        {
+        case PRECISION_FP16:
+            copy_parameters_out(_weights_fp16, parameters);
+            break;
+        case PRECISION_BF16:
+            copy_parameters_out(_weights_bf16, parameters);
+            break;
+        default:
+            copy_parameters_out(_weights, parameters);
+            break;
+        }
+    }
+
+    void MLPClassifier::set_parameters(const float* parameters)
+    {
+        switch (_precision)
+        {
+        case PRECISION_FP16:
+            copy_parameters_in(parameters, _weights_fp16);
+            break;
+        case PRECISION_BF16:
+            copy_parameters_in(parameters, _weights_bf16);
+            break;
+        default:
+            copy_parameters_in(parameters, _weights);
+            break;
+        }
+        if (!_sparse.empty())
+        {
+            compile_sparse();
+        }
+    }
+
+    size_t MLPClassifier::steps() const
+    {
+        return _step;
+    }
+
+    void MLPClassifier::reset_optimizer_state()
+    {
+        _step = 0;
+        _first_moment.clear();
+        _second_moment.clear();
+    }
+
+    void MLPClassifier::allocate_optimizer_state()
+    {
+        // plain sgd keeps no moments, models only used for inference never allocate them
+        if (_optimizer.type != OPTIMIZER_SGD && _first_moment.size() != _weights.size())
+        {
+            _first_moment.clear();
+            for (size_t l = 0; l < _weights.size(); ++l)
+            {
+                _first_moment.push_back(WeightLayer<float, int>(_weights[l].get_rows(), _weights[l].get_cols()));
+            }
+        }
+        if (_optimizer.type == OPTIMIZER_ADAM && _second_moment.size() != _weights.size())
+        {
+            _second_moment.clear();
+            for (size_t l = 0; l < _weights.size(); ++l)
+            {
+                _second_moment.push_back(WeightLayer<float, int>(_weights[l].get_rows(), _weights[l].get_cols()));
+            }
+        }
+    }
+
+    void MLPClassifier::write_optimizer(std::ofstream& stream) const
+    {
+        stream << "optimizer\n";
+        stream << optimizer_name(_optimizer.type) << "\n";
+        stream << _step << "\n";
+        stream << _weights.size() << "\n";
+        stream << std::setprecision(9);
+        const std::vector<WeightLayer<float, int>>* buffers[] = {&_first_moment, &_second_moment};
+        const bool used[] = {_optimizer.type != OPTIMIZER_SGD, _optimizer.type == OPTIMIZER_ADAM};
+        for (int b = 0; b < 2; ++b)
+        {
+            if (!used[b])
+            {
+                continue;
+            }
+            for (size_t l = 0; l < _weights.size(); ++l)
+            {
+                // moments that were never allocated are all zero
+                const bool allocated = l < buffers[b]->size();
+                const int rows = _weights[l].get_rows();
+                const int cols = _weights[l].get_cols();
+                for (int i = 0; i < rows; ++i)
+                {
+                    const float* values = allocated ? (*buffers[b])[l].row(i) : NULL;
+                    for (int j = 0; j < cols; ++j)
+                    {
+                        stream << (values ? values[j] : 0.0f) << " ";
+                    }
+                }
+                stream << "\n";
+            }
+        }
+    }
+
+    bool MLPClassifier::read_optimizer(std::ifstream& stream)
+    {
+        std::string type;
+        stream >> type;
+        if (type != "optimizer")
+        {
+            std::cerr << "Error: Not an optimizer state file\n";
+            return false;
+        }
+        std::string name;
+        size_t step = 0;
+        size_t layers = 0;
+        stream >> name >> step >> layers;
+        if (name != optimizer_name(_optimizer.type))
+        {
+            std::cerr << "Optimizer state is for " << name << " not " << optimizer_name(_optimizer.type) << ", starting fresh\n";
+            return false;
+        }
+        if (layers != _weights.size())
+        {
+            std::cerr << "Error: Optimizer state has " << layers << " layers, model has " << _weights.size() << "\n";
+            return false;
+        }
+        reset_optimizer_state();
+        allocate_optimizer_state();
+        std::vector<WeightLayer<float, int>>* buffers[] = {&_first_moment, &_second_moment};
+        for (int b = 0; b < 2; ++b)
+        {
+            for (size_t l = 0; l < buffers[b]->size(); ++l)
+            {
+                WeightLayer<float, int>& layer = (*buffers[b])[l];
+                const int rows = layer.get_rows();
+                const int cols = layer.get_cols();
+                for (int i = 0; i < rows; ++i)
+                {
+                    float* values = layer.row(i);
+                    for (int j = 0; j < cols; ++j)
+                    {
+                        stream >> values[j];
+                    }
+                }
+            }
+        }
+        if (!stream)
+        {
+            std::cerr << "Error: Optimizer state is truncated\n";
+            reset_optimizer_state();
+            return false;
+        }
+        _step = step;
+        return true;
     }
 }
@@ -0,0 +1,119 @@
+// optimizer.cpp
+// Copyright Laurence Emms 2017
+
+#include <cmath>
+#include <algorithm>
+
+#include "optimizer.h"
+
+namespace classifiers
+{
+    OptimizerOptions::OptimizerOptions() :
+        type(OPTIMIZER_SGD),
+        momentum(0.9f),
+        beta1(0.9f),
+        beta2(0.999f),
+        epsilon(1e-8f)
+    {
+    }
+
+    LearningRateSchedule::LearningRateSchedule() :
+        type(SCHEDULE_CONSTANT),
+        warmup_steps(0),
+        step_size(0),
+        gamma(0.1f),
+        total_steps(0),
+        min_rate(0.0f)
+    {
+    }
+
+    float LearningRateSchedule::rate(const float base_rate, const size_t step) const
+    {
+        if (step < warmup_steps)
+        {
+            return base_rate * static_cast<float>(step + 1) / static_cast<float>(warmup_steps);
+        }
+        const size_t decay_step = step - warmup_steps;
+        switch (type)
+        {
+        case SCHEDULE_STEP:
+            if (step_size == 0)
+            {
+                return base_rate;
+            }
+            return base_rate * std::pow(gamma, static_cast<float>(decay_step / step_size));
+        case SCHEDULE_COSINE:
+        {
+            if (total_steps <= warmup_steps)
+            {
+                return base_rate;
+            }
+            const float progress = std::min(1.0f, static_cast<float>(decay_step) / static_cast<float>(total_steps - warmup_steps));
+            return min_rate + 0.5f * (base_rate - min_rate) * (1.0f + std::cos(3.14159265f * progress));
+        }
+        default:
+            return base_rate;
+        }
+    }
+
+    bool parse_optimizer_type(const std::string& name, OptimizerType& type)
+    {
+        if (name == "sgd")
+        {
+            type = OPTIMIZER_SGD;
+        }
+        else if (name == "momentum")
+        {
+            type = OPTIMIZER_MOMENTUM;
+        }
+        else if (name == "nesterov")
+        {
+            type = OPTIMIZER_NESTEROV;
+        }
+        else if (name == "adam")
+        {
+            type = OPTIMIZER_ADAM;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    std::string optimizer_name(const OptimizerType type)
+    {
+        switch (type)
+        {
+        case OPTIMIZER_MOMENTUM:
+            return "momentum";
+        case OPTIMIZER_NESTEROV:
+            return "nesterov";
+        case OPTIMIZER_ADAM:
+            return "adam";
+        default:
+            return "sgd";
+        }
+    }
+
+    bool parse_schedule_type(const std::string& name, ScheduleType& type)
+    {
+        if (name == "constant")
+        {
+            type = SCHEDULE_CONSTANT;
+        }
+        else if (name == "step")
+        {
+            type = SCHEDULE_STEP;
+        }
+        else if (name == "cosine")
+        {
+            type = SCHEDULE_COSINE;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,39 @@
+// patchinput.cpp
+// Copyright Laurence Emms 2017
+
+#include "patchinput.h"
+
+namespace classifiers
+{
+    void fill_input(std::vector<float>& input_vector,
+                    const std::list<cv::Mat>& frames,
+                    const int x,
+                    const int y,
+                    const int w,
+                    const int h)
+    {
+        int w_offset = w / 2;
+        int h_offset = h / 2;
+        std::list<cv::Mat>::const_iterator current_frame = frames.begin();
+
+        int it_f = 0;
+        while (current_frame != frames.end())
+        {
+            int it_y = 0;
+            for (int y_o = -h_offset; y_o < h_offset; ++y_o)
+            {
+                int it_x = 0;
+                for (int x_o = -w_offset; x_o < w_offset; ++x_o)
+                {
+                    cv::Vec3b texel = current_frame->at<cv::Vec3b>(y + y_o, x + x_o);
+                    float luminance = (0.2126f * static_cast<float>(texel[0]) + 0.7512f * static_cast<float>(texel[1]) + 0.0722f * static_cast<float>(texel[2])) / 255.0f;
+                    input_vector[it_x + it_y * w + it_f * w * h] = luminance;
+                    it_x++;
+                }
+                it_y++;
+            }
+            current_frame++;
+            it_f++;
+        }
+    }
+}
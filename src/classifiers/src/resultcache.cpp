@@ -0,0 +1,174 @@
+// resultcache.cpp
+// Copyright Laurence Emms 2017
+
+#include "resultcache.h"
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace classifiers
+{
+    namespace
+    {
+        const uint64_t fnv_prime = 1099511628211ULL;
+    }
+
+    uint64_t hash_bytes(const void* data, const size_t size, const uint64_t seed)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        uint64_t hash = seed;
+        // hash a word at a time, the bytes only need to be fingerprinted, not stable across endianness
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, bytes + i, sizeof(uint64_t));
+            hash ^= word;
+            hash *= fnv_prime;
+        }
+        for (; i < size; ++i)
+        {
+            hash ^= static_cast<uint64_t>(bytes[i]);
+            hash *= fnv_prime;
+        }
+        return hash;
+    }
+
+    uint64_t hash_file(const std::string& path)
+    {
+        std::ifstream stream(path.c_str(), std::ios::binary);
+        if (!stream)
+        {
+            std::cerr << "Error: Failed to open file for hashing: " << path << "\n";
+            return 0;
+        }
+        uint64_t hash = 14695981039346656037ULL;
+        std::vector<char> buffer(1 << 16);
+        while (stream)
+        {
+            stream.read(&buffer[0], buffer.size());
+            const std::streamsize count = stream.gcount();
+            if (count <= 0)
+            {
+                break;
+            }
+            hash = hash_bytes(&buffer[0], static_cast<size_t>(count), hash);
+        }
+        return hash;
+    }
+
+    uint64_t hash_frame(const cv::Mat& frame)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        const int header[3] = {frame.rows, frame.cols, frame.type()};
+        hash = hash_bytes(header, sizeof(header), hash);
+        const size_t row_bytes = static_cast<size_t>(frame.cols) * frame.elemSize();
+        if (frame.isContinuous())
+        {
+            return hash_bytes(frame.ptr(0), row_bytes * frame.rows, hash);
+        }
+        for (int y = 0; y < frame.rows; ++y)
+        {
+            hash = hash_bytes(frame.ptr(y), row_bytes, hash);
+        }
+        return hash;
+    }
+
+    uint64_t combine_hash(const uint64_t seed, const uint64_t value)
+    {
+        return hash_bytes(&value, sizeof(value), seed);
+    }
+
+    ResultCache::ResultCache() : _open(false), _hits(0), _misses(0)
+    {
+    }
+
+    bool ResultCache::open(const std::string& cache_dir, const uint64_t model_hash)
+    {
+        _open = false;
+        _results.clear();
+        boost::system::error_code ec;
+        fs::create_directories(cache_dir, ec);
+        if (!fs::is_directory(cache_dir))
+        {
+            std::cerr << "Error: Failed to create cache directory: " << cache_dir << "\n";
+            return false;
+        }
+
+        std::stringstream name;
+        name << std::hex << std::setfill('0') << std::setw(16) << model_hash << ".cache";
+        fs::path cache_path = fs::path(cache_dir) / name.str();
+
+        if (fs::exists(cache_path))
+        {
+            std::ifstream cache_file(cache_path.string().c_str());
+            uint64_t key = 0;
+            FrameResult result;
+            // a truncated trailing entry from an interrupted run stops the read
+            while (cache_file >> std::hex >> key >> std::dec >> result.output_fraction >> result.mean_output)
+            {
+                _results[key] = result;
+            }
+        }
+        std::cout << "Read " << _results.size() << " cached results from: " << cache_path.string() << "\n";
+
+        _stream.open(cache_path.string().c_str(), std::ios::app);
+        if (!_stream)
+        {
+            std::cerr << "Error: Failed to open cache file for writing: " << cache_path.string() << "\n";
+            return false;
+        }
+        _open = true;
+        return true;
+    }
+
+    bool ResultCache::is_open() const
+    {
+        return _open;
+    }
+
+    bool ResultCache::find(const uint64_t key, FrameResult& result)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::unordered_map<uint64_t, FrameResult>::const_iterator it = _results.find(key);
+        if (it == _results.end())
+        {
+            _misses++;
+            return false;
+        }
+        _hits++;
+        result = it->second;
+        return true;
+    }
+
+    void ResultCache::insert(const uint64_t key, const FrameResult& result)
+    {
+        if (!_open)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _results[key] = result;
+        _stream << std::hex << key << std::dec << " " << result.output_fraction << " " << result.mean_output << "\n";
+        // flush per frame so an interrupted run keeps everything it has inferred
+        _stream.flush();
+    }
+
+    size_t ResultCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _hits;
+    }
+
+    size_t ResultCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _misses;
+    }
+}
@@ -0,0 +1,141 @@
+// sparselayer.cpp
+// Copyright Laurence Emms 2017
+
+#include "sparselayer.h"
+
+#include <algorithm>
+
+#include "mlpclassifier.h"
+
+namespace classifiers
+{
+    SparseLayer::SparseLayer() : _rows(0), _cols(0), _block_rows(0), _block_cols(0)
+    {
+    }
+
+    void SparseLayer::build(const WeightLayer<float, int>& weights,
+                            const std::vector<unsigned char>& mask,
+                            const int block_rows,
+                            const int block_cols)
+    {
+        _rows = weights.get_rows();
+        _cols = weights.get_cols();
+        _block_rows = block_rows > 0 && block_cols > 0 ? block_rows : 0;
+        _block_cols = block_rows > 0 && block_cols > 0 ? block_cols : 0;
+        _starts.clear();
+        _indices.clear();
+        _values.clear();
+        if (_block_rows == 0)
+        {
+            for (int k = 0; k < _cols; ++k)
+            {
+                _starts.push_back(static_cast<int>(_indices.size()));
+                for (int j = 0; j < _rows; ++j)
+                {
+                    if (mask[j * _cols + k])
+                    {
+                        _indices.push_back(j);
+                        _values.push_back(weights.row(j)[k]);
+                    }
+                }
+            }
+            _starts.push_back(static_cast<int>(_indices.size()));
+            return;
+        }
+        const int row_blocks = (_rows + _block_rows - 1) / _block_rows;
+        const int col_blocks = (_cols + _block_cols - 1) / _block_cols;
+        for (int cb = 0; cb < col_blocks; ++cb)
+        {
+            _starts.push_back(static_cast<int>(_indices.size()));
+            for (int rb = 0; rb < row_blocks; ++rb)
+            {
+                bool present = false;
+                for (int r = rb * _block_rows; !present && r < std::min(_rows, (rb + 1) * _block_rows); ++r)
+                {
+                    for (int c = cb * _block_cols; !present && c < std::min(_cols, (cb + 1) * _block_cols); ++c)
+                    {
+                        present = mask[r * _cols + c] != 0;
+                    }
+                }
+                if (!present)
+                {
+                    continue;
+                }
+                _indices.push_back(rb);
+                // edge tiles are padded with zeros
+                for (int r = 0; r < _block_rows; ++r)
+                {
+                    for (int c = 0; c < _block_cols; ++c)
+                    {
+                        const int j = rb * _block_rows + r;
+                        const int k = cb * _block_cols + c;
+                        const bool inside = j < _rows && k < _cols && mask[j * _cols + k];
+                        _values.push_back(inside ? weights.row(j)[k] : 0.0f);
+                    }
+                }
+            }
+        }
+        _starts.push_back(static_cast<int>(_indices.size()));
+    }
+
+    void SparseLayer::multiply(const float* input, float* output, const int begin, const int end) const
+    {
+        for (int k = begin; k < end; ++k)
+        {
+            output[k] = 0.0f;
+        }
+        if (_block_rows == 0)
+        {
+            for (int k = begin; k < end; ++k)
+            {
+                float sum = 0.0f;
+                for (int e = _starts[k]; e < _starts[k + 1]; ++e)
+                {
+                    sum += _values[e] * input[_indices[e]];
+                }
+                output[k] = sum;
+            }
+            return;
+        }
+        const int tile = _block_rows * _block_cols;
+        for (int cb = begin / _block_cols; cb * _block_cols < end; ++cb)
+        {
+            const int col = cb * _block_cols;
+            const int width = std::min(_block_cols, end - col);
+            float* sums = output + col;
+            for (int e = _starts[cb]; e < _starts[cb + 1]; ++e)
+            {
+                const int row = _indices[e] * _block_rows;
+                const int height = std::min(_block_rows, _rows - row);
+                const float* values = &_values[static_cast<size_t>(e) * tile];
+                for (int r = 0; r < height; ++r)
+                {
+                    const float x = input[row + r];
+                    for (int c = 0; c < width; ++c)
+                    {
+                        sums[c] += values[r * _block_cols + c] * x;
+                    }
+                }
+            }
+        }
+    }
+
+    int SparseLayer::group_width() const
+    {
+        if (_block_cols == 0)
+        {
+            return 16;
+        }
+        return _block_cols * std::max(1, 16 / _block_cols);
+    }
+
+    int SparseLayer::cols() const
+    {
+        return _cols;
+    }
+
+    size_t SparseLayer::stored() const
+    {
+        return _values.size();
+    }
+}
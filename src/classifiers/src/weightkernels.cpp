@@ -0,0 +1,120 @@
+// weightkernels.cpp
+// Copyright Laurence Emms 2017
+
+#include "weightkernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define WEIGHT_KERNELS_X86
+#endif
+
+namespace classifiers
+{
+    namespace
+    {
+        // rows are summed in order so every kernel produces the same result as the scalar loop
+        template <typename T>
+        void multiply_columns_scalar(const T* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end)
+        {
+            for (int k = begin; k < end; ++k)
+            {
+                output[k] = 0.0f;
+            }
+            for (int j = 0; j < rows; ++j)
+            {
+                const T* row = weights + static_cast<size_t>(j) * cols;
+                const float x = input[j];
+                for (int k = begin; k < end; ++k)
+                {
+                    output[k] += static_cast<float>(row[k]) * x;
+                }
+            }
+        }
+
+#ifdef WEIGHT_KERNELS_X86
+        // columns are processed 8 at a time with the running sums held in a register across all rows
+        __attribute__((target("avx2,f16c")))
+        void multiply_columns_f16c(const float16* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end)
+        {
+            int k = begin;
+            for (; k + 8 <= end; k += 8)
+            {
+                __m256 sum = _mm256_setzero_ps();
+                for (int j = 0; j < rows; ++j)
+                {
+                    const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + static_cast<size_t>(j) * cols + k));
+                    sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_cvtph_ps(packed), _mm256_set1_ps(input[j])));
+                }
+                _mm256_storeu_ps(output + k, sum);
+            }
+            if (k < end)
+            {
+                multiply_columns_scalar(weights, rows, cols, input, output, k, end);
+            }
+        }
+
+        // widening bfloat16 is a 16 bit shift into the upper half of each float lane
+        __attribute__((target("avx2")))
+        void multiply_columns_bf16_avx2(const bfloat16* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end)
+        {
+            int k = begin;
+            for (; k + 8 <= end; k += 8)
+            {
+                __m256 sum = _mm256_setzero_ps();
+                for (int j = 0; j < rows; ++j)
+                {
+                    const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + static_cast<size_t>(j) * cols + k));
+                    const __m256 widened = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(packed), 16));
+                    sum = _mm256_add_ps(sum, _mm256_mul_ps(widened, _mm256_set1_ps(input[j])));
+                }
+                _mm256_storeu_ps(output + k, sum);
+            }
+            if (k < end)
+            {
+                multiply_columns_scalar(weights, rows, cols, input, output, k, end);
+            }
+        }
+
+        bool has_f16c()
+        {
+            static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+            return supported;
+        }
+
+        bool has_avx2()
+        {
+            static const bool supported = __builtin_cpu_supports("avx2");
+            return supported;
+        }
+#endif
+    }
+
+    void multiply_columns(const float* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end)
+    {
+        multiply_columns_scalar(weights, rows, cols, input, output, begin, end);
+    }
+
+    void multiply_columns(const float16* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end)
+    {
+#ifdef WEIGHT_KERNELS_X86
+        if (has_f16c())
+        {
+            multiply_columns_f16c(weights, rows, cols, input, output, begin, end);
+            return;
+        }
+#endif
+        multiply_columns_scalar(weights, rows, cols, input, output, begin, end);
+    }
+
+    void multiply_columns(const bfloat16* weights, const int rows, const int cols, const float* input, float* output, const int begin, const int end)
+    {
+#ifdef WEIGHT_KERNELS_X86
+        if (has_avx2())
+        {
+            multiply_columns_bf16_avx2(weights, rows, cols, input, output, begin, end);
+            return;
+        }
+#endif
+        multiply_columns_scalar(weights, rows, cols, input, output, begin, end);
+    }
+}
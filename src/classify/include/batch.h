@@ -0,0 +1,31 @@
+// batch.h
+// Copyright Laurence Emms 2017
+
+#ifndef CLASSIFY_BATCH
+#define CLASSIFY_BATCH
+
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include <mlpclassifier.h>
+#include <resultcache.h>
+
+#include "classifyvideo.h"
+
+// a batch is either a directory of videos or a text file with one video path per line
+bool collect_batch(const boost::filesystem::path& batch_path, std::vector<std::string>& input_paths);
+
+// classifies every input on a pool of worker threads, each with its own copy of the classifier
+// marked files, batch.log and summary.txt are written to output_dir
+// returns the process exit code
+int classify_batch(const classifiers::MLPClassifier& prototype,
+                   classifiers::ResultCache& cache,
+                   const std::vector<std::string>& input_paths,
+                   const boost::filesystem::path& output_dir,
+                   const ClassifyOptions& options,
+                   const int jobs,
+                   const int infer_threads,
+                   const bool resume);
+
+#endif // CLASSIFY_BATCH
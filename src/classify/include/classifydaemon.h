@@ -0,0 +1,57 @@
+// classifydaemon.h
+// Copyright Laurence Emms 2017
+
+#ifndef CLASSIFY_DAEMON
+#define CLASSIFY_DAEMON
+
+#include <ctime>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <mlpclassifier.h>
+#include <resultcache.h>
+
+#include "classifyvideo.h"
+
+// a model stays loaded until its file changes on disk
+struct DaemonModel
+{
+    classifiers::MLPClassifier classifier;
+    classifiers::ResultCache cache;
+    std::time_t write_time;
+};
+
+// serves classification jobs over a Unix domain socket
+// classifiers stay loaded between jobs and jobs run on a fixed pool of workers
+class ClassifyDaemon
+{
+public:
+    ClassifyDaemon(const ClassifyOptions& options,
+                   const std::string& cache_dir,
+                   const int jobs,
+                   const int infer_threads,
+                   const size_t max_queue);
+    bool run(const std::string& socket_path);
+private:
+    std::shared_ptr<DaemonModel> get_model(const std::string& model_path, std::string& error);
+    void worker();
+    void handle_job(const int fd);
+
+    const ClassifyOptions _options;
+    const std::string _cache_dir;
+    const int _jobs;
+    const int _infer_threads;
+    const size_t _max_queue;
+    std::mutex _model_mutex;
+    std::map<std::string, std::shared_ptr<DaemonModel> > _models;
+    std::mutex _queue_mutex;
+    std::condition_variable _queue_condition;
+    std::deque<int> _queue;
+    bool _stopping;
+};
+
+#endif // CLASSIFY_DAEMON
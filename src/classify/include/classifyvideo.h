@@ -0,0 +1,358 @@
+// classifyvideo.h
+// Copyright Laurence Emms 2017
+
+#ifndef CLASSIFY_VIDEO
+#define CLASSIFY_VIDEO
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include <mlpclassifier.h>
+#include <patchinput.h>
+#include <resultcache.h>
+#include <videosource.h>
+
+// patches are laid out on a grid with a stride of one patch width
+// a patch is only classified when its center lies inside the mask
+struct PatchGrid
+{
+    int cols;
+    int rows;
+    std::vector<char> active;
+};
+
+PatchGrid build_patch_grid(const cv::Mat& mask,
+                           const int fw,
+                           const int fh,
+                           const int w,
+                           const int h);
+
+// optional per-stage accounting of classify_frame
+struct ClassifyStats
+{
+    double extract_seconds;
+    double infer_seconds;
+    size_t patches;
+};
+
+// adaptive_step > 1 first classifies every adaptive_step-th patch in each direction
+// and then densifies around the positive patches only
+// patches that are never evaluated are counted as negative
+template <typename Classifier>
+void classify_frame(Classifier& classifier,
+                    const std::list<cv::Mat>& prev_frames,
+                    const PatchGrid& grid,
+                    const int w,
+                    const int h,
+                    const int f,
+                    const int adaptive_step,
+                    classifiers::FrameResult& result,
+                    ClassifyStats* stats = NULL)
+{
+    int w_offset = w / 2;
+    int h_offset = h / 2;
+    int stride = w;
+
+    float mean_output = 0.0f;
+    int output_count = 0;
+    int evaluated_count = 0;
+    int active_count = 0;
+    std::vector<float> output_vector;
+    std::vector<float> input_vector(w * f * h + 1);
+    input_vector[w * h * f] = -1.0f; // bias node
+
+    const int step = std::max(1, adaptive_step);
+    // 0: not evaluated, 1: pending, 2: negative, 3: positive
+    std::vector<char> state(grid.active.size(), 0);
+    for (int gy = 0; gy < grid.rows; ++gy)
+    {
+        for (int gx = 0; gx < grid.cols; ++gx)
+        {
+            if (!grid.active[gx + gy * grid.cols])
+            {
+                continue;
+            }
+            active_count++;
+            if (gx % step == 0 && gy % step == 0)
+            {
+                state[gx + gy * grid.cols] = 1;
+            }
+        }
+    }
+
+    bool pending = true;
+    while (pending)
+    {
+        pending = false;
+        for (int gy = 0; gy < grid.rows; ++gy)
+        {
+            for (int gx = 0; gx < grid.cols; ++gx)
+            {
+                if (state[gx + gy * grid.cols] != 1)
+                {
+                    continue;
+                }
+                if (stats)
+                {
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    classifiers::fill_input(input_vector, prev_frames, w_offset + gx * stride, h_offset + gy * stride, w, h);
+                    std::chrono::steady_clock::time_point extracted = std::chrono::steady_clock::now();
+                    classifier.classify(input_vector, output_vector);
+                    stats->extract_seconds += std::chrono::duration<double>(extracted - start).count();
+                    stats->infer_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - extracted).count();
+                    stats->patches++;
+                }
+                else
+                {
+                    classifiers::fill_input(input_vector, prev_frames, w_offset + gx * stride, h_offset + gy * stride, w, h);
+                    classifier.classify(input_vector, output_vector);
+                }
+                if (output_vector.empty())
+                {
+                    std::cerr << "\n";
+                    state[gx + gy * grid.cols] = 2;
+                    continue;
+                }
+                evaluated_count++;
+                mean_output += output_vector[0];
+                if (output_vector[0] <= 0.5f)
+                {
+                    state[gx + gy * grid.cols] = 2;
+                    continue;
+                }
+                state[gx + gy * grid.cols] = 3;
+                output_count++;
+                if (step == 1)
+                {
+                    continue;
+                }
+                // queue the unevaluated neighbourhood of a positive patch
+                for (int ny = std::max(0, gy - step + 1); ny < std::min(grid.rows, gy + step); ++ny)
+                {
+                    for (int nx = std::max(0, gx - step + 1); nx < std::min(grid.cols, gx + step); ++nx)
+                    {
+                        if (grid.active[nx + ny * grid.cols] && state[nx + ny * grid.cols] == 0)
+                        {
+                            state[nx + ny * grid.cols] = 1;
+                            pending = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    result.output_fraction = 0.0f;
+    result.mean_output = 0.0f;
+    if (active_count > 0)
+    {
+        result.output_fraction = static_cast<float>(output_count) / static_cast<float>(active_count);
+    }
+    if (evaluated_count > 0)
+    {
+        result.mean_output = mean_output / static_cast<float>(evaluated_count);
+    }
+}
+
+struct ClassifyOptions
+{
+    int w;
+    int h;
+    int f;
+    int adaptive_step;
+    std::string mask_path;
+    bool use_roi;
+    std::vector<cv::Rect> roi_rects;
+    std::vector<cv::Rect> exclude_rects;
+    // a frame is marked when more than this fraction of its patches is positive
+    float marked_threshold;
+    // storage precision the classifier weights are converted to after loading
+    classifiers::WeightPrecision precision;
+    float display_scale;
+    bool show;
+    bool verbose;
+};
+
+// parses a list of "x,y,width,height" rectangles separated by semicolons
+bool parse_rects(const std::string& text, std::vector<cv::Rect>& rects);
+
+// builds the classification mask at the input frame size
+// an empty mask classifies the whole frame
+bool build_mask(const ClassifyOptions& options,
+                const int frame_width,
+                const int frame_height,
+                cv::Mat& mask);
+
+template <typename Classifier>
+bool classify(Classifier& classifier,
+              classifiers::ResultCache& cache,
+              std::vector<bool>& marked,
+              const std::string& input_path,
+              const ClassifyOptions& options,
+              const std::function<bool(int, int)>& progress = std::function<bool(int, int)>())
+{
+    const int w = options.w;
+    const int h = options.h;
+    const int f = options.f;
+    const bool show = options.show;
+    const bool verbose = options.verbose;
+    videoio::VideoSource source;
+    if (!source.open(input_path))
+    {
+        return false;
+    }
+    source.print_info();
+    const int frame_width = source.width();
+    const int frame_height = source.height();
+    const int frame_count = source.frame_count();
+    // a raw video pipe has no frame count, it is read until it runs dry and marked grows with it
+    const bool streamed = source.streamed();
+    marked.assign(frame_count, false);
+
+    cv::Mat mask;
+    if (!build_mask(options, frame_width, frame_height, mask))
+    {
+        return false;
+    }
+    PatchGrid grid = build_patch_grid(mask, frame_width, frame_height, w, h);
+    if (verbose)
+    {
+        int active_count = static_cast<int>(std::count(grid.active.begin(), grid.active.end(), 1));
+        std::cout << "Classifying " << active_count << " / " << grid.active.size() << " patches per frame\n";
+    }
+
+    uint64_t key_seed = classifiers::combine_hash(0, static_cast<uint64_t>(options.adaptive_step));
+    if (!mask.empty())
+    {
+        key_seed = classifiers::combine_hash(key_seed, classifiers::hash_frame(mask));
+    }
+
+    std::list<cv::Mat> prev_frames;
+    std::list<uint64_t> prev_hashes;
+    for (int fn = 0; streamed || fn < frame_count; ++fn)
+    {
+        // the source only decodes into a buffer again once the window has dropped it, so frames are not copied
+        cv::Mat frame;
+        if (!source.read(frame))
+        {
+            if (streamed)
+            {
+                break;
+            }
+            std::cout << "Frame empty: "<< fn << "\n";
+            continue;
+        }
+        if (streamed)
+        {
+            marked.push_back(false);
+        }
+        prev_frames.push_front(frame);
+        if (cache.is_open())
+        {
+            prev_hashes.push_front(classifiers::hash_frame(frame));
+        }
+        if (fn == 0)
+        {
+            // preload f frames
+            for (int i = 0; i < f - 1; ++i)
+            {
+                prev_frames.push_front(frame);
+                if (cache.is_open())
+                {
+                    prev_hashes.push_front(prev_hashes.front());
+                }
+            }
+        }
+        while (static_cast<int>(prev_frames.size()) > f)
+        {
+            prev_frames.pop_back();
+        }
+        while (static_cast<int>(prev_hashes.size()) > f)
+        {
+            prev_hashes.pop_back();
+        }
+        if (verbose)
+        {
+            std::cout << "Frame number: " << fn << " / " << frame_count << "\n";
+            double msec = source.msec();
+            double seconds = std::floor(msec / 1000.0);
+            double minutes = std::floor(seconds / 60.0);
+            double hours = std::floor(minutes / 60.0);
+            minutes -= hours * 60.0;
+            seconds -= minutes * 60.0;
+            msec -= seconds * 1000.0;
+            std::cout << "Time: " << std::setfill('0') << std::setw(2) << static_cast<int>(hours) << ":" << std::setw(2) << static_cast<int>(minutes) << ":" << std::setw(2) << static_cast<int>(seconds) << ":" << std::setw(4) << static_cast<int>(msec) << "\n";
+        }
+        int fw = frame.cols;
+        int fh = frame.rows;
+
+        // the classifier output only depends on the model, the patch selection and the frame window
+        uint64_t window_key = key_seed;
+        classifiers::FrameResult result;
+        bool cached = false;
+        if (cache.is_open())
+        {
+            for (std::list<uint64_t>::const_iterator it = prev_hashes.begin(); it != prev_hashes.end(); ++it)
+            {
+                window_key = classifiers::combine_hash(window_key, *it);
+            }
+            cached = cache.find(window_key, result);
+        }
+        if (!cached)
+        {
+            classify_frame(classifier, prev_frames, grid, w, h, f, options.adaptive_step, result);
+            cache.insert(window_key, result);
+        }
+        else if (verbose)
+        {
+            std::cout << "Cached result for frame: " << fn << "\n";
+        }
+
+        if (verbose)
+        {
+            std::cout << static_cast<int>(result.output_fraction * 100.0f) << "% of frames classified as marked\n";
+            std::cout << "Mean output: " << result.mean_output << "\n";
+        }
+        if (result.output_fraction > options.marked_threshold)
+        {
+            marked[fn] = true;
+        }
+        if (show)
+        {
+            cv::Size size(static_cast<int>(static_cast<float>(fw) * options.display_scale), static_cast<int>(static_cast<float>(fh) * options.display_scale));
+            cv::Mat disp;
+            cv::resize(frame, disp, size);
+            if (marked[fn])
+            {
+                cv::rectangle(disp, cv::Rect(0, 0, disp.cols, disp.rows), cv::Scalar(0, 0, 255), 5, 8, 0);
+            }
+            cv::imshow("Display window", disp);
+            cv::waitKey(15);
+        }
+        if (verbose)
+        {
+            std::cout << "Frame classified\n";
+        }
+        // the progress callback can cancel classification
+        if (progress && !progress(fn + 1, frame_count))
+        {
+            std::cerr << "Classification cancelled: " << input_path << "\n";
+            return false;
+        }
+    }
+    std::cout << "Training complete\n";
+    return true;
+}
+
+// writes through a temporary file so an existing marked file is never left half written
+bool write_marked(const std::string& marked_path, const std::vector<bool>& marked);
+
+#endif // CLASSIFY_VIDEO
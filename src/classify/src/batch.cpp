@@ -0,0 +1,215 @@
+// batch.cpp
+// Copyright Laurence Emms 2017
+
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <omp.h>
+#include <boost/algorithm/string.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+    bool is_video_file(const fs::path& path)
+    {
+        static const char* extensions[] = {".avi", ".mp4", ".m4v", ".mov", ".mkv", ".mpg", ".mpeg", ".mts", ".m2ts", ".ts", ".wmv", ".webm"};
+        std::string extension = boost::algorithm::to_lower_copy(path.extension().string());
+        for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
+        {
+            if (extension == extensions[i])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct BatchEntry
+    {
+        std::string status;
+        int frame_count;
+        int marked_count;
+        double seconds;
+    };
+
+    // the batch log records one line per finished file: status frames marked seconds path
+    void read_batch_log(const fs::path& log_path, std::map<std::string, BatchEntry>& entries)
+    {
+        std::ifstream log_file(log_path.string().c_str());
+        std::string line;
+        while (std::getline(log_file, line))
+        {
+            std::istringstream line_stream(line);
+            BatchEntry entry;
+            std::string path;
+            if (!(line_stream >> entry.status >> entry.frame_count >> entry.marked_count >> entry.seconds))
+            {
+                continue;
+            }
+            std::getline(line_stream, path);
+            boost::algorithm::trim(path);
+            if (!path.empty())
+            {
+                entries[path] = entry;
+            }
+        }
+    }
+}
+
+bool collect_batch(const fs::path& batch_path, std::vector<std::string>& input_paths)
+{
+    if (fs::is_directory(batch_path))
+    {
+        for (fs::directory_iterator it(batch_path); it != fs::directory_iterator(); ++it)
+        {
+            if (fs::is_regular_file(it->path()) && is_video_file(it->path()))
+            {
+                input_paths.push_back(it->path().string());
+            }
+        }
+        std::sort(input_paths.begin(), input_paths.end());
+        return true;
+    }
+    std::ifstream list_file(batch_path.string().c_str());
+    if (!list_file)
+    {
+        std::cerr << "Failed to open batch list: " << batch_path.string() << "\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(list_file, line))
+    {
+        boost::algorithm::trim(line);
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        input_paths.push_back(line);
+    }
+    return true;
+}
+
+int classify_batch(const classifiers::MLPClassifier& prototype,
+                   classifiers::ResultCache& cache,
+                   const std::vector<std::string>& input_paths,
+                   const fs::path& output_dir,
+                   const ClassifyOptions& options,
+                   const int jobs,
+                   const int infer_threads,
+                   const bool resume)
+{
+    // one marked file per input, named after the input file
+    std::vector<std::string> marked_paths;
+    std::set<std::string> names;
+    for (size_t i = 0; i < input_paths.size(); ++i)
+    {
+        std::string name = fs::path(input_paths[i]).filename().string();
+        if (!names.insert(name).second)
+        {
+            std::cerr << "Duplicate input file name in batch: " << name << "\n";
+            return 1;
+        }
+        marked_paths.push_back((output_dir / (name + ".marked")).string());
+    }
+
+    fs::path log_path = output_dir / "batch.log";
+    std::map<std::string, BatchEntry> entries;
+    if (resume)
+    {
+        read_batch_log(log_path, entries);
+    }
+    else
+    {
+        boost::system::error_code ec;
+        fs::remove(log_path, ec);
+    }
+
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < input_paths.size(); ++i)
+    {
+        std::map<std::string, BatchEntry>::const_iterator it = entries.find(input_paths[i]);
+        if (it != entries.end() && it->second.status == "done" && fs::exists(marked_paths[i]))
+        {
+            continue;
+        }
+        pending.push_back(i);
+    }
+    std::cout << "Batch of " << input_paths.size() << " files, " << input_paths.size() - pending.size() << " already complete\n";
+    std::cout << "Jobs: " << jobs << " inference threads per job: " << infer_threads << "\n";
+
+    std::ofstream log_file(log_path.string().c_str(), std::ios::app);
+    std::mutex log_mutex;
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int j = 0; j < std::min(jobs, static_cast<int>(pending.size())); ++j)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            // the feed forward pass is parallelized with OpenMP, limit it per worker
+            omp_set_num_threads(infer_threads);
+            // the classifier holds its layer activations, every worker needs its own copy
+            classifiers::MLPClassifier classifier(prototype);
+            for (size_t p = next++; p < pending.size(); p = next++)
+            {
+                const size_t i = pending[p];
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::vector<bool> marked;
+                bool success = classify(classifier, cache, marked, input_paths[i], options) &&
+                               write_marked(marked_paths[i], marked);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                BatchEntry entry;
+                entry.status = success ? "done" : "failed";
+                entry.frame_count = static_cast<int>(marked.size());
+                entry.marked_count = static_cast<int>(std::count(marked.begin(), marked.end(), true));
+                entry.seconds = seconds;
+
+                std::lock_guard<std::mutex> lock(log_mutex);
+                log_file << entry.status << " " << entry.frame_count << " " << entry.marked_count << " " << entry.seconds << " " << input_paths[i] << "\n";
+                log_file.flush();
+                entries[input_paths[i]] = entry;
+                std::cout << "Batch " << entry.status << ": " << input_paths[i] << " (" << seconds << "s)\n";
+            }
+        }));
+    }
+    for (size_t j = 0; j < workers.size(); ++j)
+    {
+        workers[j].join();
+    }
+
+    fs::path summary_path = output_dir / "summary.txt";
+    std::cout << "Writing batch summary to: " << summary_path.string() << "\n";
+    std::ofstream summary_file(summary_path.string().c_str());
+    int failed = 0;
+    int total_frames = 0;
+    int total_marked = 0;
+    double total_seconds = 0.0;
+    for (size_t i = 0; i < input_paths.size(); ++i)
+    {
+        std::map<std::string, BatchEntry>::const_iterator it = entries.find(input_paths[i]);
+        if (it == entries.end() || it->second.status != "done")
+        {
+            failed++;
+            summary_file << "failed " << input_paths[i] << "\n";
+            continue;
+        }
+        total_frames += it->second.frame_count;
+        total_marked += it->second.marked_count;
+        total_seconds += it->second.seconds;
+        summary_file << "done " << it->second.frame_count << " frames " << it->second.marked_count << " marked " << it->second.seconds << "s " << input_paths[i] << " -> " << marked_paths[i] << "\n";
+    }
+    summary_file << "files: " << input_paths.size() << " failed: " << failed << "\n";
+    summary_file << "frames: " << total_frames << " marked: " << total_marked << "\n";
+    summary_file << "classification time: " << total_seconds << "s\n";
+    std::cout << "Batch complete: " << input_paths.size() - failed << " / " << input_paths.size() << " files classified\n";
+    return failed == 0 ? 0 : 1;
+}
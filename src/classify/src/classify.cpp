@@ -8,169 +8,76 @@
 #include <algorithm>
 #include <list>
 #include <random>
+#include <sstream>
+#include <omp.h>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <opencv2/opencv.hpp>
 
 #include <mlpclassifier.h>
+#include <resultcache.h>
+
+#include "classifyvideo.h"
+#include "batch.h"
+#include "classifydaemon.h"
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-template <typename Classifier>
-bool classify(Classifier& classifier,
-              std::vector<bool>& marked,
-              const std::string& input_path,
-              const int w,
-              const int h,
-              const int f,
-              const float display_scale,
-              const bool show,
-              const bool verbose)
+bool build_options(const po::variables_map& vm, const bool show, ClassifyOptions& options)
 {
-    cv::VideoCapture cap(input_path);
-    if (!cap.isOpened())
+    options.w = 8;
+    options.h = 8;
+    options.f = 4;
+    options.adaptive_step = 1;
+    options.marked_threshold = 0.0f;
+    options.precision = classifiers::PRECISION_FP32;
+    options.use_roi = vm.count("roi") != 0;
+    options.display_scale = 0.4f;
+    options.verbose = vm.count("verbose") != 0;
+    options.show = show;
+
+    if (vm.count("mask") != 0)
+    {
+        options.mask_path = vm["mask"].as<std::string>();
+        std::cout << "Using mask file: " << options.mask_path << "\n";
+    }
+    if (vm.count("roi") != 0 && !parse_rects(vm["roi"].as<std::string>(), options.roi_rects))
+    {
+        return false;
+    }
+    if (vm.count("exclude") != 0 && !parse_rects(vm["exclude"].as<std::string>(), options.exclude_rects))
     {
-        std::cerr << "Failed to open video capture\n";
         return false;
     }
 
-    const double fourcc_d = cap.get(CV_CAP_PROP_FOURCC);
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_d);
-    std::cout << "FourCC: " << fourcc << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    std::cout << "FPS: " << static_cast<int>(cap.get(CV_CAP_PROP_FPS)) << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
-
-    // count frames
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-
-    std::list<cv::Mat> prev_frames;
-    for (int fn = 0; fn < frame_count; ++fn)
+    if (vm.count("threshold") != 0)
     {
-        cv::Mat frame;
-        if (!cap.read(frame))
-        {
-            std::cout << "Frame empty: "<< fn << "\n";
-            continue;
-        }
-        prev_frames.push_front(frame.clone());
-        if (fn == 0)
-        {
-            // preload f frames
-            for (int i = 0; i < f - 1; ++i)
-            {
-                prev_frames.push_front(frame.clone());
-            }
-        }
-        while (static_cast<int>(prev_frames.size()) > f)
-        {
-            prev_frames.pop_back();
-        }
-        if (verbose)
-        {
-            std::cout << "Frame number: " << fn << " / " << frame_count << "\n";
-            double msec = cap.get(CV_CAP_PROP_POS_MSEC);
-            double seconds = std::floor(msec / 1000.0);
-            double minutes = std::floor(seconds / 60.0);
-            double hours = std::floor(minutes / 60.0);
-            minutes -= hours * 60.0;
-            seconds -= minutes * 60.0;
-            msec -= seconds * 1000.0;
-            std::cout << "Time: " << std::setfill('0') << std::setw(2) << static_cast<int>(hours) << ":" << std::setw(2) << static_cast<int>(minutes) << ":" << std::setw(2) << static_cast<int>(seconds) << ":" << std::setw(4) << static_cast<int>(msec) << "\n";
-        }
-        int w_offset = w / 2;
-        int h_offset = h / 2;
-        int fw = frame.cols;
-        int fh = frame.rows;
+        options.marked_threshold = vm["threshold"].as<float>();
+        std::cout << "Marked threshold: " << options.marked_threshold << "\n";
+    }
 
-        float mean_output = 0.0f;
-        int output_count = 0;
-        std::vector<float> output_vector;
-        std::vector<float> input_vector(w * f * h + 1);
-        input_vector[w * h * f] = -1.0f; // bias node
-        int stride = w;
-        int total = 0;
-        for (int y = h_offset; y + h_offset < fh; y += stride)
+    if (vm.count("adaptive") != 0)
+    {
+        options.adaptive_step = vm["adaptive"].as<int>();
+        if (options.adaptive_step < 1)
         {
-            for (int x = w_offset; x + w_offset < fw; x += stride)
-            {
-                std::list<cv::Mat>::iterator current_frame = prev_frames.begin();
-
-                int it_f = 0;
-                while (current_frame != prev_frames.end())
-                {
-                    int it_y = 0;
-                    for (int y_o = -h_offset; y_o < h_offset; ++y_o)
-                    {
-                        int it_x = 0;
-                        for (int x_o = -w_offset; x_o < w_offset; ++x_o)
-                        {
-                            cv::Vec3b texel = current_frame->at<cv::Vec3b>(y + y_o, x + x_o);
-                            float luminance = (0.2126f * static_cast<float>(texel[0]) + 0.7512f * static_cast<float>(texel[1]) + 0.0722f * static_cast<float>(texel[2])) / 255.0f;
-                            input_vector[it_x + it_y * w + it_f * w * h] = luminance;
-                            it_x++;
-                        }
-                        it_y++;
-                    }
-                    current_frame++;
-                    it_f++;
-                }
-
-                classifier.classify(input_vector, output_vector);
-                if (output_vector.empty())
-                {
-                    std::cerr << "\n";
-                    continue;
-                }
-                mean_output += output_vector[0];
-                if (output_vector[0] > 0.5f)
-                {
-                    output_count++;
-                }
-                total++;
-            }
+            std::cerr << "Adaptive step must be at least 1\n";
+            return false;
         }
+        std::cout << "Adaptive patch step: " << options.adaptive_step << "\n";
+    }
 
-        float output_fraction = static_cast<float>(output_count) / static_cast<float>(total);
-
-        if (verbose)
-        {
-            std::cout << static_cast<int>(output_fraction * 100.0f) << "% of frames classified as marked\n";
-            std::cout << "Mean output: " << mean_output / static_cast<float>(total) << "\n";
-        }
-        float marked_threshold = 0.0f;
-        if (output_fraction > marked_threshold)
-        {
-            marked[fn] = true;
-        }
-        if (show)
-        {
-            cv::Size size(static_cast<int>(static_cast<float>(fw) * display_scale), static_cast<int>(static_cast<float>(fh) * display_scale));
-            cv::Mat disp;
-            cv::resize(frame, disp, size);
-            if (marked[fn])
-            {
-                cv::rectangle(disp, cv::Rect(0, 0, disp.cols, disp.rows), cv::Scalar(0, 0, 255), 5, 8, 0);
-            }
-            cv::imshow("Display window", disp);
-            cv::waitKey(15);
-        }
-        if (verbose)
+    if (vm.count("precision") != 0)
+    {
+        if (!classifiers::parse_precision(vm["precision"].as<std::string>(), options.precision))
         {
-            std::cout << "Frame classified\n";
+            std::cerr << "Unknown weight precision: " << vm["precision"].as<std::string>() << "\n";
+            return false;
         }
+        std::cout << "Weight precision: " << classifiers::precision_name(options.precision) << "\n";
     }
-    cap.release();
-    std::cout << "Training complete\n";
     return true;
 }
 
@@ -180,6 +87,8 @@ int main(int argc, char** argv)
     std::cout << "Classify\n";
     std::cout << "by Laurence Emms\n";
 
+    int jobs = 1;
+    int infer_threads = omp_get_max_threads();
     po::options_description desc("Options");
     desc.add_options()
         ("help,h", "Print help message")
@@ -187,6 +96,20 @@ int main(int argc, char** argv)
         ("input,i", po::value<std::string>(), "Input video file")
         ("classifier,c", po::value<std::string>(), "Classifier file")
         ("marked", po::value<std::string>(), "Marked frames file")
+        ("cache", po::value<std::string>(), "Classification result cache directory")
+        ("mask", po::value<std::string>(), "Mask image, only patches centered on non-zero pixels are classified")
+        ("roi", po::value<std::string>(), "Regions to classify as x,y,width,height;...")
+        ("exclude", po::value<std::string>(), "Regions to skip as x,y,width,height;...")
+        ("adaptive", po::value<int>(), "Classify every Nth patch and densify around positives")
+        ("threshold", po::value<float>(), "Mark frames with more than this fraction of positive patches")
+        ("precision", po::value<std::string>(), "Weight storage for inference: fp32, fp16 or bf16")
+        ("batch", po::value<std::string>(), "Classify a directory of videos or a file listing one video per line")
+        ("output-dir", po::value<std::string>(), "Batch output directory for marked files and the summary")
+        ("jobs,j", po::value<int>(&jobs), "Batch files decoded and classified concurrently")
+        ("infer-threads", po::value<int>(&infer_threads), "Inference threads per batch job")
+        ("resume", "Skip batch files completed by a previous run")
+        ("daemon", po::value<std::string>(), "Serve classification jobs on this Unix socket")
+        ("queue", po::value<int>(), "Daemon jobs waiting for a worker before new jobs are refused")
         ("show,s", "Display output")
         ("verbose", "Force verbose output")
         ;
@@ -206,7 +129,41 @@ int main(int argc, char** argv)
         return 0;
     }
 
-    if (vm.count("input") == 0)
+    bool batch = vm.count("batch") != 0;
+    bool daemon = vm.count("daemon") != 0;
+    if (daemon)
+    {
+        // the daemon reads classifiers, inputs and outputs from its jobs
+        if (vm.count("show") != 0)
+        {
+            std::cerr << "The daemon can not display output\n";
+            return 1;
+        }
+        int max_queue = 4 * jobs;
+        if (vm.count("queue") != 0)
+        {
+            max_queue = vm["queue"].as<int>();
+        }
+        if (jobs < 1 || infer_threads < 1 || max_queue < 1)
+        {
+            std::cerr << "Jobs, inference threads and queue length must be at least 1\n";
+            return 1;
+        }
+        ClassifyOptions options;
+        if (!build_options(vm, false, options))
+        {
+            return 1;
+        }
+        std::string cache_dir;
+        if (vm.count("cache") != 0)
+        {
+            cache_dir = vm["cache"].as<std::string>();
+        }
+        ClassifyDaemon classify_daemon(options, cache_dir, jobs, infer_threads, static_cast<size_t>(max_queue));
+        return classify_daemon.run(vm["daemon"].as<std::string>()) ? 0 : 1;
+    }
+
+    if (!batch && vm.count("input") == 0)
     {
         std::cerr << "Input file not specified\n";
         return 1;
@@ -218,30 +175,19 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    if (vm.count("marked") == 0)
+    if (!batch && vm.count("marked") == 0)
     {
         std::cerr << "Marked file not specified\n";
         return 1;
     }
 
-
-    fs::path input_path(vm["input"].as<std::string>());
-    fs::path classifier_path(vm["classifier"].as<std::string>());
-    fs::path marked_path(vm["marked"].as<std::string>());
-    
-    if (!fs::exists(input_path.string()))
+    if (jobs < 1 || infer_threads < 1)
     {
-        std::cerr << "Input file does not exist: " << input_path.string() << "\n";
+        std::cerr << "Jobs and inference threads must be at least 1\n";
         return 1;
     }
 
-    std::cout << "Reading input file: " << input_path.string() << "\n";
-    cv::VideoCapture cap(input_path.string());
-    if (!cap.isOpened())
-    {
-        std::cerr << "Failed to open video capture\n";
-        return 1;
-    }
+    fs::path classifier_path(vm["classifier"].as<std::string>());
 
     int w = 8;
     int h = 8;
@@ -275,60 +221,115 @@ int main(int argc, char** argv)
         classifier.init(layer_sizes);
     }
 
-    std::cout << "Input format:\n";
-    const int fourcc_i = static_cast<int>(cap.get(CV_CAP_PROP_FOURCC));
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_i);
-    std::cout << "FourCC: " << fourcc << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    double fps = cap.get(CV_CAP_PROP_FPS);
-    std::cout << "FPS: " << fps << "\n";
-    double estimated_frame_count = cap.get(CV_CAP_PROP_FRAME_COUNT);
-    std::cout << "Estimated frame count: " << estimated_frame_count << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
+    ClassifyOptions options;
+    // batch jobs run on worker threads and never display
+    if (!build_options(vm, !batch && vm.count("show") != 0, options))
+    {
+        return 1;
+    }
+    if (vm.count("precision") != 0)
+    {
+        classifier.set_precision(options.precision);
+    }
+    if (options.show)
+    {
+        cv::namedWindow("Display window", cv::WINDOW_AUTOSIZE);
+    }
 
-    // count frames
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-    cap.release();
+    classifiers::ResultCache cache;
+    if (vm.count("cache") != 0)
+    {
+        if (!fs::exists(classifier_path.string()))
+        {
+            std::cout << "Classifier is untrained, not using the result cache\n";
+        }
+        else
+        {
+            // results are only valid for this exact model and patch layout
+            uint64_t model_hash = classifiers::hash_file(classifier_path.string());
+            model_hash = classifiers::combine_hash(model_hash, static_cast<uint64_t>(w));
+            model_hash = classifiers::combine_hash(model_hash, static_cast<uint64_t>(h));
+            model_hash = classifiers::combine_hash(model_hash, static_cast<uint64_t>(f));
+            model_hash = classifiers::combine_hash(model_hash, static_cast<uint64_t>(classifier.precision()));
+            std::cout << "Using result cache: " << vm["cache"].as<std::string>() << "\n";
+            if (!cache.open(vm["cache"].as<std::string>(), model_hash))
+            {
+                std::cerr << "Failed to open result cache\n";
+                return 1;
+            }
+        }
+    }
 
-    bool verbose = vm.count("verbose") != 0;
-    bool show = vm.count("show") != 0;
-    if (show)
+    if (batch)
     {
-        cv::namedWindow("Display window", cv::WINDOW_AUTOSIZE);
+        fs::path batch_path(vm["batch"].as<std::string>());
+        if (!fs::exists(batch_path))
+        {
+            std::cerr << "Batch path does not exist: " << batch_path.string() << "\n";
+            return 1;
+        }
+        std::vector<std::string> input_paths;
+        if (!collect_batch(batch_path, input_paths))
+        {
+            return 1;
+        }
+        fs::path output_dir = fs::is_directory(batch_path) ? batch_path : batch_path.parent_path();
+        if (vm.count("output-dir") != 0)
+        {
+            output_dir = vm["output-dir"].as<std::string>();
+        }
+        boost::system::error_code ec;
+        fs::create_directories(output_dir, ec);
+        if (!fs::is_directory(output_dir))
+        {
+            std::cerr << "Failed to create output directory: " << output_dir.string() << "\n";
+            return 1;
+        }
+        int result = classify_batch(classifier,
+                                    cache,
+                                    input_paths,
+                                    output_dir,
+                                    options,
+                                    jobs,
+                                    infer_threads,
+                                    vm.count("resume") != 0);
+        if (cache.is_open())
+        {
+            std::cout << "Result cache hits: " << cache.hits() << " misses: " << cache.misses() << "\n";
+        }
+        return result;
+    }
+
+    fs::path input_path(vm["input"].as<std::string>());
+    fs::path marked_path(vm["marked"].as<std::string>());
+
+    if (!fs::exists(input_path.string()))
+    {
+        std::cerr << "Input file does not exist: " << input_path.string() << "\n";
+        return 1;
     }
 
-    float display_scale = 0.4f;
-    std::vector<bool> marked(frame_count, false);
+    omp_set_num_threads(infer_threads);
+    std::vector<bool> marked;
     std::cout << "Classifying input file: " << input_path.string() << "\n";
     if (!classify(classifier,
+                  cache,
                   marked,
                   input_path.string(),
-                  w,
-                  h,
-                  f,
-                  display_scale,
-                  show,
-                  verbose))
+                  options))
     {
         std::cerr << "Failed to classify on video: " << input_path.string() << "\n";
         return 1;
     }
+    if (cache.is_open())
+    {
+        std::cout << "Result cache hits: " << cache.hits() << " misses: " << cache.misses() << "\n";
+    }
 
     std::cout << "Writing marked data to: " << marked_path.string() << "\n";
-    std::ofstream marked_file(marked_path.string().c_str());
-    for (size_t f = 0; f < marked.size(); ++f)
+    if (!write_marked(marked_path.string(), marked))
     {
-        if (marked[f])
-        {
-            marked_file << f << "\n";
-        }
+        return 1;
     }
 
     std::cout << "Finished classifying video: " << input_path.string() << "\n";
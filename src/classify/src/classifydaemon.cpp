@@ -0,0 +1,344 @@
+// classifydaemon.cpp
+// Copyright Laurence Emms 2017
+
+#include "classifydaemon.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <omp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+    volatile std::sig_atomic_t daemon_running = 1;
+
+    // a request is one short line, a client gets this long to send it
+    const size_t max_request_length = 4096;
+    const int request_timeout_seconds = 10;
+
+    void stop_daemon(int)
+    {
+        daemon_running = 0;
+    }
+
+    bool write_line(const int fd, const std::string& line)
+    {
+        std::string data = line + "\n";
+        size_t written = 0;
+        while (written < data.size())
+        {
+            // MSG_NOSIGNAL: a client that hung up must not kill the daemon
+            ssize_t count = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            written += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    bool read_line(const int fd, std::string& line)
+    {
+        line.clear();
+        char c = 0;
+        while (line.size() < max_request_length)
+        {
+            ssize_t count = recv(fd, &c, 1, 0);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            // also fails once the receive timeout expires
+            if (count <= 0)
+            {
+                return false;
+            }
+            if (c == '\n')
+            {
+                return true;
+            }
+            line.push_back(c);
+        }
+        return false;
+    }
+}
+
+ClassifyDaemon::ClassifyDaemon(const ClassifyOptions& options,
+                               const std::string& cache_dir,
+                               const int jobs,
+                               const int infer_threads,
+                               const size_t max_queue) :
+    _options(options),
+    _cache_dir(cache_dir),
+    _jobs(jobs),
+    _infer_threads(infer_threads),
+    _max_queue(max_queue),
+    _stopping(false)
+{
+}
+
+std::shared_ptr<DaemonModel> ClassifyDaemon::get_model(const std::string& model_path, std::string& error)
+{
+    std::lock_guard<std::mutex> lock(_model_mutex);
+    boost::system::error_code ec;
+    std::time_t write_time = fs::last_write_time(model_path, ec);
+    if (ec)
+    {
+        error = "classifier file does not exist";
+        return std::shared_ptr<DaemonModel>();
+    }
+    std::map<std::string, std::shared_ptr<DaemonModel> >::iterator it = _models.find(model_path);
+    if (it != _models.end() && it->second->write_time == write_time)
+    {
+        return it->second;
+    }
+
+    std::cout << "Reading classifier file: " << model_path << "\n";
+    std::shared_ptr<DaemonModel> model(new DaemonModel());
+    model->write_time = write_time;
+    std::ifstream classifier_file(model_path.c_str());
+    model->classifier.read(classifier_file);
+    if (model->classifier.num_layers() <= 0 ||
+        model->classifier.layer_size(0) != _options.w * _options.h * _options.f + 1)
+    {
+        error = "classifier does not match the patch layout";
+        return std::shared_ptr<DaemonModel>();
+    }
+    if (_options.precision != classifiers::PRECISION_FP32)
+    {
+        model->classifier.set_precision(_options.precision);
+    }
+    if (!_cache_dir.empty())
+    {
+        uint64_t model_hash = classifiers::hash_file(model_path);
+        model_hash = classifiers::combine_hash(model_hash, static_cast<uint64_t>(_options.w));
+        model_hash = classifiers::combine_hash(model_hash, static_cast<uint64_t>(_options.h));
+        model_hash = classifiers::combine_hash(model_hash, static_cast<uint64_t>(_options.f));
+        model_hash = classifiers::combine_hash(model_hash, static_cast<uint64_t>(model->classifier.precision()));
+        if (!model->cache.open(_cache_dir, model_hash))
+        {
+            std::cerr << "Failed to open result cache, continuing without it\n";
+        }
+    }
+    // jobs still running on a replaced model keep their reference
+    _models[model_path] = model;
+    return model;
+}
+
+// request: "classify\t<classifier>\t<input>\t<marked>"
+// replies: "progress <frame> <frame count>" lines followed by
+//          "done <marked frames> <frame count>" or "error <message>"
+void ClassifyDaemon::handle_job(const int fd)
+{
+    std::string request;
+    if (!read_line(fd, request))
+    {
+        return;
+    }
+    std::vector<std::string> fields;
+    boost::split(fields, request, boost::is_any_of("\t"));
+    if (fields.size() != 4 || fields[0] != "classify")
+    {
+        write_line(fd, "error malformed request");
+        return;
+    }
+    const std::string& model_path = fields[1];
+    const std::string& input_path = fields[2];
+    const std::string& marked_path = fields[3];
+    std::cout << "Job: " << input_path << " -> " << marked_path << "\n";
+    if (!fs::exists(input_path))
+    {
+        write_line(fd, "error input file does not exist");
+        return;
+    }
+
+    std::string error;
+    std::shared_ptr<DaemonModel> model = get_model(model_path, error);
+    if (!model)
+    {
+        write_line(fd, "error " + error);
+        return;
+    }
+
+    classifiers::MLPClassifier classifier(model->classifier);
+    int last_percent = -1;
+    std::function<bool(int, int)> progress = [&](int frame, int frame_count)
+    {
+        int percent = frame_count > 0 ? frame * 100 / frame_count : 100;
+        if (percent == last_percent)
+        {
+            return true;
+        }
+        last_percent = percent;
+        std::ostringstream line;
+        line << "progress " << frame << " " << frame_count;
+        // stop working for a client that has gone away
+        return write_line(fd, line.str());
+    };
+    std::vector<bool> marked;
+    if (!classify(classifier, model->cache, marked, input_path, _options, progress))
+    {
+        write_line(fd, "error failed to classify video");
+        return;
+    }
+    if (!write_marked(marked_path, marked))
+    {
+        write_line(fd, "error failed to write marked file");
+        return;
+    }
+    std::ostringstream line;
+    line << "done " << std::count(marked.begin(), marked.end(), true) << " " << marked.size();
+    write_line(fd, line.str());
+}
+
+void ClassifyDaemon::worker()
+{
+    // each worker keeps its own OpenMP thread team warm between jobs
+    omp_set_num_threads(_infer_threads);
+    while (true)
+    {
+        int fd = -1;
+        {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            while (_queue.empty() && !_stopping)
+            {
+                _queue_condition.wait(lock);
+            }
+            if (_queue.empty())
+            {
+                return;
+            }
+            fd = _queue.front();
+            _queue.pop_front();
+        }
+        handle_job(fd);
+        close(fd);
+    }
+}
+
+bool ClassifyDaemon::run(const std::string& socket_path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path is too long: " << socket_path << "\n";
+        return false;
+    }
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        std::cerr << "Failed to create socket\n";
+        return false;
+    }
+    // a stale socket from an earlier run is replaced, anything else at the path is left alone
+    struct stat status;
+    if (lstat(socket_path.c_str(), &status) == 0)
+    {
+        if (!S_ISSOCK(status.st_mode))
+        {
+            std::cerr << "Socket path exists and is not a socket: " << socket_path << "\n";
+            close(listen_fd);
+            return false;
+        }
+        unlink(socket_path.c_str());
+    }
+    // only the owner may submit jobs, the socket must never exist with wider permissions
+    mode_t old_mask = umask(0077);
+    int bound = bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    umask(old_mask);
+    if (bound != 0)
+    {
+        std::cerr << "Failed to bind socket: " << socket_path << "\n";
+        close(listen_fd);
+        return false;
+    }
+    if (listen(listen_fd, 64) != 0)
+    {
+        std::cerr << "Failed to listen on socket: " << socket_path << "\n";
+        close(listen_fd);
+        unlink(socket_path.c_str());
+        return false;
+    }
+
+    std::signal(SIGINT, stop_daemon);
+    std::signal(SIGTERM, stop_daemon);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::thread> workers;
+    for (int j = 0; j < _jobs; ++j)
+    {
+        workers.push_back(std::thread(&ClassifyDaemon::worker, this));
+    }
+    std::cout << "Listening on: " << socket_path << "\n";
+
+    while (daemon_running)
+    {
+        pollfd poll_fd;
+        poll_fd.fd = listen_fd;
+        poll_fd.events = POLLIN;
+        poll_fd.revents = 0;
+        // wake up regularly to notice a shutdown signal
+        if (poll(&poll_fd, 1, 500) <= 0)
+        {
+            continue;
+        }
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            continue;
+        }
+        // a client that never finishes its request must not hold a worker
+        timeval timeout;
+        timeout.tv_sec = request_timeout_seconds;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::unique_lock<std::mutex> lock(_queue_mutex);
+        if (_queue.size() >= _max_queue)
+        {
+            lock.unlock();
+            write_line(fd, "error daemon is busy");
+            close(fd);
+            continue;
+        }
+        _queue.push_back(fd);
+        _queue_condition.notify_one();
+    }
+
+    std::cout << "Stopping daemon, finishing queued jobs\n";
+    {
+        std::lock_guard<std::mutex> lock(_queue_mutex);
+        _stopping = true;
+    }
+    _queue_condition.notify_all();
+    for (size_t j = 0; j < workers.size(); ++j)
+    {
+        workers[j].join();
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    return true;
+}
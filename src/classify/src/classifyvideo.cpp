@@ -0,0 +1,156 @@
+// classifyvideo.cpp
+// Copyright Laurence Emms 2017
+
+#include "classifyvideo.h"
+
+#include <fstream>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+PatchGrid build_patch_grid(const cv::Mat& mask,
+                           const int fw,
+                           const int fh,
+                           const int w,
+                           const int h)
+{
+    PatchGrid grid;
+    int w_offset = w / 2;
+    int h_offset = h / 2;
+    int stride = w;
+    grid.cols = 0;
+    grid.rows = 0;
+    for (int x = w_offset; x + w_offset < fw; x += stride)
+    {
+        grid.cols++;
+    }
+    for (int y = h_offset; y + h_offset < fh; y += stride)
+    {
+        grid.rows++;
+    }
+    grid.active.resize(grid.cols * grid.rows, 1);
+    if (mask.empty())
+    {
+        return grid;
+    }
+    for (int gy = 0; gy < grid.rows; ++gy)
+    {
+        for (int gx = 0; gx < grid.cols; ++gx)
+        {
+            int x = w_offset + gx * stride;
+            int y = h_offset + gy * stride;
+            grid.active[gx + gy * grid.cols] = mask.at<unsigned char>(y, x) != 0 ? 1 : 0;
+        }
+    }
+    return grid;
+}
+
+bool parse_rects(const std::string& text, std::vector<cv::Rect>& rects)
+{
+    std::vector<std::string> rect_strings;
+    boost::split(rect_strings, text, boost::is_any_of(";"));
+    for (size_t i = 0; i < rect_strings.size(); ++i)
+    {
+        std::string rect_string = rect_strings[i];
+        boost::algorithm::trim(rect_string);
+        if (rect_string.empty())
+        {
+            continue;
+        }
+        std::vector<std::string> values;
+        boost::split(values, rect_string, boost::is_any_of(","));
+        if (values.size() != 4)
+        {
+            std::cerr << "Invalid rectangle: " << rect_string << "\n";
+            return false;
+        }
+        int v[4];
+        for (int j = 0; j < 4; ++j)
+        {
+            boost::algorithm::trim(values[j]);
+            std::istringstream value_stream(values[j]);
+            if (!(value_stream >> v[j]))
+            {
+                std::cerr << "Invalid rectangle: " << rect_string << "\n";
+                return false;
+            }
+        }
+        rects.push_back(cv::Rect(v[0], v[1], v[2], v[3]));
+    }
+    return true;
+}
+
+bool build_mask(const ClassifyOptions& options,
+                const int frame_width,
+                const int frame_height,
+                cv::Mat& mask)
+{
+    mask.release();
+    if (options.mask_path.empty() && !options.use_roi && options.exclude_rects.empty())
+    {
+        return true;
+    }
+    if (!options.mask_path.empty())
+    {
+        cv::Mat mask_image = cv::imread(options.mask_path, cv::IMREAD_GRAYSCALE);
+        if (mask_image.empty())
+        {
+            std::cerr << "Failed to read mask file: " << options.mask_path << "\n";
+            return false;
+        }
+        cv::resize(mask_image, mask, cv::Size(frame_width, frame_height), 0, 0, cv::INTER_NEAREST);
+    }
+    else if (options.use_roi)
+    {
+        mask = cv::Mat::zeros(frame_height, frame_width, CV_8UC1);
+    }
+    else
+    {
+        mask = cv::Mat(frame_height, frame_width, CV_8UC1, cv::Scalar(255));
+    }
+    cv::Rect frame_rect(0, 0, frame_width, frame_height);
+    for (size_t i = 0; i < options.roi_rects.size(); ++i)
+    {
+        mask(options.roi_rects[i] & frame_rect).setTo(cv::Scalar(255));
+    }
+    for (size_t i = 0; i < options.exclude_rects.size(); ++i)
+    {
+        mask(options.exclude_rects[i] & frame_rect).setTo(cv::Scalar(0));
+    }
+    return true;
+}
+
+bool write_marked(const std::string& marked_path, const std::vector<bool>& marked)
+{
+    std::string temp_path = marked_path + ".tmp";
+    {
+        std::ofstream marked_file(temp_path.c_str());
+        if (!marked_file)
+        {
+            std::cerr << "Failed to open marked file: " << temp_path << "\n";
+            return false;
+        }
+        for (size_t f = 0; f < marked.size(); ++f)
+        {
+            if (marked[f])
+            {
+                marked_file << f << "\n";
+            }
+        }
+        if (!marked_file)
+        {
+            std::cerr << "Failed to write marked file: " << temp_path << "\n";
+            return false;
+        }
+    }
+    boost::system::error_code ec;
+    fs::rename(temp_path, marked_path, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to rename marked file: " << temp_path << " -> " << marked_path << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,187 @@
+// classifyc.cpp
+// Copyright Laurence Emms 2017
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+bool write_line(const int fd, const std::string& line)
+{
+    std::string data = line + "\n";
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t count = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        written += static_cast<size_t>(count);
+    }
+    return true;
+}
+
+bool read_line(const int fd, std::string& line)
+{
+    line.clear();
+    char c = 0;
+    while (true)
+    {
+        ssize_t count = recv(fd, &c, 1, 0);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        if (c == '\n')
+        {
+            return true;
+        }
+        line.push_back(c);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::cout << "Classify client\n";
+    std::cout << "by Laurence Emms\n";
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "Print help message")
+        ("version,v", "Print version number")
+        ("input,i", po::value<std::string>(), "Input video file")
+        ("classifier,c", po::value<std::string>(), "Classifier file")
+        ("marked", po::value<std::string>(), "Marked frames file")
+        ("socket", po::value<std::string>()->default_value("/tmp/classifyd.sock"), "Classify daemon socket")
+        ;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << desc << "\n";
+        return 0;
+    }
+
+    if (vm.count("version"))
+    {
+        std::cout << "Classify client 1.0\n";
+        return 0;
+    }
+
+    if (vm.count("input") == 0)
+    {
+        std::cerr << "Input file not specified\n";
+        return 1;
+    }
+
+    if (vm.count("classifier") == 0)
+    {
+        std::cerr << "Classifier file not specified\n";
+        return 1;
+    }
+
+    if (vm.count("marked") == 0)
+    {
+        std::cerr << "Marked file not specified\n";
+        return 1;
+    }
+
+    // the daemon runs in its own working directory
+    fs::path input_path = fs::absolute(vm["input"].as<std::string>());
+    fs::path classifier_path = fs::absolute(vm["classifier"].as<std::string>());
+    fs::path marked_path = fs::absolute(vm["marked"].as<std::string>());
+    std::string socket_path = vm["socket"].as<std::string>();
+
+    if (!fs::exists(input_path))
+    {
+        std::cerr << "Input file does not exist: " << input_path.string() << "\n";
+        return 1;
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path is too long: " << socket_path << "\n";
+        return 1;
+    }
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to create socket\n";
+        return 1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        std::cerr << "Failed to connect to classify daemon: " << socket_path << "\n";
+        close(fd);
+        return 1;
+    }
+
+    std::cout << "Classifying input file: " << input_path.string() << "\n";
+    if (!write_line(fd, "classify\t" + classifier_path.string() + "\t" + input_path.string() + "\t" + marked_path.string()))
+    {
+        std::cerr << "Failed to send job to classify daemon\n";
+        close(fd);
+        return 1;
+    }
+
+    std::string line;
+    while (read_line(fd, line))
+    {
+        std::istringstream line_stream(line);
+        std::string reply;
+        line_stream >> reply;
+        if (reply == "progress")
+        {
+            int frame = 0;
+            int frame_count = 0;
+            line_stream >> frame >> frame_count;
+            std::cout << "Frame number: " << frame << " / " << frame_count << "\n";
+        }
+        else if (reply == "done")
+        {
+            int marked_count = 0;
+            int frame_count = 0;
+            line_stream >> marked_count >> frame_count;
+            std::cout << "Marked " << marked_count << " / " << frame_count << " frames\n";
+            std::cout << "Finished classifying video: " << input_path.string() << "\n";
+            close(fd);
+            return 0;
+        }
+        else if (reply == "error")
+        {
+            std::string message;
+            std::getline(line_stream, message);
+            std::cerr << "Classify daemon error:" << message << "\n";
+            close(fd);
+            return 1;
+        }
+    }
+    std::cerr << "Lost connection to classify daemon\n";
+    close(fd);
+    return 1;
+}
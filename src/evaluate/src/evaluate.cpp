@@ -0,0 +1,528 @@
+// evaluate.cpp
+// Copyright Laurence Emms 2017
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <sstream>
+#include <omp.h>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <mlpclassifier.h>
+#include <resultcache.h>
+#include <videosource.h>
+
+#include "classifyvideo.h"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+typedef std::chrono::steady_clock Clock;
+
+struct ThresholdResult
+{
+    float threshold;
+    int tp;
+    int fp;
+    int tn;
+    int fn;
+    double precision;
+    double recall;
+    double f1;
+    double fpr;
+};
+
+struct StageTiming
+{
+    double load_seconds;
+    double decode_seconds;
+    double extract_seconds;
+    double infer_seconds;
+    double total_seconds;
+    size_t patches;
+    int frames;
+};
+
+double seconds_since(const Clock::time_point& start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string json_string(const std::string& text)
+{
+    std::ostringstream stream;
+    stream << "\"";
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        const char c = text[i];
+        if (c == '"' || c == '\\')
+        {
+            stream << "\\" << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            stream << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        }
+        else
+        {
+            stream << c;
+        }
+    }
+    stream << "\"";
+    return stream.str();
+}
+
+// classifies every frame and records the fraction of positive patches per frame,
+// decoded marks the frames that were actually read and scored
+template <typename Classifier>
+bool score_video(Classifier& classifier,
+                 const std::string& input_path,
+                 const ClassifyOptions& options,
+                 std::vector<float>& scores,
+                 std::vector<bool>& decoded,
+                 StageTiming& timing)
+{
+    const int w = options.w;
+    const int h = options.h;
+    const int f = options.f;
+    videoio::VideoSource source;
+    if (!source.open(input_path))
+    {
+        return false;
+    }
+    const int frame_width = source.width();
+    const int frame_height = source.height();
+    std::cout << "Frame width: " << frame_width << "\n";
+    std::cout << "Frame height: " << frame_height << "\n";
+    const int frame_count = source.frame_count();
+    std::cout << "Frame count: " << frame_count << "\n";
+    // a raw video pipe has no frame count and is scored until it runs dry
+    const bool streamed = source.streamed();
+
+    cv::Mat mask;
+    if (!build_mask(options, frame_width, frame_height, mask))
+    {
+        return false;
+    }
+    PatchGrid grid = build_patch_grid(mask, frame_width, frame_height, w, h);
+
+    ClassifyStats stats;
+    stats.extract_seconds = 0.0;
+    stats.infer_seconds = 0.0;
+    stats.patches = 0;
+    scores.assign(frame_count, 0.0f);
+    decoded.assign(frame_count, false);
+    std::list<cv::Mat> prev_frames;
+    for (int fn = 0; streamed || fn < frame_count; ++fn)
+    {
+        Clock::time_point decode_start = Clock::now();
+        cv::Mat frame;
+        bool read = source.read(frame);
+        timing.decode_seconds += seconds_since(decode_start);
+        if (!read)
+        {
+            if (streamed)
+            {
+                break;
+            }
+            std::cout << "Frame empty: "<< fn << "\n";
+            continue;
+        }
+        if (streamed)
+        {
+            scores.push_back(0.0f);
+            decoded.push_back(false);
+        }
+        prev_frames.push_front(frame);
+        if (static_cast<int>(prev_frames.size()) == 1)
+        {
+            // preload f frames
+            for (int i = 0; i < f - 1; ++i)
+            {
+                prev_frames.push_front(frame);
+            }
+        }
+        while (static_cast<int>(prev_frames.size()) > f)
+        {
+            prev_frames.pop_back();
+        }
+        classifiers::FrameResult result;
+        classify_frame(classifier, prev_frames, grid, w, h, f, options.adaptive_step, result, &stats);
+        scores[fn] = result.output_fraction;
+        decoded[fn] = true;
+        timing.frames++;
+        if (options.verbose)
+        {
+            std::cout << "Frame " << fn << " / " << frame_count << " score: " << result.output_fraction << "\n";
+        }
+    }
+    timing.extract_seconds = stats.extract_seconds;
+    timing.infer_seconds = stats.infer_seconds;
+    timing.patches = stats.patches;
+    return true;
+}
+
+void compute_thresholds(const std::vector<float>& scores,
+                        const std::vector<bool>& decoded,
+                        const std::vector<bool>& truth,
+                        const std::vector<float>& thresholds,
+                        std::vector<ThresholdResult>& results)
+{
+    for (size_t t = 0; t < thresholds.size(); ++t)
+    {
+        ThresholdResult result;
+        result.threshold = thresholds[t];
+        result.tp = 0;
+        result.fp = 0;
+        result.tn = 0;
+        result.fn = 0;
+        for (size_t i = 0; i < scores.size(); ++i)
+        {
+            // frames that failed to decode have no score
+            if (!decoded[i])
+            {
+                continue;
+            }
+            // the same decision classify makes for a frame
+            bool predicted = scores[i] > thresholds[t];
+            if (predicted && truth[i])
+            {
+                result.tp++;
+            }
+            else if (predicted)
+            {
+                result.fp++;
+            }
+            else if (truth[i])
+            {
+                result.fn++;
+            }
+            else
+            {
+                result.tn++;
+            }
+        }
+        result.precision = result.tp + result.fp > 0 ? static_cast<double>(result.tp) / (result.tp + result.fp) : 1.0;
+        result.recall = result.tp + result.fn > 0 ? static_cast<double>(result.tp) / (result.tp + result.fn) : 1.0;
+        result.f1 = result.precision + result.recall > 0.0 ? 2.0 * result.precision * result.recall / (result.precision + result.recall) : 0.0;
+        result.fpr = result.fp + result.tn > 0 ? static_cast<double>(result.fp) / (result.fp + result.tn) : 0.0;
+        results.push_back(result);
+    }
+}
+
+// area under the ROC curve through the threshold points, closed with (0, 0) and (1, 1)
+double roc_auc(const std::vector<ThresholdResult>& results)
+{
+    std::vector<std::pair<double, double> > points;
+    points.push_back(std::make_pair(0.0, 0.0));
+    points.push_back(std::make_pair(1.0, 1.0));
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        points.push_back(std::make_pair(results[i].fpr, results[i].recall));
+    }
+    std::sort(points.begin(), points.end());
+    double auc = 0.0;
+    for (size_t i = 1; i < points.size(); ++i)
+    {
+        auc += (points[i].first - points[i - 1].first) * (points[i].second + points[i - 1].second) * 0.5;
+    }
+    return auc;
+}
+
+bool write_json(const std::string& json_path,
+                const std::string& input_path,
+                const std::string& classifier_path,
+                const std::string& marked_path,
+                const ClassifyOptions& options,
+                const int positives,
+                const int skipped,
+                const StageTiming& timing,
+                const std::vector<ThresholdResult>& results,
+                const double auc)
+{
+    std::ofstream json_file(json_path.c_str());
+    if (!json_file)
+    {
+        std::cerr << "Failed to open JSON output: " << json_path << "\n";
+        return false;
+    }
+    json_file << std::setprecision(6);
+    json_file << "{\n";
+    json_file << "  \"input\": " << json_string(input_path) << ",\n";
+    json_file << "  \"classifier\": " << json_string(classifier_path) << ",\n";
+    json_file << "  \"marked\": " << json_string(marked_path) << ",\n";
+    json_file << "  \"weight_precision\": " << json_string(classifiers::precision_name(options.precision)) << ",\n";
+    json_file << "  \"adaptive_step\": " << options.adaptive_step << ",\n";
+    json_file << "  \"masked\": " << ((!options.mask_path.empty() || options.use_roi || !options.exclude_rects.empty()) ? "true" : "false") << ",\n";
+    json_file << "  \"frames\": " << timing.frames << ",\n";
+    json_file << "  \"skipped_frames\": " << skipped << ",\n";
+    json_file << "  \"positives\": " << positives << ",\n";
+    json_file << "  \"timing\": {\n";
+    json_file << "    \"load_seconds\": " << timing.load_seconds << ",\n";
+    json_file << "    \"decode_seconds\": " << timing.decode_seconds << ",\n";
+    json_file << "    \"extract_seconds\": " << timing.extract_seconds << ",\n";
+    json_file << "    \"infer_seconds\": " << timing.infer_seconds << ",\n";
+    json_file << "    \"total_seconds\": " << timing.total_seconds << ",\n";
+    json_file << "    \"patches\": " << timing.patches << ",\n";
+    json_file << "    \"frames_per_second\": " << (timing.total_seconds > 0.0 ? timing.frames / timing.total_seconds : 0.0) << ",\n";
+    json_file << "    \"patches_per_second\": " << (timing.total_seconds > 0.0 ? timing.patches / timing.total_seconds : 0.0) << "\n";
+    json_file << "  },\n";
+    json_file << "  \"auc\": " << auc << ",\n";
+    json_file << "  \"thresholds\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const ThresholdResult& r = results[i];
+        json_file << "    {\"threshold\": " << r.threshold
+                  << ", \"tp\": " << r.tp << ", \"fp\": " << r.fp << ", \"tn\": " << r.tn << ", \"fn\": " << r.fn
+                  << ", \"precision\": " << r.precision << ", \"recall\": " << r.recall << ", \"f1\": " << r.f1
+                  << ", \"fpr\": " << r.fpr << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json_file << "  ]\n";
+    json_file << "}\n";
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::cout << "Evaluate\n";
+    std::cout << "by Laurence Emms\n";
+
+    int infer_threads = omp_get_max_threads();
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "Print help message")
+        ("version,v", "Print version number")
+        ("input,i", po::value<std::string>(), "Input video file")
+        ("classifier,c", po::value<std::string>(), "Classifier file")
+        ("marked", po::value<std::string>(), "Ground truth marked frames file")
+        ("json", po::value<std::string>(), "Write the report as JSON to this file")
+        ("thresholds", po::value<std::string>(), "Comma separated marked thresholds to report")
+        ("mask", po::value<std::string>(), "Mask image, only patches centered on non-zero pixels are classified")
+        ("roi", po::value<std::string>(), "Regions to classify as x,y,width,height;...")
+        ("exclude", po::value<std::string>(), "Regions to skip as x,y,width,height;...")
+        ("adaptive", po::value<int>(), "Classify every Nth patch and densify around positives")
+        ("precision", po::value<std::string>(), "Weight storage for inference: fp32, fp16 or bf16")
+        ("infer-threads", po::value<int>(&infer_threads), "Inference threads")
+        ("verbose", "Force verbose output")
+        ;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << desc << "\n";
+        return 0;
+    }
+
+    if (vm.count("version"))
+    {
+        std::cout << "Evaluate 1.0\n";
+        return 0;
+    }
+
+    if (vm.count("input") == 0)
+    {
+        std::cerr << "Input file not specified\n";
+        return 1;
+    }
+
+    if (vm.count("classifier") == 0)
+    {
+        std::cerr << "Classifier file not specified\n";
+        return 1;
+    }
+
+    if (vm.count("marked") == 0)
+    {
+        std::cerr << "Marked file not specified\n";
+        return 1;
+    }
+
+    fs::path input_path(vm["input"].as<std::string>());
+    fs::path classifier_path(vm["classifier"].as<std::string>());
+    fs::path marked_path(vm["marked"].as<std::string>());
+
+    if (!fs::exists(input_path))
+    {
+        std::cerr << "Input file does not exist: " << input_path.string() << "\n";
+        return 1;
+    }
+
+    if (!fs::exists(classifier_path))
+    {
+        std::cerr << "Classifier file does not exist: " << classifier_path.string() << "\n";
+        return 1;
+    }
+
+    if (!fs::exists(marked_path))
+    {
+        std::cerr << "Marked file does not exist: " << marked_path.string() << "\n";
+        return 1;
+    }
+
+    if (infer_threads < 1)
+    {
+        std::cerr << "Inference threads must be at least 1\n";
+        return 1;
+    }
+    omp_set_num_threads(infer_threads);
+
+    ClassifyOptions options;
+    options.w = 8;
+    options.h = 8;
+    options.f = 4;
+    options.adaptive_step = 1;
+    options.marked_threshold = 0.0f;
+    options.precision = classifiers::PRECISION_FP32;
+    options.use_roi = vm.count("roi") != 0;
+    options.display_scale = 0.4f;
+    options.show = false;
+    options.verbose = vm.count("verbose") != 0;
+    if (vm.count("mask") != 0)
+    {
+        options.mask_path = vm["mask"].as<std::string>();
+    }
+    if (vm.count("roi") != 0 && !parse_rects(vm["roi"].as<std::string>(), options.roi_rects))
+    {
+        return 1;
+    }
+    if (vm.count("exclude") != 0 && !parse_rects(vm["exclude"].as<std::string>(), options.exclude_rects))
+    {
+        return 1;
+    }
+    if (vm.count("adaptive") != 0)
+    {
+        options.adaptive_step = vm["adaptive"].as<int>();
+        if (options.adaptive_step < 1)
+        {
+            std::cerr << "Adaptive step must be at least 1\n";
+            return 1;
+        }
+    }
+
+    if (vm.count("precision") != 0 && !classifiers::parse_precision(vm["precision"].as<std::string>(), options.precision))
+    {
+        std::cerr << "Unknown weight precision: " << vm["precision"].as<std::string>() << "\n";
+        return 1;
+    }
+
+    std::vector<float> thresholds;
+    if (vm.count("thresholds") != 0)
+    {
+        std::vector<std::string> values;
+        boost::split(values, vm["thresholds"].as<std::string>(), boost::is_any_of(","));
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            boost::algorithm::trim(values[i]);
+            std::istringstream value_stream(values[i]);
+            float threshold = 0.0f;
+            if (!(value_stream >> threshold))
+            {
+                std::cerr << "Invalid threshold: " << values[i] << "\n";
+                return 1;
+            }
+            thresholds.push_back(threshold);
+        }
+    }
+    else
+    {
+        const float default_thresholds[] = {0.0f, 0.001f, 0.0025f, 0.005f, 0.01f, 0.025f, 0.05f, 0.1f, 0.25f, 0.5f};
+        thresholds.assign(default_thresholds, default_thresholds + sizeof(default_thresholds) / sizeof(default_thresholds[0]));
+    }
+
+    StageTiming timing;
+    timing.load_seconds = 0.0;
+    timing.decode_seconds = 0.0;
+    timing.extract_seconds = 0.0;
+    timing.infer_seconds = 0.0;
+    timing.total_seconds = 0.0;
+    timing.patches = 0;
+    timing.frames = 0;
+
+    Clock::time_point total_start = Clock::now();
+    classifiers::MLPClassifier classifier;
+    {
+        std::cout << "Reading classifier file: " << classifier_path.string() << "\n";
+        std::ifstream classifier_file(classifier_path.string().c_str());
+        classifier.read(classifier_file);
+        if (classifier.num_layers() <= 0)
+        {
+            std::cerr << "Error: Classifier has no layers\n";
+            return 1;
+        }
+        if (vm.count("precision") != 0)
+        {
+            classifier.set_precision(options.precision);
+        }
+        options.precision = classifier.precision();
+        std::cout << "Weight precision: " << classifiers::precision_name(classifier.precision()) << "\n";
+    }
+    timing.load_seconds = seconds_since(total_start);
+
+    std::vector<float> scores;
+    std::vector<bool> decoded;
+    std::cout << "Evaluating on input file: " << input_path.string() << "\n";
+    if (!score_video(classifier, input_path.string(), options, scores, decoded, timing))
+    {
+        std::cerr << "Failed to evaluate on video: " << input_path.string() << "\n";
+        return 1;
+    }
+    timing.total_seconds = seconds_since(total_start);
+
+    std::vector<bool> truth(scores.size(), false);
+    std::ifstream marked_file(marked_path.string().c_str());
+    int frame = 0;
+    int positives = 0;
+    while (marked_file >> frame)
+    {
+        if (frame >= 0 && frame < static_cast<int>(truth.size()) && decoded[frame] && !truth[frame])
+        {
+            truth[frame] = true;
+            positives++;
+        }
+    }
+    const int skipped = static_cast<int>(std::count(decoded.begin(), decoded.end(), false));
+    if (skipped > 0)
+    {
+        std::cout << "Skipped " << skipped << " frames that failed to decode\n";
+    }
+
+    std::vector<ThresholdResult> results;
+    compute_thresholds(scores, decoded, truth, thresholds, results);
+    double auc = roc_auc(results);
+
+    std::cout << "Frames: " << timing.frames << " skipped: " << skipped << " ground truth marked: " << positives << "\n";
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << "threshold  precision  recall     f1         fpr\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const ThresholdResult& r = results[i];
+        std::cout << std::setw(9) << r.threshold << "  " << std::setw(9) << r.precision << "  " << std::setw(9) << r.recall << "  " << std::setw(9) << r.f1 << "  " << std::setw(9) << r.fpr << "\n";
+    }
+    std::cout << "ROC AUC: " << auc << "\n";
+    std::cout << std::setprecision(3);
+    std::cout << "Load: " << timing.load_seconds << "s decode: " << timing.decode_seconds << "s extract: " << timing.extract_seconds << "s infer: " << timing.infer_seconds << "s total: " << timing.total_seconds << "s\n";
+    if (timing.total_seconds > 0.0)
+    {
+        std::cout << "Frames/sec: " << timing.frames / timing.total_seconds << " patches/sec: " << timing.patches / timing.total_seconds << "\n";
+    }
+
+    if (vm.count("json") != 0)
+    {
+        std::string json_path = vm["json"].as<std::string>();
+        std::cout << "Writing report to: " << json_path << "\n";
+        if (!write_json(json_path, input_path.string(), classifier_path.string(), marked_path.string(), options, positives, skipped, timing, results, auc))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,21 @@
+// blendkernels.h
+// Copyright Laurence Emms 2017
+
+#ifndef BLEND_KERNELS
+#define BLEND_KERNELS
+
+namespace interpolation
+{
+    // cpu features checked once, shared by the blend and motion estimation kernels
+    bool has_avx2();
+    bool has_sse2();
+
+    // weights are 8 bit fixed point, 0 gives from and 256 gives to
+    int blend_weight(const float alpha);
+
+    // outputs[i][k] = (from[k] * (256 - weights[i]) + to[k] * weights[i] + 128) >> 8 for k in [0, length)
+    // the two source rows are read once for all count outputs, using AVX2 or SSE2 when the cpu has them
+    void blend_row(const unsigned char* from, const unsigned char* to, const int length, unsigned char* const* outputs, const int* weights, const int count);
+}
+
+#endif // BLEND_KERNELS
@@ -0,0 +1,72 @@
+// framecache.h
+// Copyright Laurence Emms 2017
+
+#ifndef FRAME_CACHE
+#define FRAME_CACHE
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <opencv2/opencv.hpp>
+
+#include <videosource.h>
+
+namespace interpolation
+{
+    // display scaled frames kept in a least recently used cache within a memory budget,
+    // a background thread decodes ahead of and behind the frame being shown
+    // the source is borrowed and must not be read by anything else until the cache is destroyed
+    class FrameCache
+    {
+    public:
+        FrameCache(videoio::VideoSource& source,
+                   const float display_scale,
+                   const size_t budget_bytes,
+                   const int ahead,
+                   const int behind);
+        ~FrameCache();
+        bool open();
+        // moves the cursor to fn and blocks until it is decoded, false if the frame cannot be read
+        bool get(const int fn, cv::Mat& frame, double& msec);
+        size_t hits() const;
+        size_t misses() const;
+    private:
+        struct Entry
+        {
+            cv::Mat frame;
+            double msec;
+            std::list<int>::iterator order;
+        };
+
+        void run();
+        // next frame to decode around the cursor, -1 when the window is full
+        int next_target() const;
+        void insert(const int fn, const cv::Mat& frame, const double msec);
+
+        videoio::VideoSource& _source;
+        const float _display_scale;
+        const size_t _budget_bytes;
+        int _ahead;
+        int _behind;
+        int _frame_count;
+        int _cursor;
+        bool _stop;
+        size_t _bytes;
+        size_t _hits;
+        size_t _misses;
+        // most recently used at the front
+        std::list<int> _order;
+        std::unordered_map<int, Entry> _entries;
+        std::set<int> _failed;
+        mutable std::mutex _mutex;
+        std::condition_variable _condition;
+        std::thread _thread;
+    };
+}
+
+#endif // FRAME_CACHE
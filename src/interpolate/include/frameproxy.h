@@ -0,0 +1,52 @@
+// frameproxy.h
+// Copyright Laurence Emms 2017
+
+#ifndef FRAME_PROXY
+#define FRAME_PROXY
+
+#include <cstdint>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include <videosource.h>
+
+namespace interpolation
+{
+    // a memory mapped file of downscaled BGR frames indexed by frame number, used for marking in place of the source
+    // the file is tied to the size and modification time of the source and the scale it was built at
+    class FrameProxy
+    {
+    public:
+        FrameProxy();
+        ~FrameProxy();
+        // decodes the whole source once from its first frame, writing through a temporary file and a rename
+        static bool build(videoio::VideoSource& source, const std::string& proxy_path, const float scale);
+        // false if the proxy is missing, damaged or was built from a different source or scale
+        bool open(const std::string& proxy_path, const std::string& input_path, const float scale);
+        void close();
+        int frame_count() const;
+        // the frame points into the read only mapping and stays valid until the proxy is closed
+        cv::Mat frame(const int fn) const;
+        double msec(const int fn) const;
+    private:
+        struct Header
+        {
+            char magic[8];
+            std::uint64_t source_size;
+            std::int64_t source_mtime;
+            float scale;
+            std::int32_t width;
+            std::int32_t height;
+            std::int32_t frame_count;
+        };
+
+        static bool source_stamp(const std::string& input_path, std::uint64_t& size, std::int64_t& mtime);
+
+        unsigned char* _mapped;
+        size_t _mapped_size;
+        Header _header;
+    };
+}
+
+#endif // FRAME_PROXY
@@ -0,0 +1,50 @@
+// motionestimation.h
+// Copyright Laurence Emms 2017
+
+#ifndef MOTION_ESTIMATION
+#define MOTION_ESTIMATION
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace interpolation
+{
+    struct MotionOptions
+    {
+        // block size in pixels at full resolution
+        int block_size;
+        // full resolution pixels searched either side of zero, covered at the coarsest level and refined by one pixel per level
+        int search_range;
+        // luma pyramid levels, clamped so the coarsest blocks are at least 4 pixels
+        int levels;
+        // milliseconds allowed for each estimate, 0 for no limit
+        double budget_ms;
+    };
+
+    // one vector per block from a block in the first frame to its match in the second
+    struct MotionField
+    {
+        int block_size;
+        int cols;
+        int rows;
+        std::vector<float> dx;
+        std::vector<float> dy;
+        // blocks left at their coarser vector because the budget ran out
+        int unrefined;
+    };
+
+    // sum of absolute differences of two 8 bit blocks, using AVX2 or SSE2 when the cpu has them
+    int block_sad(const unsigned char* a, const int a_stride, const unsigned char* b, const int b_stride, const int width, const int height);
+
+    // hierarchical block matching on the luma of two BGR frames, blocks are searched in parallel
+    void estimate_motion(const cv::Mat& from, const cv::Mat& to, const MotionOptions& options, MotionField& field);
+
+    // per pixel vectors interpolated from the block field
+    void dense_flow(const MotionField& field, const cv::Size& size, cv::Mat& flow_x, cv::Mat& flow_y);
+
+    // the frame at alpha between from and to, both warped along the flow and blended
+    void interpolate_motion(const cv::Mat& from, const cv::Mat& to, const cv::Mat& flow_x, const cv::Mat& flow_y, const float alpha, cv::Mat& output);
+}
+
+#endif // MOTION_ESTIMATION
@@ -0,0 +1,70 @@
+// renderpipeline.h
+// Copyright Laurence Emms 2017
+
+#ifndef RENDER_PIPELINE
+#define RENDER_PIPELINE
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <videosink.h>
+
+namespace interpolation
+{
+    // frames are submitted in numbered sequences from any thread and written in sequence order on one thread
+    class OrderedWriter
+    {
+    public:
+        OrderedWriter(videoio::VideoSink& output, const size_t max_pending);
+        ~OrderedWriter();
+        // takes the frames, blocks while max_pending sequences are waiting unless this is the next one to write
+        // so the thread holding the oldest sequence can always make progress
+        void submit(const size_t sequence, std::vector<cv::Mat>& frames);
+        // blocks until every sequence below count is written
+        void finish(const size_t count);
+        size_t written() const;
+    private:
+        void run();
+
+        videoio::VideoSink& _output;
+        const size_t _max_pending;
+        size_t _next;
+        size_t _written;
+        bool _stop;
+        std::map<size_t, std::vector<cv::Mat> > _pending;
+        mutable std::mutex _mutex;
+        std::condition_variable _condition;
+        std::thread _thread;
+    };
+
+    // runs tasks on a fixed set of threads in submission order, each thread runs OpenMP regions single threaded
+    class RenderPool
+    {
+    public:
+        RenderPool(const int threads, const size_t max_queued);
+        ~RenderPool();
+        // blocks while max_queued tasks are waiting
+        void submit(const std::function<void()>& task);
+        // blocks until every submitted task has run
+        void wait();
+    private:
+        void run();
+
+        const size_t _max_queued;
+        int _active;
+        bool _stop;
+        std::deque<std::function<void()> > _tasks;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        std::vector<std::thread> _threads;
+    };
+}
+
+#endif // RENDER_PIPELINE
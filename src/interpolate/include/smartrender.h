@@ -0,0 +1,68 @@
+// smartrender.h
+// Copyright Laurence Emms 2017
+
+#ifndef SMART_RENDER
+#define SMART_RENDER
+
+#include <string>
+#include <vector>
+
+#include <videobackend.h>
+#include <videosource.h>
+
+namespace interpolation
+{
+    struct Keyframe
+    {
+        // display order frame number
+        int frame;
+        double time;
+    };
+
+    // coding parameters of the first video stream, rendered segments must share them to be joined with stream copies
+    // segments are MPEG-TS with the parameter sets in band before every keyframe, so the joined stream switches
+    // between the source and the rendered parameter sets instead of decoding everything with the first ones
+    struct StreamParameters
+    {
+        std::string codec;
+        std::string profile;
+        int level;
+        std::string pix_fmt;
+        // exact rational frame rate such as 30000/1001
+        std::string frame_rate;
+        // denominator of the stream time base
+        int timescale;
+    };
+
+    // a run of whole GOPs that is either stream copied or decoded and rendered
+    struct RenderSegment
+    {
+        int first;
+        int count;
+        double time;
+        bool render;
+    };
+
+    // keyframes of the first video stream from the frame index of the source, the video must start on a keyframe
+    // and have closed GOPs so a run of whole GOPs holds exactly its frames in decode order
+    bool probe_keyframes(const videoio::VideoSource& source, std::vector<Keyframe>& keyframes, int& frame_count);
+
+    // reads the coding parameters of the first video stream with ffprobe
+    bool probe_stream(const std::string& input_path, StreamParameters& parameters);
+
+    // sets up the ffmpeg encoder to write MPEG-TS segments with the parameters of the source,
+    // false when they cannot be matched and the rendered segments could not be stream copied alongside the source
+    bool match_encoder(const StreamParameters& parameters, videoio::BackendOptions& options);
+
+    // a GOP is rendered when it holds a marked frame or an anchor of a gap, neighbouring GOPs of the same kind are merged
+    std::vector<RenderSegment> plan_segments(const std::vector<bool>& marked, const std::vector<Keyframe>& keyframes, const int frame_count);
+
+    // stream copies the packets of the segment into an MPEG-TS segment with ffmpeg
+    bool copy_segment(const std::string& input_path, const RenderSegment& segment, const std::string& segment_path);
+
+    // joins the segments without re-encoding with the ffmpeg concat demuxer,
+    // a positive timescale is kept for the track when the output is mp4 or mov
+    bool concat_segments(const std::vector<std::string>& segment_paths, const std::string& list_path, const std::string& output_path, const int timescale);
+}
+
+#endif // SMART_RENDER
@@ -0,0 +1,139 @@
+// blendkernels.cpp
+// Copyright Laurence Emms 2017
+
+#include "blendkernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BLEND_KERNELS_X86
+#endif
+
+namespace interpolation
+{
+    namespace
+    {
+        // the weighted sum is at most 255 * 256 + 128 so it fits in an unsigned 16 bit lane
+        void blend_row_scalar(const unsigned char* from, const unsigned char* to, const int begin, const int end, unsigned char* const* outputs, const int* weights, const int count)
+        {
+            for (int k = begin; k < end; ++k)
+            {
+                const int a = from[k];
+                const int b = to[k];
+                for (int i = 0; i < count; ++i)
+                {
+                    outputs[i][k] = static_cast<unsigned char>((a * (256 - weights[i]) + b * weights[i] + 128) >> 8);
+                }
+            }
+        }
+
+#ifdef BLEND_KERNELS_X86
+        // bytes are widened to 16 bit against zero and packed back, unpack and pack both work per 128 bit lane so the order is kept
+        __attribute__((target("avx2")))
+        void blend_row_avx2(const unsigned char* from, const unsigned char* to, const int length, unsigned char* const* outputs, const int* weights, const int count)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i round = _mm256_set1_epi16(128);
+            int k = 0;
+            for (; k + 32 <= length; k += 32)
+            {
+                const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + k));
+                const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(to + k));
+                const __m256i a_lo = _mm256_unpacklo_epi8(a, zero);
+                const __m256i a_hi = _mm256_unpackhi_epi8(a, zero);
+                const __m256i b_lo = _mm256_unpacklo_epi8(b, zero);
+                const __m256i b_hi = _mm256_unpackhi_epi8(b, zero);
+                for (int i = 0; i < count; ++i)
+                {
+                    const __m256i wb = _mm256_set1_epi16(static_cast<short>(weights[i]));
+                    const __m256i wa = _mm256_set1_epi16(static_cast<short>(256 - weights[i]));
+                    __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(a_lo, wa), _mm256_mullo_epi16(b_lo, wb)), round);
+                    __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(a_hi, wa), _mm256_mullo_epi16(b_hi, wb)), round);
+                    lo = _mm256_srli_epi16(lo, 8);
+                    hi = _mm256_srli_epi16(hi, 8);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(outputs[i] + k), _mm256_packus_epi16(lo, hi));
+                }
+            }
+            if (k < length)
+            {
+                blend_row_scalar(from, to, k, length, outputs, weights, count);
+            }
+        }
+
+        __attribute__((target("sse2")))
+        void blend_row_sse2(const unsigned char* from, const unsigned char* to, const int length, unsigned char* const* outputs, const int* weights, const int count)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i round = _mm_set1_epi16(128);
+            int k = 0;
+            for (; k + 16 <= length; k += 16)
+            {
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + k));
+                const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(to + k));
+                const __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+                const __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+                const __m128i b_lo = _mm_unpacklo_epi8(b, zero);
+                const __m128i b_hi = _mm_unpackhi_epi8(b, zero);
+                for (int i = 0; i < count; ++i)
+                {
+                    const __m128i wb = _mm_set1_epi16(static_cast<short>(weights[i]));
+                    const __m128i wa = _mm_set1_epi16(static_cast<short>(256 - weights[i]));
+                    __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(a_lo, wa), _mm_mullo_epi16(b_lo, wb)), round);
+                    __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(a_hi, wa), _mm_mullo_epi16(b_hi, wb)), round);
+                    lo = _mm_srli_epi16(lo, 8);
+                    hi = _mm_srli_epi16(hi, 8);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(outputs[i] + k), _mm_packus_epi16(lo, hi));
+                }
+            }
+            if (k < length)
+            {
+                blend_row_scalar(from, to, k, length, outputs, weights, count);
+            }
+        }
+#endif
+    }
+
+    bool has_avx2()
+    {
+#ifdef BLEND_KERNELS_X86
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    bool has_sse2()
+    {
+#ifdef BLEND_KERNELS_X86
+        static const bool supported = __builtin_cpu_supports("sse2");
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    int blend_weight(const float alpha)
+    {
+        return std::max(0, std::min(256, static_cast<int>(std::floor(alpha * 256.0f + 0.5f))));
+    }
+
+    void blend_row(const unsigned char* from, const unsigned char* to, const int length, unsigned char* const* outputs, const int* weights, const int count)
+    {
+#ifdef BLEND_KERNELS_X86
+        if (has_avx2())
+        {
+            blend_row_avx2(from, to, length, outputs, weights, count);
+            return;
+        }
+        if (has_sse2())
+        {
+            blend_row_sse2(from, to, length, outputs, weights, count);
+            return;
+        }
+#endif
+        blend_row_scalar(from, to, 0, length, outputs, weights, count);
+    }
+}
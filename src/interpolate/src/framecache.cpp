@@ -0,0 +1,202 @@
+// framecache.cpp
+// Copyright Laurence Emms 2017
+
+#include "framecache.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace interpolation
+{
+    FrameCache::FrameCache(videoio::VideoSource& source,
+                           const float display_scale,
+                           const size_t budget_bytes,
+                           const int ahead,
+                           const int behind) :
+        _source(source),
+        _display_scale(display_scale),
+        _budget_bytes(budget_bytes),
+        _ahead(std::max(0, ahead)),
+        _behind(std::max(0, behind)),
+        _frame_count(0),
+        _cursor(0),
+        _stop(false),
+        _bytes(0),
+        _hits(0),
+        _misses(0)
+    {
+    }
+
+    FrameCache::~FrameCache()
+    {
+        if (_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+                _condition.notify_all();
+            }
+            _thread.join();
+        }
+    }
+
+    bool FrameCache::open()
+    {
+        if (!_source.is_open())
+        {
+            return false;
+        }
+        _frame_count = _source.frame_count();
+
+        // the window is shrunk to fit the budget so prefetching never evicts the frames around the cursor
+        int width = static_cast<int>(static_cast<float>(_source.width()) * _display_scale);
+        int height = static_cast<int>(static_cast<float>(_source.height()) * _display_scale);
+        size_t frame_bytes = std::max<size_t>(1, static_cast<size_t>(width) * height * 3);
+        int window = static_cast<int>(std::max<size_t>(1, _budget_bytes / frame_bytes));
+        while (_ahead + _behind + 1 > window && (_ahead > 0 || _behind > 0))
+        {
+            if (_ahead >= _behind)
+            {
+                _ahead--;
+            }
+            else
+            {
+                _behind--;
+            }
+        }
+        std::cout << "Frame cache: " << window << " frames, prefetching " << _ahead << " ahead and " << _behind << " behind\n";
+
+        _thread = std::thread(&FrameCache::run, this);
+        return true;
+    }
+
+    bool FrameCache::get(const int fn, cv::Mat& frame, double& msec)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cursor = fn;
+        _condition.notify_all();
+        std::unordered_map<int, Entry>::iterator it = _entries.find(fn);
+        if (it != _entries.end())
+        {
+            _hits++;
+        }
+        else
+        {
+            _misses++;
+            while ((it = _entries.find(fn)) == _entries.end() && _failed.count(fn) == 0)
+            {
+                _condition.wait(lock);
+            }
+            if (it == _entries.end())
+            {
+                return false;
+            }
+        }
+        _order.splice(_order.begin(), _order, it->second.order);
+        frame = it->second.frame;
+        msec = it->second.msec;
+        return true;
+    }
+
+    size_t FrameCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _hits;
+    }
+
+    size_t FrameCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _misses;
+    }
+
+    int FrameCache::next_target() const
+    {
+        // the frame being waited on, then ahead in viewing order, then the oldest missing frame behind
+        // so a backwards step decodes the run behind the cursor in one pass after a single seek
+        // the count is approximate, the cursor is always tried but prefetching stops at the count
+        const int last = _frame_count > 0 ? std::max(_cursor, _frame_count - 1) : _cursor + _ahead;
+        for (int fn = _cursor; fn <= std::min(_cursor + _ahead, last); ++fn)
+        {
+            if (_entries.count(fn) == 0 && _failed.count(fn) == 0)
+            {
+                return fn;
+            }
+        }
+        for (int fn = std::max(0, _cursor - _behind); fn < _cursor; ++fn)
+        {
+            if (_entries.count(fn) == 0 && _failed.count(fn) == 0)
+            {
+                return fn;
+            }
+        }
+        return -1;
+    }
+
+    void FrameCache::insert(const int fn, const cv::Mat& frame, const double msec)
+    {
+        // only frames outside the window are evicted, otherwise the prefetch would decode the frames it just evicted
+        size_t frame_bytes = frame.total() * frame.elemSize();
+        std::list<int>::iterator candidate = _order.end();
+        while (_bytes + frame_bytes > _budget_bytes && candidate != _order.begin())
+        {
+            --candidate;
+            if (*candidate >= _cursor - _behind && *candidate <= _cursor + _ahead)
+            {
+                continue;
+            }
+            std::unordered_map<int, Entry>::iterator it = _entries.find(*candidate);
+            _bytes -= it->second.frame.total() * it->second.frame.elemSize();
+            _entries.erase(it);
+            candidate = _order.erase(candidate);
+        }
+        _order.push_front(fn);
+        Entry& entry = _entries[fn];
+        entry.frame = frame;
+        entry.msec = msec;
+        entry.order = _order.begin();
+        _bytes += frame_bytes;
+    }
+
+    void FrameCache::run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            int target = -1;
+            while (!_stop && (target = next_target()) < 0)
+            {
+                _condition.wait(lock);
+            }
+            if (_stop)
+            {
+                return;
+            }
+            lock.unlock();
+
+            // decoding forward from the current position is cheaper than a seek back to the previous keyframe
+            // decoding forward from the current position is cheaper than a seek back to the previous keyframe,
+            // a failed seek would return some other frame as the target
+            cv::Mat decoded;
+            bool read = _source.seek(target) && _source.read(decoded);
+            double msec = _source.msec();
+            cv::Mat scaled;
+            if (read)
+            {
+                cv::Size size(static_cast<int>(static_cast<float>(decoded.cols) * _display_scale), static_cast<int>(static_cast<float>(decoded.rows) * _display_scale));
+                cv::resize(decoded, scaled, size);
+            }
+
+            lock.lock();
+            if (read)
+            {
+                insert(target, scaled, msec);
+            }
+            else
+            {
+                _failed.insert(target);
+            }
+            _condition.notify_all();
+        }
+    }
+}
@@ -0,0 +1,220 @@
+// frameproxy.cpp
+// Copyright Laurence Emms 2017
+
+#include "frameproxy.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace interpolation
+{
+    // file layout: header, frame_count frames of width * height * 3 bytes, frame_count timestamps
+    namespace
+    {
+        const char proxy_magic[8] = {'I', 'P', 'R', 'O', 'X', 'Y', '1', '\0'};
+    }
+
+    FrameProxy::FrameProxy() :
+        _mapped(nullptr),
+        _mapped_size(0)
+    {
+        std::memset(&_header, 0, sizeof(_header));
+    }
+
+    FrameProxy::~FrameProxy()
+    {
+        close();
+    }
+
+    bool FrameProxy::source_stamp(const std::string& input_path, std::uint64_t& size, std::int64_t& mtime)
+    {
+        boost::system::error_code error;
+        size = static_cast<std::uint64_t>(fs::file_size(input_path, error));
+        if (error)
+        {
+            return false;
+        }
+        mtime = static_cast<std::int64_t>(fs::last_write_time(input_path, error));
+        return !error;
+    }
+
+    bool FrameProxy::build(videoio::VideoSource& source, const std::string& proxy_path, const float scale)
+    {
+        const std::string& input_path = source.path();
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, proxy_magic, sizeof(proxy_magic));
+        header.scale = scale;
+        if (!source_stamp(input_path, header.source_size, header.source_mtime))
+        {
+            std::cerr << "Failed to stat source: " << input_path << "\n";
+            return false;
+        }
+
+        if (!source.set_range(0, -1))
+        {
+            std::cerr << "Failed to seek to the start of: " << input_path << "\n";
+            return false;
+        }
+        header.width = static_cast<std::int32_t>(static_cast<float>(source.width()) * scale);
+        header.height = static_cast<std::int32_t>(static_cast<float>(source.height()) * scale);
+        if (header.width <= 0 || header.height <= 0)
+        {
+            std::cerr << "Invalid proxy size\n";
+            return false;
+        }
+
+        // frames are stored uncompressed, long sources need a lot of space next to them
+        const std::uint64_t frame_bytes = static_cast<std::uint64_t>(header.width) * header.height * 3 + sizeof(double);
+        const std::uint64_t estimated_bytes = sizeof(header) + frame_bytes * static_cast<std::uint64_t>(std::max(0, source.frame_count()));
+        fs::path proxy_dir = fs::absolute(proxy_path).parent_path();
+        boost::system::error_code error;
+        fs::space_info space = fs::space(proxy_dir, error);
+        std::cout << "Proxy size: about " << estimated_bytes / (1024 * 1024) << " MB\n";
+        if (!error && estimated_bytes > space.available)
+        {
+            std::cerr << "Not enough free space for the proxy in " << proxy_dir.string() << ": needs about "
+                      << estimated_bytes / (1024 * 1024) << " MB, " << space.available / (1024 * 1024) << " MB available\n";
+            return false;
+        }
+
+        std::string temp_path = proxy_path + ".tmp";
+        std::ofstream proxy_file(temp_path.c_str(), std::ios::binary);
+        if (!proxy_file)
+        {
+            std::cerr << "Failed to write proxy: " << temp_path << "\n";
+            return false;
+        }
+        // the header is rewritten with the frame count once the source has been read
+        proxy_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<double> timestamps;
+        cv::Mat frame;
+        cv::Mat scaled;
+        while (source.read(frame))
+        {
+            timestamps.push_back(source.msec());
+            // area averaging keeps fine detail legible at a small scale
+            cv::resize(frame, scaled, cv::Size(header.width, header.height), 0, 0, cv::INTER_AREA);
+            for (int y = 0; y < scaled.rows; ++y)
+            {
+                proxy_file.write(reinterpret_cast<const char*>(scaled.ptr(y)), static_cast<std::streamsize>(header.width) * 3);
+            }
+            if (timestamps.size() % 500 == 0)
+            {
+                std::cout << "Proxy frames: " << timestamps.size() << "\n";
+            }
+        }
+
+        header.frame_count = static_cast<std::int32_t>(timestamps.size());
+        if (!timestamps.empty())
+        {
+            proxy_file.write(reinterpret_cast<const char*>(&timestamps[0]), static_cast<std::streamsize>(timestamps.size() * sizeof(double)));
+        }
+        proxy_file.seekp(0);
+        proxy_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        proxy_file.close();
+        if (!proxy_file)
+        {
+            std::cerr << "Failed to write proxy: " << temp_path << "\n";
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        if (std::rename(temp_path.c_str(), proxy_path.c_str()) != 0)
+        {
+            std::cerr << "Failed to move proxy into place: " << proxy_path << "\n";
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        std::cout << "Built proxy of " << header.frame_count << " frames at " << header.width << "x" << header.height << ": " << proxy_path << "\n";
+        return true;
+    }
+
+    bool FrameProxy::open(const std::string& proxy_path, const std::string& input_path, const float scale)
+    {
+        close();
+        int fd = ::open(proxy_path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(Header))
+        {
+            ::close(fd);
+            return false;
+        }
+        size_t mapped_size = static_cast<size_t>(file_stat.st_size);
+        void* memory = mmap(NULL, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED)
+        {
+            std::cerr << "Failed to map proxy: " << proxy_path << "\n";
+            return false;
+        }
+
+        Header header;
+        std::memcpy(&header, memory, sizeof(header));
+        std::uint64_t source_size = 0;
+        std::int64_t source_mtime = 0;
+        size_t frame_bytes = static_cast<size_t>(header.width) * header.height * 3;
+        bool valid = std::memcmp(header.magic, proxy_magic, sizeof(proxy_magic)) == 0 &&
+                     header.scale == scale &&
+                     header.width > 0 && header.height > 0 && header.frame_count >= 0 &&
+                     source_stamp(input_path, source_size, source_mtime) &&
+                     header.source_size == source_size &&
+                     header.source_mtime == source_mtime &&
+                     mapped_size == sizeof(Header) + static_cast<size_t>(header.frame_count) * (frame_bytes + sizeof(double));
+        if (!valid)
+        {
+            munmap(memory, mapped_size);
+            return false;
+        }
+        _mapped = static_cast<unsigned char*>(memory);
+        _mapped_size = mapped_size;
+        _header = header;
+        return true;
+    }
+
+    void FrameProxy::close()
+    {
+        if (_mapped != nullptr)
+        {
+            munmap(_mapped, _mapped_size);
+            _mapped = nullptr;
+            _mapped_size = 0;
+        }
+    }
+
+    int FrameProxy::frame_count() const
+    {
+        return _mapped != nullptr ? _header.frame_count : 0;
+    }
+
+    cv::Mat FrameProxy::frame(const int fn) const
+    {
+        size_t frame_bytes = static_cast<size_t>(_header.width) * _header.height * 3;
+        unsigned char* data = _mapped + sizeof(Header) + static_cast<size_t>(fn) * frame_bytes;
+        return cv::Mat(_header.height, _header.width, CV_8UC3, data);
+    }
+
+    double FrameProxy::msec(const int fn) const
+    {
+        size_t frame_bytes = static_cast<size_t>(_header.width) * _header.height * 3;
+        const unsigned char* timestamps = _mapped + sizeof(Header) + static_cast<size_t>(_header.frame_count) * frame_bytes;
+        double value = 0.0;
+        std::memcpy(&value, timestamps + static_cast<size_t>(fn) * sizeof(double), sizeof(double));
+        return value;
+    }
+}
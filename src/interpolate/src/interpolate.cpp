@@ -3,66 +3,96 @@
 
 #include <cmath>
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <opencv2/opencv.hpp>
 
+#include <videosink.h>
+#include <videosource.h>
+
+#include "blendkernels.h"
+#include "framecache.h"
+#include "frameproxy.h"
+#include "motionestimation.h"
+#include "renderpipeline.h"
+#include "smartrender.h"
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
+// frames are read through a cache so stepping backwards does not seek and re-decode for every key press
+// with a proxy path the frames come from a downscaled proxy of the source instead, built on first use
+// both decode through the source opened in main, which is not read again until marking is done
 bool mark_video(std::vector<bool>& marked,
-                const std::string& input_path,
-                const float display_scale)
+                videoio::VideoSource& source,
+                const float display_scale,
+                const size_t cache_bytes,
+                const std::string& proxy_path)
 {
-    std::cout << "Reading input file: " << input_path << "\n";
-    cv::VideoCapture cap(input_path);
-    if (!cap.isOpened())
-    {
-        std::cerr << "Failed to open video capture\n";
-        return false;
-    }
-
-    //count frames
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
-
-    const double fourcc_d = cap.get(CV_CAP_PROP_FOURCC);
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_d);
-    std::cout << "FourCC: " << fourcc << "\n";
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    std::cout << "FPS: " << static_cast<int>(cap.get(CV_CAP_PROP_FPS)) << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
-
-    bool backtracked = false;
-    marked.resize(frame_count, false);
-    bool read_frame = true;
+    const std::string& input_path = source.path();
+    int frame_count = source.frame_count();
+
+    interpolation::FrameProxy proxy;
+    bool use_proxy = false;
+    if (!proxy_path.empty())
+    {
+        use_proxy = proxy.open(proxy_path, input_path, display_scale);
+        if (!use_proxy)
+        {
+            std::cout << "Building proxy: " << proxy_path << "\n";
+            use_proxy = interpolation::FrameProxy::build(source, proxy_path, display_scale) &&
+                        proxy.open(proxy_path, input_path, display_scale);
+        }
+        if (use_proxy)
+        {
+            // the proxy holds every decoded frame so its count is exact
+            frame_count = proxy.frame_count();
+            std::cout << "Marking from proxy: " << proxy_path << ", " << frame_count << " frames\n";
+        }
+        else
+        {
+            std::cerr << "Failed to use proxy, marking from the source\n";
+        }
+    }
+
+    std::unique_ptr<interpolation::FrameCache> cache;
+    if (!use_proxy)
+    {
+        cache.reset(new interpolation::FrameCache(source, display_scale, cache_bytes, 48, 24));
+        if (!cache->open())
+        {
+            return false;
+        }
+    }
+
+    // marks loaded from the file past the end of a shorter proxy are kept
+    marked.resize(std::max(frame_count, static_cast<int>(marked.size())), false);
     int fn = 0;
-    cv::Mat frame;
     while (fn < frame_count)
     {
-        if (backtracked)
+        cv::Mat frame;
+        double msec = 0.0;
+        if (use_proxy)
         {
-            cap.set(CV_CAP_PROP_POS_FRAMES, fn);
-            backtracked = false;
+            frame = proxy.frame(fn);
+            msec = proxy.msec(fn);
         }
-        if (read_frame)
+        else if (!cache->get(fn, frame, msec))
         {
-            if (!cap.read(frame))
-            {
-                std::cout << "Frame empty: " << fn << "\n";
-                continue;
-            }
+            std::cout << "Frame empty: " << fn << "\n";
+            fn++;
+            continue;
         }
         std::cout << "Frame number: " << fn << " / " << frame_count << "\n";
-        double msec = cap.get(CV_CAP_PROP_POS_MSEC);
         double seconds = std::floor(msec / 1000.0);
         double minutes = std::floor(seconds / 60.0);
         double hours = std::floor(minutes / 60.0);
@@ -70,13 +100,9 @@ bool mark_video(std::vector<bool>& marked,
         seconds -= minutes * 60.0;
         msec -= seconds * 1000.0;
         std::cout << "Time: " << std::setfill('0') << std::setw(2) << static_cast<int>(hours) << ":" << std::setw(2) << static_cast<int>(minutes) << ":" << std::setw(2) << static_cast<int>(seconds) << ":" << std::setw(4) << static_cast<int>(msec) << "\n";
-        read_frame = true;
-        int fw = frame.cols;
-        int fh = frame.rows;
 
-        cv::Size size(static_cast<int>(static_cast<float>(fw) * display_scale), static_cast<int>(static_cast<float>(fh) * display_scale));
-        cv::Mat disp;
-        cv::resize(frame, disp, size);
+        // the frame is already display scaled and is shared with the cache or the proxy
+        cv::Mat disp = frame.clone();
         if (marked[fn])
         {
             cv::rectangle(disp, cv::Rect(0, 0, disp.cols, disp.rows), cv::Scalar(0, 0, 255), 5, 8, 0);
@@ -100,13 +126,11 @@ bool mark_video(std::vector<bool>& marked,
         }
         else if (key == 'b')
         {
-            backtracked = true;
-            fn--;
+            fn = std::max(0, fn - 1);
         }
         else if (key == 'v')
         {
-            backtracked = true;
-            fn -= 5;
+            fn = std::max(0, fn - 5);
         }
         else if (key == 'n')
         {
@@ -127,13 +151,8 @@ bool mark_video(std::vector<bool>& marked,
             if (found)
             {
                 std::cout << "Moving to next marked frame\n";
-                backtracked = true;
                 fn = fnext;
             }
-            else
-            {
-                read_frame = false;
-            }
         }
         else if (key == 'p')
         {
@@ -154,24 +173,21 @@ bool mark_video(std::vector<bool>& marked,
             if (found)
             {
                 std::cout << "Moving to previous marked frame\n";
-                backtracked = true;
                 fn = fprev;
             }
-            else
-            {
-                read_frame = false;
-            }
         }
         else if (key == 's')
         {
             std::cout << "Moving to start frame\n";
-            backtracked = true;
             fn = 0;
         }
         else if (key == 'q')
         {
             std::cout << "Quitting marking and saving marking file\n";
-            cap.release();
+            if (cache)
+            {
+                std::cout << "Frame cache hits: " << cache->hits() << " misses: " << cache->misses() << "\n";
+            }
             return true;
         }
         else
@@ -179,140 +195,256 @@ bool mark_video(std::vector<bool>& marked,
             fn++;
         }
     }
-    cap.release();
+    if (cache)
+    {
+        std::cout << "Frame cache hits: " << cache->hits() << " misses: " << cache->misses() << "\n";
+    }
     std::cout << "Video marking complete\n";
     return true;
 }
 
-bool process_video(cv::VideoWriter& output_video,
-                   const std::vector<bool>& marked,
-                   const std::string& input_path,
+void display_frame(const cv::Mat& frame,
+                   const bool marked,
                    const float display_scale)
 {
-    std::cout << "Reading input file: " << input_path << "\n";
-    cv::VideoCapture cap(input_path);
-    if (!cap.isOpened())
+    int fw = frame.cols;
+    int fh = frame.rows;
+    cv::Size size(static_cast<int>(static_cast<float>(fw) * display_scale), static_cast<int>(static_cast<float>(fh) * display_scale));
+    cv::Mat disp;
+    cv::resize(frame, disp, size);
+    if (marked)
     {
-        std::cerr << "Failed to open video capture\n";
-        return false;
+        cv::rectangle(disp, cv::Rect(0, 0, disp.cols, disp.rows), cv::Scalar(0, 0, 255), 5, 8, 0);
     }
+    cv::imshow("Display window", disp);
+    cv::waitKey(30);
+}
 
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
+// gap frames blended together in one pass over the anchors, bounds the memory held for long runs
+const int blend_batch = 16;
 
-    //count frames
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
+// number of batches render_gap emits for a gap
+int gap_batches(const cv::Mat& prev_frame,
+                const cv::Mat& next_frame,
+                const int gap)
+{
+    if (prev_frame.empty() && next_frame.empty())
+    {
+        return 0;
+    }
+    return (gap + blend_batch - 1) / blend_batch;
+}
 
-    const double fourcc_d = cap.get(CV_CAP_PROP_FOURCC);
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_d);
-    std::cout << "FourCC: " << fourcc << "\n";
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    std::cout << "FPS: " << static_cast<int>(cap.get(CV_CAP_PROP_FPS)) << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
+// render the gap frames between two anchors and emit them in order in batches of up to blend_batch frames
+// either anchor may be empty at the ends of the video
+void render_gap(const cv::Mat& prev_frame,
+                const cv::Mat& next_frame,
+                const int gap,
+                const bool motion,
+                const interpolation::MotionOptions& motion_options,
+                const std::function<void(std::vector<cv::Mat>&)>& emit)
+{
+    const cv::Mat& from = prev_frame.empty() ? next_frame : prev_frame;
+    const cv::Mat& to = next_frame.empty() ? prev_frame : next_frame;
+    if (from.empty())
+    {
+        return;
+    }
+    float inv_range = 1.0f / static_cast<float>(gap + 1);
 
-    int wh = frame_width * frame_height;
+    // motion needs both anchors, a run at either end of the video holds its one anchor
+    if (motion && !prev_frame.empty() && !next_frame.empty())
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        interpolation::MotionField field;
+        interpolation::estimate_motion(from, to, motion_options, field);
+        double estimate_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        // gaps can be rendered on several threads, the line is built first so it prints whole
+        std::ostringstream message;
+        message << "Motion estimated in " << estimate_ms << " ms";
+        if (field.unrefined > 0)
+        {
+            message << ", budget left " << field.unrefined << " blocks unrefined";
+        }
+        message << "\n";
+        std::cout << message.str();
+
+        cv::Mat flow_x;
+        cv::Mat flow_y;
+        interpolation::dense_flow(field, from.size(), flow_x, flow_y);
+        for (int batch = 0; batch < gap; batch += blend_batch)
+        {
+            std::vector<cv::Mat> interp_frames(std::min(blend_batch, gap - batch));
+            for (size_t i = 0; i < interp_frames.size(); ++i)
+            {
+                interpolation::interpolate_motion(from, to, flow_x, flow_y, static_cast<float>(batch + i + 1) * inv_range, interp_frames[i]);
+            }
+            emit(interp_frames);
+        }
+        return;
+    }
+
+    const int rows = from.rows;
+    const int row_length = from.cols * static_cast<int>(from.elemSize());
+    for (int batch = 0; batch < gap; batch += blend_batch)
+    {
+        const int count = std::min(blend_batch, gap - batch);
+        std::vector<cv::Mat> interp_frames(count);
+        std::vector<int> weights(count);
+        for (int i = 0; i < count; ++i)
+        {
+            interp_frames[i].create(from.rows, from.cols, from.type());
+            weights[i] = interpolation::blend_weight(static_cast<float>(batch + i + 1) * inv_range);
+        }
+
+#pragma omp parallel for
+        for (int y = 0; y < rows; ++y)
+        {
+            std::array<unsigned char*, blend_batch> outputs;
+            for (int i = 0; i < count; ++i)
+            {
+                outputs[i] = interp_frames[i].ptr(y);
+            }
+            interpolation::blend_row(from.ptr(y), to.ptr(y), row_length, outputs.data(), weights.data(), count);
+        }
+
+        emit(interp_frames);
+    }
+}
+
+// show displays every written frame, without it frames are rendered as fast as they decode and encode
+// frames are read once in order, marked frames are only counted so a gap of any length holds just its two anchors
+// when nothing is shown gaps render on a pool of render_threads while decoding continues,
+// and every frame goes through a reorder buffer to a single writer thread
+// frames in [first_frame, end_frame) are processed, a negative end_frame reads to the end of the video
+bool process_video(videoio::VideoSink& output_video,
+                   const std::vector<bool>& marked,
+                   videoio::VideoSource& source,
+                   const float display_scale,
+                   const bool show,
+                   const bool motion,
+                   const interpolation::MotionOptions& motion_options,
+                   const int render_threads,
+                   const int first_frame,
+                   const int end_frame)
+{
+    const int frame_count = source.frame_count();
+
+    std::unique_ptr<interpolation::OrderedWriter> writer;
+    std::unique_ptr<interpolation::RenderPool> pool;
+    if (!show)
+    {
+        std::cout << "Render threads: " << render_threads << "\n";
+        writer.reset(new interpolation::OrderedWriter(output_video, 2 * render_threads + 2));
+        pool.reset(new interpolation::RenderPool(render_threads, 2 * render_threads));
+    }
+    size_t sequence = 0;
 
     cv::Mat prev_frame;
-    int fn = 0;
-    while (fn < frame_count)
+    int gap_start = 0;
+    int gap = 0;
+    int fn = first_frame;
+    source.set_range(first_frame, end_frame);
+    std::function<void(const cv::Mat&)> flush_gap = [&](const cv::Mat& next_frame)
+    {
+        if (pool)
+        {
+            // the batches of the gap take the next sequence numbers, the anchors are shared with the task
+            const size_t first_sequence = sequence;
+            sequence += gap_batches(prev_frame, next_frame, gap);
+            interpolation::OrderedWriter* ordered = writer.get();
+            const cv::Mat from = prev_frame;
+            const cv::Mat to = next_frame;
+            const int count = gap;
+            pool->submit([=]()
+            {
+                size_t batch_sequence = first_sequence;
+                render_gap(from, to, count, motion, motion_options, [&](std::vector<cv::Mat>& frames)
+                {
+                    ordered->submit(batch_sequence++, frames);
+                });
+            });
+        }
+        else
+        {
+            int interp_fn = gap_start;
+            render_gap(prev_frame, next_frame, gap, motion, motion_options, [&](std::vector<cv::Mat>& frames)
+            {
+                for (const cv::Mat& interp_frame : frames)
+                {
+                    std::cout << "interpolating frame: " << interp_fn++ << "\n";
+                    output_video.write(interp_frame);
+                    if (show)
+                    {
+                        display_frame(interp_frame, true, display_scale);
+                    }
+                }
+            });
+        }
+        gap = 0;
+    };
+
+    // the approximate count can be short, keep reading until the decoder runs dry
+    while (true)
     {
+        // pooled buffers are only decoded into again once the writer and the gap renders have released them
         cv::Mat frame;
-        if (!cap.read(frame))
+        if (!source.read(frame))
         {
-            std::cout << "Frame empty: "<< fn << "\n";
-            continue;
+            break;
         }
         std::cout << "Frame number: " << fn << " / " << frame_count << "\n";
 
-        if (!marked[fn])
+        bool is_marked = fn < static_cast<int>(marked.size()) && marked[fn];
+        if (is_marked)
         {
-            output_video.write(frame);
-            int fw = frame.cols;
-            int fh = frame.rows;
-            cv::Size size(static_cast<int>(static_cast<float>(fw) * display_scale), static_cast<int>(static_cast<float>(fh) * display_scale));
-            cv::Mat disp;
-            cv::resize(frame, disp, size);
-            if (marked[fn])
+            if (gap == 0)
             {
-                cv::rectangle(disp, cv::Rect(0, 0, disp.cols, disp.rows), cv::Scalar(0, 0, 255), 5, 8, 0);
+                gap_start = fn;
             }
-            cv::imshow("Display window", disp);
-            cv::waitKey(30);
-            fn++;
+            gap++;
         }
         else
         {
-            // find next frame
-            int search_frame = fn + 1;
-            cv::Mat sframe;
-            while (marked[search_frame])
+            if (gap > 0)
             {
-                search_frame++;
-                while (!cap.read(sframe))
-                {
-                    std::cout << "Frame empty: " << search_frame << "\n";
-                }
+                flush_gap(frame);
             }
-            search_frame++;
-            while (!cap.read(sframe))
+            if (writer)
             {
-                std::cout << "Frame empty: " << search_frame << "\n";
+                std::vector<cv::Mat> frames(1, frame);
+                writer->submit(sequence++, frames);
             }
-            search_frame++;
-            while (!cap.read(sframe))
+            else
             {
-                std::cout << "Frame empty: " << search_frame << "\n";
+                output_video.write(frame);
             }
-            cv::Mat interp_frame = prev_frame.clone();
-            int range = search_frame - fn - 1;
-            float inv_range = 1.0f / static_cast<float>(range + 1);
-            for (int i = 0; i < range; ++i)
+            if (show)
             {
-                float alpha = static_cast<float>(i) * inv_range;
-#pragma omp parallel for
-                for (int t = 0; t < wh; ++t)
-                {
-                    int x = t % frame_width;
-                    int y = t / frame_width;
+                display_frame(frame, false, display_scale);
+            }
+            prev_frame = frame;
+        }
+        fn++;
+    }
 
-                    cv::Vec3b prev_texel = prev_frame.at<cv::Vec3b>(y, x);
-                    cv::Vec3b s_texel = sframe.at<cv::Vec3b>(y, x);
+    // a run reaching the end of the video holds the last unmarked frame
+    if (gap > 0)
+    {
+        flush_gap(cv::Mat());
+    }
 
-                    std::array<float, 3> interp_texel;
-                    cv::Vec3b itexel;
-                    for (int v = 0; v < 3; ++v)
-                    {
-                        interp_texel[v] = std::max(0.0f, std::min(255.0f, static_cast<float>(prev_texel[v]) * (1.0f - alpha) + static_cast<float>(s_texel[v]) * alpha));
-                        itexel[v] = static_cast<char>(interp_texel[v]);
-                    }
+    if (pool)
+    {
+        pool->wait();
+        writer->finish(sequence);
+        std::cout << "Frames written: " << writer->written() << "\n";
+    }
 
-                    interp_frame.at<cv::Vec3b>(y, x) = itexel;
-                }
-                std::cout << "interpolating frame: " << fn + i + 1 << "\n";
-                output_video.write(interp_frame);
-
-                int fw = frame.cols;
-                int fh = frame.rows;
-                cv::Size size(static_cast<int>(static_cast<float>(fw) * display_scale), static_cast<int>(static_cast<float>(fh) * display_scale));
-                cv::Mat disp;
-                cv::resize(interp_frame, disp, size);
-                if (marked[fn])
-                {
-                    cv::rectangle(disp, cv::Rect(0, 0, disp.cols, disp.rows), cv::Scalar(0, 0, 255), 5, 8, 0);
-                }
-                cv::imshow("Display window", disp);
-                cv::waitKey(30);
-            }
-            fn = search_frame;
-        }
-        prev_frame = frame.clone();
+    if (fn < (end_frame < 0 ? frame_count : end_frame))
+    {
+        std::cout << "Decoder stopped at frame " << fn << " of " << frame_count << "\n";
     }
-    cap.release();
     std::cout << "Video processing complete\n";
     return true;
 }
@@ -321,30 +453,52 @@ int main(int argc, char** argv)
 {
     std::cout << "Interpolate\n";
     std::cout << "by Laurence Emms\n";
-    std::cout << "Controls:\n";
-    std::cout << "Spacebar: Mark frame for interpolation and advance to next frame\n";
-    std::cout << "B: Navigate to previous frame\n";
-    std::cout << "V: Navigate back 5 frames\n";
-    std::cout << "N: Navigate to next marked frame\n";
-    std::cout << "P: Navigate to previous marked frame\n";
-    std::cout << "S: Navigate to the start frame\n";
-    std::cout << "Q: Quit marking and save marked file\n";
-    std::cout << "Any other key: Navigate to next frame\n";
-    std::cout << "Marked frames are indicated by a red border\n";
 
     po::options_description desc("Options");
     desc.add_options()
         ("help,h", "Print help message")
         ("version,v", "Print version number")
         ("input,i", po::value<std::string>(), "Input video file")
-        ("output,o", po::value<std::string>(), "Output video file")
+        ("output,o", po::value<std::string>(), "Output video file, a .vraw path writes uncompressed frames for the next tool")
         ("marked", po::value<std::string>(), "Marked frames file")
+        ("headless", "Render the frames in an existing marked file without marking or displaying")
+        ("motion", "Interpolate along block motion vectors instead of cross fading")
+        ("block-size", po::value<int>()->default_value(16), "Motion block size in pixels")
+        ("search-range", po::value<int>()->default_value(16), "Motion search range in pixels")
+        ("motion-budget", po::value<double>()->default_value(0.0), "Milliseconds allowed for motion estimation per gap, 0 for no limit")
+        ("render-threads", po::value<int>()->default_value(0), "Threads rendering gaps when nothing is displayed, 0 for one per core")
+        ("smart-render", "Stream copy the GOPs without marked frames and only render the GOPs around gaps, needs ffmpeg and an H.264 source with closed GOPs")
+        ("cache-mb", po::value<int>()->default_value(512), "Memory budget in megabytes for decoded frames while marking")
+        ("proxy", "Mark against a downscaled proxy of the input, built once and kept next to it as <input>.proxy, uncompressed so it needs free space for 3 bytes per display pixel per frame")
+        ("gstreamer", "Decode and encode with GStreamer pipelines instead of OpenCV when built with GStreamer")
+        ("ffmpeg", "Encode by piping frames into an ffmpeg process, falls back to OpenCV when ffmpeg is not installed")
+        ("codec", po::value<std::string>()->default_value("libx264"), "ffmpeg video encoder")
+        ("preset", po::value<std::string>()->default_value("medium"), "ffmpeg encoder preset, empty for the encoder default")
+        ("crf", po::value<int>()->default_value(18), "ffmpeg constant rate factor, negative for the encoder default")
+        ("pipe-bgr", "Pipe packed BGR frames to ffmpeg instead of converting them to YUV 4:2:0 first")
+        ("queue-depth", po::value<int>()->default_value(8), "Frames buffered ahead of the GStreamer or ffmpeg encoder")
+        ("io-threads", po::value<int>()->default_value(0), "GStreamer and ffmpeg decoder, converter and encoder threads, 0 to let each decide")
         ("force,f", "Force overwriting output")
         ;
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
 
+    bool headless = vm.count("headless") != 0;
+    if (!headless)
+    {
+        std::cout << "Controls:\n";
+        std::cout << "Spacebar: Mark frame for interpolation and advance to next frame\n";
+        std::cout << "B: Navigate to previous frame\n";
+        std::cout << "V: Navigate back 5 frames\n";
+        std::cout << "N: Navigate to next marked frame\n";
+        std::cout << "P: Navigate to previous marked frame\n";
+        std::cout << "S: Navigate to the start frame\n";
+        std::cout << "Q: Quit marking and save marked file\n";
+        std::cout << "Any other key: Navigate to next frame\n";
+        std::cout << "Marked frames are indicated by a red border\n";
+    }
+
     if (vm.count("help"))
     {
         std::cout << desc << "\n";
@@ -369,6 +523,12 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (headless && (vm.count("marked") == 0 || !fs::exists(vm["marked"].as<std::string>())))
+    {
+        std::cerr << "Headless rendering requires an existing marked file\n";
+        return 1;
+    }
+
     fs::path input_path(vm["input"].as<std::string>());
     fs::path output_path(vm["output"].as<std::string>());
     
@@ -394,36 +554,63 @@ int main(int argc, char** argv)
     }
 
     std::cout << "Reading input file: " << input_path.string() << "\n";
-    cv::VideoCapture cap(input_path.string());
-    if (!cap.isOpened())
+    // the source is opened once, marking, the proxy build and every rendered segment read through its decoder
+    videoio::BackendOptions backend = videoio::default_backend();
+    if (vm.count("gstreamer") != 0)
+    {
+        backend.backend = videoio::Backend::GStreamer;
+    }
+    backend.queue_depth = std::max(1, vm["queue-depth"].as<int>());
+    backend.threads = std::max(0, vm["io-threads"].as<int>());
+    backend.codec = vm["codec"].as<std::string>();
+    backend.preset = vm["preset"].as<std::string>();
+    backend.crf = vm["crf"].as<int>();
+    backend.pipe_yuv = vm.count("pipe-bgr") == 0;
+    // ffmpeg only encodes, the input is still decoded by the backend chosen above
+    videoio::BackendOptions output_backend = backend;
+    if (vm.count("ffmpeg") != 0)
+    {
+        output_backend.backend = videoio::Backend::FFmpeg;
+    }
+
+    videoio::VideoSource source;
+    if (!source.open(input_path.string(), backend))
     {
-        std::cerr << "Failed to open video capture\n";
         return 1;
     }
 
     std::cout << "Input format:\n";
-    const int fourcc_i = static_cast<int>(cap.get(CV_CAP_PROP_FOURCC));
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_i);
-    std::cout << "FourCC: " << fourcc << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    double fps = cap.get(CV_CAP_PROP_FPS);
-    std::cout << "FPS: " << fps << "\n";
-    double estimated_frame_count = cap.get(CV_CAP_PROP_FRAME_COUNT);
-    std::cout << "Estimated frame count: " << estimated_frame_count << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
-
-    // count frames
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-    cap.release();
+    source.print_info();
+    const int fourcc_i = source.fourcc();
+    const double fps = source.fps();
+    const int frame_count = source.frame_count();
 
     const float display_scale = 0.4f;
+
+    bool motion = vm.count("motion") != 0;
+    interpolation::MotionOptions motion_options;
+    motion_options.block_size = vm["block-size"].as<int>();
+    motion_options.search_range = vm["search-range"].as<int>();
+    motion_options.levels = 3;
+    motion_options.budget_ms = vm["motion-budget"].as<double>();
+
+    int render_threads = vm["render-threads"].as<int>();
+    if (render_threads <= 0)
+    {
+        render_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    if (motion && (motion_options.block_size < 4 || motion_options.search_range < 1))
+    {
+        std::cerr << "Motion block size must be at least 4 and search range at least 1\n";
+        return 1;
+    }
+    // marking navigates back and forth, a raw video pipe can only be rendered from a marked file
+    const bool streamed = source.streamed();
+    if (streamed && !headless)
+    {
+        std::cerr << "Marking needs a seekable input, use --headless with a marked file to render a raw video pipe\n";
+        return 1;
+    }
     std::vector<bool> marked(frame_count, false);
 
     fs::path marked_path;
@@ -437,21 +624,36 @@ int main(int argc, char** argv)
             int frame = 0;
             while (marked_file >> frame)
             {
+                // a pipe has no frame count, the largest marked frame decides how many are tracked
+                if (frame < 0 || (!streamed && frame >= frame_count))
+                {
+                    std::cerr << "Ignoring marked frame out of range: " << frame << "\n";
+                    continue;
+                }
+                if (frame >= static_cast<int>(marked.size()))
+                {
+                    marked.resize(frame + 1, false);
+                }
                 marked[frame] = true;
             }
         }
     }
 
-    std::cout << "Marking input file: " << input_path.string() << "\n";
-    if (!mark_video(marked,
-                    input_path.string(),
-                    display_scale))
+    if (!headless)
     {
-        std::cerr << "Failed to mark video: " << input_path.string() << "\n";
-        return 1;
+        std::cout << "Marking input file: " << input_path.string() << "\n";
+        if (!mark_video(marked,
+                        source,
+                        display_scale,
+                        static_cast<size_t>(std::max(1, vm["cache-mb"].as<int>())) * 1024 * 1024,
+                        vm.count("proxy") != 0 ? input_path.string() + ".proxy" : std::string()))
+        {
+            std::cerr << "Failed to mark video: " << input_path.string() << "\n";
+            return 1;
+        }
     }
 
-    if (vm.count("marked") != 0)
+    if (!headless && vm.count("marked") != 0)
     {
         std::cout << "Writing marked data to: " << marked_path.string() << "\n";
         std::ofstream marked_file(marked_path.string().c_str());
@@ -466,29 +668,134 @@ int main(int argc, char** argv)
 
     std::cout << "Output file: " << output_path.string() << "\n";
 
-    cv::Size output_size(frame_width, frame_height);
-    cv::VideoWriter output_video;
-    output_video.open(output_path.string(), fourcc_i, fps, output_size, true);
-    if (!output_video.isOpened())
+    cv::Size output_size(source.width(), source.height());
+
+    // the packet index decides which GOPs can be copied, without it every frame is rendered
+    bool smart_render = vm.count("smart-render") != 0;
+    if (smart_render && videoio::is_raw_video(output_path.string()))
     {
-        std::cerr << "Failed to open output video: " << output_path.string() << "\n";
-        return 1;
+        std::cerr << "Smart render cannot stream copy into raw video, rendering every frame\n";
+        smart_render = false;
+    }
+    std::vector<interpolation::Keyframe> keyframes;
+    int indexed_frame_count = 0;
+    if (smart_render && !interpolation::probe_keyframes(source, keyframes, indexed_frame_count))
+    {
+        std::cerr << "Smart render unavailable, rendering every frame\n";
+        smart_render = false;
+    }
+    // rendered segments are joined to stream copies of the source, so ffmpeg encodes them with its codec parameters
+    interpolation::StreamParameters stream_parameters;
+    videoio::BackendOptions segment_backend = output_backend;
+    if (smart_render &&
+        (videoio::available_backend(videoio::Backend::FFmpeg) != videoio::Backend::FFmpeg ||
+         !interpolation::probe_stream(input_path.string(), stream_parameters) ||
+         !interpolation::match_encoder(stream_parameters, segment_backend)))
+    {
+        std::cerr << "Smart render cannot match the encoding of the source, rendering every frame\n";
+        smart_render = false;
     }
 
-    std::cout << "Processing input file: " << input_path.string() << "\n";
-    if (!process_video(output_video,
-                       marked,
-                       input_path.string(),
-                       display_scale))
+    if (smart_render)
     {
-        std::cerr << "Failed to process video: " << input_path.string() << "\n";
-        output_video.release();
-        return 1;
+        std::vector<interpolation::RenderSegment> segments = interpolation::plan_segments(marked, keyframes, indexed_frame_count);
+        fs::path segment_dir(output_path.string() + ".segments");
+        fs::create_directories(segment_dir);
+        std::vector<std::string> segment_paths;
+        int copied_frames = 0;
+        int rendered_frames = 0;
+        for (size_t i = 0; i < segments.size(); ++i)
+        {
+            const interpolation::RenderSegment& segment = segments[i];
+            std::ostringstream segment_name;
+            // MPEG-TS carries the parameter sets of each segment in band through the join
+            segment_name << "segment" << std::setfill('0') << std::setw(5) << i << ".ts";
+            fs::path segment_path = segment_dir / segment_name.str();
+            segment_paths.push_back(segment_path.string());
+
+            if (!segment.render)
+            {
+                std::cout << "Copying frames " << segment.first << " to " << segment.first + segment.count - 1 << "\n";
+                if (!interpolation::copy_segment(input_path.string(), segment, segment_path.string()))
+                {
+                    std::cerr << "Failed to copy segment: " << segment_path.string() << "\n";
+                    return 1;
+                }
+                copied_frames += segment.count;
+                continue;
+            }
+
+            std::cout << "Rendering frames " << segment.first << " to " << segment.first + segment.count - 1 << "\n";
+            videoio::VideoSink segment_video;
+            if (!segment_video.open(segment_path.string(), fourcc_i, fps, output_size, segment_backend) ||
+                segment_video.backend() != videoio::Backend::FFmpeg)
+            {
+                std::cerr << "Failed to open ffmpeg for segment video: " << segment_path.string() << "\n";
+                return 1;
+            }
+            if (!process_video(segment_video,
+                               marked,
+                               source,
+                               display_scale,
+                               !headless,
+                               motion,
+                               motion_options,
+                               render_threads,
+                               segment.first,
+                               segment.first + segment.count))
+            {
+                std::cerr << "Failed to process video: " << input_path.string() << "\n";
+                return 1;
+            }
+            if (!segment_video.close())
+            {
+                std::cerr << "Failed to encode segment video: " << segment_path.string() << "\n";
+                return 1;
+            }
+            rendered_frames += segment.count;
+        }
+
+        if (!interpolation::concat_segments(segment_paths, (segment_dir / "segments.txt").string(), output_path.string(), stream_parameters.timescale))
+        {
+            std::cerr << "Failed to join segments into: " << output_path.string() << "\n";
+            return 1;
+        }
+        fs::remove_all(segment_dir);
+        std::cout << "Copied " << copied_frames << " frames, rendered " << rendered_frames << " frames\n";
+    }
+    else
+    {
+        videoio::VideoSink output_video;
+        if (!output_video.open(output_path.string(), fourcc_i, fps, output_size, output_backend))
+        {
+            std::cerr << "Failed to open output video: " << output_path.string() << "\n";
+            return 1;
+        }
+
+        std::cout << "Processing input file: " << input_path.string() << "\n";
+        if (!process_video(output_video,
+                           marked,
+                           source,
+                           display_scale,
+                           !headless,
+                           motion,
+                           motion_options,
+                           render_threads,
+                           0,
+                           -1))
+        {
+            std::cerr << "Failed to process video: " << input_path.string() << "\n";
+            output_video.close();
+            return 1;
+        }
+        output_video.close();
     }
-    output_video.release();
     std::cout << "Finished writing video: " << output_path.string() << "\n";
 
-    cv::waitKey(0);
+    if (!headless)
+    {
+        cv::waitKey(0);
+    }
 
     return 0;
 }
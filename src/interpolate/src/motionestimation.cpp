@@ -0,0 +1,310 @@
+// motionestimation.cpp
+// Copyright Laurence Emms 2017
+
+#include "motionestimation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+
+#include "blendkernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MOTION_ESTIMATION_X86
+#endif
+
+namespace interpolation
+{
+    namespace
+    {
+        int block_sad_scalar(const unsigned char* a, const int a_stride, const unsigned char* b, const int b_stride, const int begin, const int width, const int height)
+        {
+            int sum = 0;
+            for (int y = 0; y < height; ++y)
+            {
+                const unsigned char* ra = a + static_cast<size_t>(y) * a_stride;
+                const unsigned char* rb = b + static_cast<size_t>(y) * b_stride;
+                for (int x = begin; x < width; ++x)
+                {
+                    sum += std::abs(static_cast<int>(ra[x]) - static_cast<int>(rb[x]));
+                }
+            }
+            return sum;
+        }
+
+#ifdef MOTION_ESTIMATION_X86
+        // psadbw sums 8 byte differences into each 64 bit half, the halves are added at the end
+        __attribute__((target("sse2")))
+        int block_sad_sse2(const unsigned char* a, const int a_stride, const unsigned char* b, const int b_stride, const int width, const int height)
+        {
+            __m128i sum = _mm_setzero_si128();
+            int x = 0;
+            for (int y = 0; y < height; ++y)
+            {
+                const unsigned char* ra = a + static_cast<size_t>(y) * a_stride;
+                const unsigned char* rb = b + static_cast<size_t>(y) * b_stride;
+                x = 0;
+                for (; x + 16 <= width; x += 16)
+                {
+                    sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ra + x)),
+                                                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(rb + x))));
+                }
+                for (; x + 8 <= width; x += 8)
+                {
+                    sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(ra + x)),
+                                                          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rb + x))));
+                }
+            }
+            int total = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+            if (x < width)
+            {
+                total += block_sad_scalar(a, a_stride, b, b_stride, x, width, height);
+            }
+            return total;
+        }
+
+        // 16 pixel wide blocks are matched two rows per register
+        __attribute__((target("avx2")))
+        int block_sad_avx2(const unsigned char* a, const int a_stride, const unsigned char* b, const int b_stride, const int width, const int height)
+        {
+            if (width != 16)
+            {
+                return block_sad_sse2(a, a_stride, b, b_stride, width, height);
+            }
+            __m256i sum = _mm256_setzero_si256();
+            int y = 0;
+            for (; y + 2 <= height; y += 2)
+            {
+                const unsigned char* ra = a + static_cast<size_t>(y) * a_stride;
+                const unsigned char* rb = b + static_cast<size_t>(y) * b_stride;
+                const __m256i va = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ra))),
+                                                           _mm_loadu_si128(reinterpret_cast<const __m128i*>(ra + a_stride)), 1);
+                const __m256i vb = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rb))),
+                                                           _mm_loadu_si128(reinterpret_cast<const __m128i*>(rb + b_stride)), 1);
+                sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+            }
+            const __m128i folded = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+            int total = _mm_cvtsi128_si32(folded) + _mm_cvtsi128_si32(_mm_srli_si128(folded, 8));
+            if (y < height)
+            {
+                total += block_sad_sse2(a + static_cast<size_t>(y) * a_stride, a_stride, b + static_cast<size_t>(y) * b_stride, b_stride, width, height - y);
+            }
+            return total;
+        }
+#endif
+
+        double elapsed_ms(const std::chrono::steady_clock::time_point& start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    int block_sad(const unsigned char* a, const int a_stride, const unsigned char* b, const int b_stride, const int width, const int height)
+    {
+#ifdef MOTION_ESTIMATION_X86
+        if (has_avx2())
+        {
+            return block_sad_avx2(a, a_stride, b, b_stride, width, height);
+        }
+        if (has_sse2())
+        {
+            return block_sad_sse2(a, a_stride, b, b_stride, width, height);
+        }
+#endif
+        return block_sad_scalar(a, a_stride, b, b_stride, 0, width, height);
+    }
+
+    void estimate_motion(const cv::Mat& from, const cv::Mat& to, const MotionOptions& options, MotionField& field)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        const int block_size = std::max(4, options.block_size);
+        int levels = std::max(1, options.levels);
+        while (levels > 1 && (block_size >> (levels - 1)) < 4)
+        {
+            levels--;
+        }
+
+        std::vector<cv::Mat> from_pyramid(levels);
+        std::vector<cv::Mat> to_pyramid(levels);
+        cv::cvtColor(from, from_pyramid[0], cv::COLOR_BGR2GRAY);
+        cv::cvtColor(to, to_pyramid[0], cv::COLOR_BGR2GRAY);
+        for (int level = 1; level < levels; ++level)
+        {
+            cv::pyrDown(from_pyramid[level - 1], from_pyramid[level]);
+            cv::pyrDown(to_pyramid[level - 1], to_pyramid[level]);
+        }
+
+        field.block_size = block_size;
+        field.cols = (from.cols + block_size - 1) / block_size;
+        field.rows = (from.rows + block_size - 1) / block_size;
+        const int blocks = field.cols * field.rows;
+        // vectors are held in pixels of the level being searched
+        std::vector<int> vx(blocks, 0);
+        std::vector<int> vy(blocks, 0);
+
+        std::atomic<bool> expired(false);
+        int unrefined = 0;
+        for (int level = levels - 1; level >= 0; --level)
+        {
+            if (level < levels - 1)
+            {
+                for (int t = 0; t < blocks; ++t)
+                {
+                    vx[t] *= 2;
+                    vy[t] *= 2;
+                }
+            }
+
+            const cv::Mat& a = from_pyramid[level];
+            const cv::Mat& b = to_pyramid[level];
+            const int size = block_size >> level;
+            const int range = level == levels - 1 ? std::max(1, options.search_range >> (levels - 1)) : 1;
+            int skipped = 0;
+#pragma omp parallel for schedule(dynamic, 16) reduction(+:skipped)
+            for (int t = 0; t < blocks; ++t)
+            {
+                if (expired.load(std::memory_order_relaxed))
+                {
+                    skipped++;
+                    continue;
+                }
+                if (options.budget_ms > 0.0 && elapsed_ms(start) > options.budget_ms)
+                {
+                    expired.store(true, std::memory_order_relaxed);
+                    skipped++;
+                    continue;
+                }
+
+                const int x0 = (t % field.cols) * size;
+                const int y0 = (t / field.cols) * size;
+                const int w = std::min(size, a.cols - x0);
+                const int h = std::min(size, a.rows - y0);
+                if (w <= 0 || h <= 0)
+                {
+                    continue;
+                }
+
+                const unsigned char* block = a.ptr(y0) + x0;
+                int best = std::numeric_limits<int>::max();
+                int best_x = 0;
+                int best_y = 0;
+                // the zero vector is always a candidate so a bad coarse match cannot drag a static block away
+                const int centres[2][2] = {{vx[t], vy[t]}, {0, 0}};
+                for (int c = 0; c < 2; ++c)
+                {
+                    const int cr = c == 0 ? range : 0;
+                    for (int oy = -cr; oy <= cr; ++oy)
+                    {
+                        const int y = y0 + centres[c][1] + oy;
+                        if (y < 0 || y + h > b.rows)
+                        {
+                            continue;
+                        }
+                        for (int ox = -cr; ox <= cr; ++ox)
+                        {
+                            const int x = x0 + centres[c][0] + ox;
+                            if (x < 0 || x + w > b.cols)
+                            {
+                                continue;
+                            }
+                            const int sad = block_sad(block, static_cast<int>(a.step), b.ptr(y) + x, static_cast<int>(b.step), w, h);
+                            if (sad < best)
+                            {
+                                best = sad;
+                                best_x = x - x0;
+                                best_y = y - y0;
+                            }
+                        }
+                    }
+                }
+                vx[t] = best_x;
+                vy[t] = best_y;
+            }
+            if (level == 0)
+            {
+                unrefined = skipped;
+            }
+        }
+
+        field.dx.assign(vx.begin(), vx.end());
+        field.dy.assign(vy.begin(), vy.end());
+        field.unrefined = unrefined;
+    }
+
+    void dense_flow(const MotionField& field, const cv::Size& size, cv::Mat& flow_x, cv::Mat& flow_y)
+    {
+        // the grid is padded by one block on each side so the edge vectors interpolate out to the frame border
+        const int cols = field.cols + 2;
+        const int rows = field.rows + 2;
+        cv::Mat grid_x(rows, cols, CV_32FC1);
+        cv::Mat grid_y(rows, cols, CV_32FC1);
+        for (int y = 0; y < rows; ++y)
+        {
+            const int by = std::max(0, std::min(field.rows - 1, y - 1));
+            float* gx = grid_x.ptr<float>(y);
+            float* gy = grid_y.ptr<float>(y);
+            for (int x = 0; x < cols; ++x)
+            {
+                const int bx = std::max(0, std::min(field.cols - 1, x - 1));
+                gx[x] = field.dx[by * field.cols + bx];
+                gy[x] = field.dy[by * field.cols + bx];
+            }
+        }
+
+        // block centres land on grid cell centres once the padded grid is scaled to the padded frame
+        const int pad = field.block_size;
+        cv::Mat padded_x;
+        cv::Mat padded_y;
+        cv::resize(grid_x, padded_x, cv::Size(cols * pad, rows * pad), 0, 0, cv::INTER_LINEAR);
+        cv::resize(grid_y, padded_y, cv::Size(cols * pad, rows * pad), 0, 0, cv::INTER_LINEAR);
+        padded_x(cv::Rect(pad, pad, size.width, size.height)).copyTo(flow_x);
+        padded_y(cv::Rect(pad, pad, size.width, size.height)).copyTo(flow_y);
+    }
+
+    void interpolate_motion(const cv::Mat& from, const cv::Mat& to, const cv::Mat& flow_x, const cv::Mat& flow_y, const float alpha, cv::Mat& output)
+    {
+        const int rows = from.rows;
+        const int cols = from.cols;
+        cv::Mat from_x(rows, cols, CV_32FC1);
+        cv::Mat from_y(rows, cols, CV_32FC1);
+        cv::Mat to_x(rows, cols, CV_32FC1);
+        cv::Mat to_y(rows, cols, CV_32FC1);
+        // a pixel at p in from moves to p + v in to, so at alpha it sits at p + alpha * v
+#pragma omp parallel for
+        for (int y = 0; y < rows; ++y)
+        {
+            const float* fx = flow_x.ptr<float>(y);
+            const float* fy = flow_y.ptr<float>(y);
+            float* ax = from_x.ptr<float>(y);
+            float* ay = from_y.ptr<float>(y);
+            float* bx = to_x.ptr<float>(y);
+            float* by = to_y.ptr<float>(y);
+            for (int x = 0; x < cols; ++x)
+            {
+                ax[x] = static_cast<float>(x) - alpha * fx[x];
+                ay[x] = static_cast<float>(y) - alpha * fy[x];
+                bx[x] = static_cast<float>(x) + (1.0f - alpha) * fx[x];
+                by[x] = static_cast<float>(y) + (1.0f - alpha) * fy[x];
+            }
+        }
+
+        cv::Mat warped_from;
+        cv::Mat warped_to;
+        cv::remap(from, warped_from, from_x, from_y, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+        cv::remap(to, warped_to, to_x, to_y, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+        output.create(rows, cols, from.type());
+        const int row_length = cols * static_cast<int>(from.elemSize());
+        const int weight = blend_weight(alpha);
+#pragma omp parallel for
+        for (int y = 0; y < rows; ++y)
+        {
+            unsigned char* out = output.ptr(y);
+            blend_row(warped_from.ptr(y), warped_to.ptr(y), row_length, &out, &weight, 1);
+        }
+    }
+}
@@ -0,0 +1,158 @@
+// renderpipeline.cpp
+// Copyright Laurence Emms 2017
+
+#include "renderpipeline.h"
+
+#include <algorithm>
+
+#include <omp.h>
+
+namespace interpolation
+{
+    OrderedWriter::OrderedWriter(videoio::VideoSink& output, const size_t max_pending) :
+        _output(output),
+        _max_pending(std::max<size_t>(1, max_pending)),
+        _next(0),
+        _written(0),
+        _stop(false)
+    {
+        _thread = std::thread(&OrderedWriter::run, this);
+    }
+
+    OrderedWriter::~OrderedWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _condition.notify_all();
+        }
+        _thread.join();
+    }
+
+    void OrderedWriter::submit(const size_t sequence, std::vector<cv::Mat>& frames)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (sequence != _next && _pending.size() >= _max_pending)
+        {
+            _condition.wait(lock);
+        }
+        _pending[sequence].swap(frames);
+        _condition.notify_all();
+    }
+
+    void OrderedWriter::finish(const size_t count)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_next < count)
+        {
+            _condition.wait(lock);
+        }
+    }
+
+    size_t OrderedWriter::written() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _written;
+    }
+
+    void OrderedWriter::run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            while (!_stop && (_pending.empty() || _pending.begin()->first != _next))
+            {
+                _condition.wait(lock);
+            }
+            if (_pending.empty() || _pending.begin()->first != _next)
+            {
+                return;
+            }
+            std::vector<cv::Mat> frames;
+            frames.swap(_pending.begin()->second);
+            _pending.erase(_pending.begin());
+            // encoding runs unlocked so submitters only wait on the map
+            lock.unlock();
+            for (const cv::Mat& frame : frames)
+            {
+                _output.write(frame);
+            }
+            lock.lock();
+            _written += frames.size();
+            _next++;
+            _condition.notify_all();
+        }
+    }
+
+    RenderPool::RenderPool(const int threads, const size_t max_queued) :
+        _max_queued(std::max<size_t>(1, max_queued)),
+        _active(0),
+        _stop(false)
+    {
+        for (int t = 0; t < std::max(1, threads); ++t)
+        {
+            _threads.push_back(std::thread(&RenderPool::run, this));
+        }
+    }
+
+    RenderPool::~RenderPool()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _condition.notify_all();
+        }
+        for (std::thread& thread : _threads)
+        {
+            thread.join();
+        }
+    }
+
+    void RenderPool::submit(const std::function<void()>& task)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_tasks.size() >= _max_queued)
+        {
+            _condition.wait(lock);
+        }
+        _tasks.push_back(task);
+        _condition.notify_all();
+    }
+
+    void RenderPool::wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_tasks.empty() || _active > 0)
+        {
+            _condition.wait(lock);
+        }
+    }
+
+    void RenderPool::run()
+    {
+        // gaps are rendered in parallel with each other, the per frame loops stay on this thread
+        omp_set_num_threads(1);
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            while (_tasks.empty() && !_stop)
+            {
+                _condition.wait(lock);
+            }
+            if (_tasks.empty())
+            {
+                return;
+            }
+            std::function<void()> task = _tasks.front();
+            _tasks.pop_front();
+            _active++;
+            _condition.notify_all();
+            lock.unlock();
+            task();
+            lock.lock();
+            _active--;
+            _condition.notify_all();
+        }
+    }
+}
@@ -0,0 +1,260 @@
+// smartrender.cpp
+// Copyright Laurence Emms 2017
+
+#include "smartrender.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <frameindex.h>
+
+namespace interpolation
+{
+    namespace
+    {
+        bool run_command(const std::string& command)
+        {
+            int status = std::system(command.c_str());
+            if (status != 0)
+            {
+                std::cerr << "Command failed: " << command << "\n";
+                return false;
+            }
+            return true;
+        }
+
+        std::string format_time(const double time)
+        {
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(6) << time;
+            return text.str();
+        }
+
+        // the track timescale can only be set for the mp4 family of containers
+        bool has_track_timescale(const std::string& path)
+        {
+            std::string extension = boost::filesystem::path(path).extension().string();
+            boost::algorithm::to_lower(extension);
+            return extension == ".mp4" || extension == ".mov" || extension == ".m4v";
+        }
+    }
+
+    bool probe_stream(const std::string& input_path, StreamParameters& parameters)
+    {
+        std::string command = "ffprobe -v error -select_streams v:0 -show_entries stream=codec_name,profile,level,pix_fmt,r_frame_rate,time_base -of default=noprint_wrappers=1 " +
+                              videoio::shell_quote(input_path) + " 2>/dev/null";
+        FILE* pipe = popen(command.c_str(), "r");
+        if (pipe == nullptr)
+        {
+            return false;
+        }
+        std::map<std::string, std::string> values;
+        char line[256];
+        while (fgets(line, sizeof(line), pipe) != nullptr)
+        {
+            std::string text(line);
+            boost::algorithm::trim(text);
+            size_t equals = text.find('=');
+            if (equals != std::string::npos)
+            {
+                values[text.substr(0, equals)] = text.substr(equals + 1);
+            }
+        }
+        if (pclose(pipe) != 0 || values.count("codec_name") == 0)
+        {
+            std::cerr << "Failed to probe the video stream of: " << input_path << "\n";
+            return false;
+        }
+        parameters.codec = values["codec_name"];
+        parameters.profile = values["profile"];
+        parameters.level = std::atoi(values["level"].c_str());
+        parameters.pix_fmt = values["pix_fmt"];
+        parameters.frame_rate = values["r_frame_rate"];
+        parameters.timescale = 0;
+        // time_base is 1/timescale
+        const std::string& time_base = values["time_base"];
+        if (time_base.compare(0, 2, "1/") == 0)
+        {
+            parameters.timescale = std::atoi(time_base.c_str() + 2);
+        }
+        return true;
+    }
+
+    bool match_encoder(const StreamParameters& parameters, videoio::BackendOptions& options)
+    {
+        // only H.264 has its profile and level set through ffmpeg options, through libx264
+        if (parameters.codec != "h264")
+        {
+            std::cerr << "Smart render can only match H.264 sources, the source is " << parameters.codec << "\n";
+            return false;
+        }
+        static const std::map<std::string, std::string> profiles = {
+            {"Constrained Baseline", "baseline"},
+            {"Baseline", "baseline"},
+            {"Main", "main"},
+            {"High", "high"},
+            {"High 10", "high10"},
+            {"High 4:2:2", "high422"},
+            {"High 4:4:4 Predictive", "high444"}
+        };
+        std::map<std::string, std::string>::const_iterator profile = profiles.find(parameters.profile);
+        if (profile == profiles.end())
+        {
+            std::cerr << "Smart render cannot encode the H.264 profile: " << parameters.profile << "\n";
+            return false;
+        }
+        static const char* const pix_fmts[] = {"yuv420p", "yuvj420p", "yuv422p", "yuvj422p", "yuv444p", "yuvj444p",
+                                               "yuv420p10le", "yuv422p10le", "yuv444p10le"};
+        if (std::find(std::begin(pix_fmts), std::end(pix_fmts), parameters.pix_fmt) == std::end(pix_fmts))
+        {
+            std::cerr << "Smart render cannot encode the pixel format: " << parameters.pix_fmt << "\n";
+            return false;
+        }
+        if (parameters.level <= 0 || parameters.frame_rate.empty() || parameters.frame_rate == "0/0")
+        {
+            std::cerr << "Smart render could not read the level and frame rate of the source\n";
+            return false;
+        }
+        // level_idc is ten times the level, 9 is level 1b
+        std::ostringstream level;
+        if (parameters.level == 9)
+        {
+            level << "1b";
+        }
+        else
+        {
+            level << parameters.level / 10 << "." << parameters.level % 10;
+        }
+        options.backend = videoio::Backend::FFmpeg;
+        options.codec = "libx264";
+        options.profile = profile->second;
+        options.level = level.str();
+        options.pix_fmt = parameters.pix_fmt;
+        options.frame_rate = parameters.frame_rate;
+        // headers before every keyframe, with ids other than the 0 the source encoder uses
+        options.x264_params = "repeat-headers=1:sps-id=1";
+        options.timescale = 0;
+        return true;
+    }
+
+    bool probe_keyframes(const videoio::VideoSource& source, std::vector<Keyframe>& keyframes, int& frame_count)
+    {
+        const std::string& input_path = source.path();
+        const videoio::FrameIndex& index = source.index();
+        if (!source.indexed() || index.keyframes.empty())
+        {
+            std::cerr << "Failed to read the packet index of: " << input_path << "\n";
+            return false;
+        }
+        // frames before the first keyframe cannot be copied on their own
+        if (index.keyframes.front() != 0)
+        {
+            std::cerr << "Video does not start with a keyframe: " << input_path << "\n";
+            return false;
+        }
+        // the leading frames of an open GOP belong to the previous run in display order but not in decode order
+        if (index.open_gop)
+        {
+            std::cerr << "Video has open GOPs that cannot be cut at keyframes: " << input_path << "\n";
+            return false;
+        }
+        keyframes.clear();
+        for (int frame : index.keyframes)
+        {
+            Keyframe keyframe;
+            keyframe.frame = frame;
+            keyframe.time = index.timestamps[frame] / 1000.0;
+            keyframes.push_back(keyframe);
+        }
+        frame_count = index.frame_count;
+        return true;
+    }
+
+    std::vector<RenderSegment> plan_segments(const std::vector<bool>& marked, const std::vector<Keyframe>& keyframes, const int frame_count)
+    {
+        // a gap needs the unmarked frames either side of it decoded as well
+        std::vector<bool> needed(frame_count, false);
+        for (int i = 0; i < frame_count; ++i)
+        {
+            if (i < static_cast<int>(marked.size()) && marked[i])
+            {
+                needed[i] = true;
+                if (i > 0)
+                {
+                    needed[i - 1] = true;
+                }
+                if (i + 1 < frame_count)
+                {
+                    needed[i + 1] = true;
+                }
+            }
+        }
+
+        std::vector<RenderSegment> segments;
+        for (size_t k = 0; k < keyframes.size(); ++k)
+        {
+            const int first = keyframes[k].frame;
+            const int end = k + 1 < keyframes.size() ? keyframes[k + 1].frame : frame_count;
+            if (end <= first)
+            {
+                continue;
+            }
+            bool render = std::find(needed.begin() + first, needed.begin() + end, true) != needed.begin() + end;
+            if (!segments.empty() && segments.back().render == render)
+            {
+                segments.back().count += end - first;
+                continue;
+            }
+            RenderSegment segment;
+            segment.first = first;
+            segment.count = end - first;
+            segment.time = keyframes[k].time;
+            segment.render = render;
+            segments.push_back(segment);
+        }
+        return segments;
+    }
+
+    bool copy_segment(const std::string& input_path, const RenderSegment& segment, const std::string& segment_path)
+    {
+        // seeking before the input to a keyframe time starts the copy exactly on that keyframe,
+        // the bitstream filter puts the source parameter sets in band before each keyframe
+        std::string command = "ffmpeg -v error -y -ss " + format_time(segment.time) +
+                              " -i " + videoio::shell_quote(input_path) +
+                              " -map 0:v:0 -an -c copy -bsf:v h264_mp4toannexb -frames:v " + std::to_string(segment.count) +
+                              " -avoid_negative_ts make_zero -f mpegts " + videoio::shell_quote(segment_path);
+        return run_command(command);
+    }
+
+    bool concat_segments(const std::vector<std::string>& segment_paths, const std::string& list_path, const std::string& output_path, const int timescale)
+    {
+        {
+            std::ofstream list_file(list_path.c_str());
+            if (!list_file)
+            {
+                std::cerr << "Failed to write segment list: " << list_path << "\n";
+                return false;
+            }
+            for (const std::string& segment_path : segment_paths)
+            {
+                list_file << "file " << videoio::shell_quote(segment_path) << "\n";
+            }
+        }
+        std::string command = "ffmpeg -v error -y -f concat -safe 0 -i " + videoio::shell_quote(list_path) + " -c copy";
+        if (timescale > 0 && has_track_timescale(output_path))
+        {
+            command += " -video_track_timescale " + std::to_string(timescale);
+        }
+        command += " " + videoio::shell_quote(output_path);
+        return run_command(command);
+    }
+}
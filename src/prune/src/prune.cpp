@@ -0,0 +1,174 @@
+// prune.cpp
+// Copyright Laurence Emms 2017
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include <mlpclassifier.h>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// mean seconds per classification of random inputs
+double time_inference(classifiers::MLPClassifier& classifier, const int iterations)
+{
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<float> input(classifier.layer_size(0));
+    std::vector<float> output;
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        input[i] = dist(gen);
+    }
+    input.back() = -1.0f; // bias node
+    classifier.classify(input, output);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        classifier.classify(input, output);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char** argv)
+{
+    std::cout << "Prune\n";
+    std::cout << "by Laurence Emms\n";
+
+    float sparsity = 0.9f;
+    float sparse_threshold = 0.3f;
+    int iterations = 1000;
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "Print help message")
+        ("version,v", "Print version number")
+        ("classifier,c", po::value<std::string>(), "Trained classifier file")
+        ("output,o", po::value<std::string>(), "Pruned classifier file")
+        ("sparsity", po::value<float>(&sparsity), "Fraction of each hidden layer's weights to remove")
+        ("block", po::value<std::string>(), "Prune whole ROWSxCOLS tiles, e.g. 4x8, instead of single weights")
+        ("sparse-threshold", po::value<float>(&sparse_threshold), "Layers less dense than this use the sparse kernel")
+        ("iterations", po::value<int>(&iterations), "Inferences timed for the dense and sparse comparison")
+        ;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << desc << "\n";
+        std::cout << "Fine tune a pruned classifier with train, pruned weights stay zero\n";
+        return 0;
+    }
+
+    if (vm.count("version"))
+    {
+        std::cout << "Prune 1.0\n";
+        return 0;
+    }
+
+    if (vm.count("classifier") == 0)
+    {
+        std::cerr << "Classifier file not specified\n";
+        return 1;
+    }
+
+    if (vm.count("output") == 0)
+    {
+        std::cerr << "Output file not specified\n";
+        return 1;
+    }
+
+    if (sparsity < 0.0f || sparsity >= 1.0f)
+    {
+        std::cerr << "Sparsity must be in [0, 1)\n";
+        return 1;
+    }
+
+    if (iterations < 1)
+    {
+        std::cerr << "Iterations must be at least 1\n";
+        return 1;
+    }
+
+    int block_rows = 0;
+    int block_cols = 0;
+    if (vm.count("block") != 0)
+    {
+        std::istringstream block_stream(vm["block"].as<std::string>());
+        char separator = 0;
+        if (!(block_stream >> block_rows >> separator >> block_cols) || separator != 'x' || block_rows < 1 || block_cols < 1)
+        {
+            std::cerr << "Invalid block size: " << vm["block"].as<std::string>() << "\n";
+            return 1;
+        }
+    }
+
+    fs::path classifier_path(vm["classifier"].as<std::string>());
+    fs::path output_path(vm["output"].as<std::string>());
+    if (!fs::exists(classifier_path))
+    {
+        std::cerr << "Classifier file does not exist: " << classifier_path.string() << "\n";
+        return 1;
+    }
+
+    classifiers::MLPClassifier classifier;
+    std::cout << "Reading classifier file: " << classifier_path.string() << "\n";
+    {
+        std::ifstream classifier_file(classifier_path.string().c_str());
+        classifier.read(classifier_file);
+    }
+    int layers = classifier.num_layers();
+    if (layers <= 0)
+    {
+        std::cerr << "Error: Classifier has no layers\n";
+        return 1;
+    }
+    if (classifier.precision() != classifiers::PRECISION_FP32)
+    {
+        std::cout << "Converting " << classifiers::precision_name(classifier.precision()) << " weights to fp32\n";
+        classifier.set_precision(classifiers::PRECISION_FP32);
+    }
+
+    classifier.set_sparse_threshold(0.0f);
+    double dense_seconds = time_inference(classifier, iterations);
+
+    if (block_rows > 0)
+    {
+        std::cout << "Pruning " << sparsity * 100.0f << "% of " << block_rows << "x" << block_cols << " blocks\n";
+        classifier.prune_blocks(sparsity, block_rows, block_cols);
+    }
+    else
+    {
+        std::cout << "Pruning " << sparsity * 100.0f << "% of weights by magnitude\n";
+        classifier.prune_magnitude(sparsity);
+    }
+    classifier.set_sparse_threshold(sparse_threshold);
+
+    for (int l = 0; l < layers - 1; ++l)
+    {
+        std::cout << "Layer " << l << " -> " << l + 1 << ": " << classifier.layer_size(l) << "x" << classifier.layer_size(l + 1)
+                  << " density " << std::fixed << std::setprecision(3) << classifier.density(l)
+                  << (classifier.uses_sparse(l) ? " sparse" : " dense") << "\n";
+    }
+
+    double sparse_seconds = time_inference(classifier, iterations);
+    std::cout << std::setprecision(4);
+    std::cout << "Dense inference: " << dense_seconds * 1000.0 << " ms, pruned inference: " << sparse_seconds * 1000.0 << " ms, speedup "
+              << std::setprecision(2) << dense_seconds / sparse_seconds << "x\n";
+
+    std::cout << "Writing pruned classifier to: " << output_path.string() << "\n";
+    std::ofstream output_file(output_path.string().c_str());
+    classifier.write(output_file);
+    if (!output_file)
+    {
+        std::cerr << "Failed to write classifier: " << output_path.string() << "\n";
+        return 1;
+    }
+    return 0;
+}
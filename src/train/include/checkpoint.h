@@ -0,0 +1,76 @@
+// checkpoint.h
+// Copyright Laurence Emms 2017
+
+#ifndef CHECKPOINT
+#define CHECKPOINT
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mlpclassifier.h>
+
+#include "trainingdata.h"
+
+namespace training
+{
+    // where the data loader is in the run
+    struct TrainingProgress
+    {
+        unsigned int seed;
+        size_t trained;
+        // subset frames of each source that have been trained on
+        std::vector<size_t> consumed;
+    };
+
+    // a checkpoint holds the progress, the sampler state, the model and the optimizer state
+    bool write_checkpoint(const std::string& path,
+                          const std::vector<TrainingSource>& sources,
+                          const TrainingProgress& progress,
+                          const std::string& sampler_state,
+                          const classifiers::MLPClassifier& classifier);
+    // the classifier must already have its optimizer set, the saved state has to match it
+    bool read_checkpoint(const std::string& path,
+                         const std::vector<TrainingSource>& sources,
+                         TrainingProgress& progress,
+                         std::string& sampler_state,
+                         classifiers::MLPClassifier& classifier);
+
+    // writes checkpoints on a background thread through a temporary file and a rename
+    // so a crash during a write leaves the previous checkpoint intact
+    class CheckpointWriter
+    {
+    public:
+        CheckpointWriter(const std::string& path, const std::vector<TrainingSource>& sources);
+        ~CheckpointWriter();
+        // copies the state and returns immediately, skipped if the previous checkpoint is still being written
+        bool save(const TrainingProgress& progress,
+                  const std::string& sampler_state,
+                  const classifiers::MLPClassifier& classifier);
+        // blocks until the pending checkpoint is written
+        void wait();
+        size_t written() const;
+        size_t failed() const;
+    private:
+        void run();
+
+        const std::string _path;
+        const std::vector<TrainingSource>& _sources;
+        bool _pending;
+        bool _writing;
+        bool _stop;
+        size_t _written;
+        size_t _failed;
+        TrainingProgress _progress;
+        std::string _sampler_state;
+        std::unique_ptr<classifiers::MLPClassifier> _classifier;
+        mutable std::mutex _mutex;
+        std::condition_variable _condition;
+        std::thread _thread;
+    };
+}
+
+#endif // CHECKPOINT
@@ -0,0 +1,76 @@
+// parameteraverager.h
+// Copyright Laurence Emms 2017
+
+#ifndef PARAMETER_AVERAGER
+#define PARAMETER_AVERAGER
+
+#include <string>
+#include <vector>
+
+#include <mlpclassifier.h>
+
+namespace training
+{
+    struct AveragingOptions
+    {
+        // worker processes on this node, each trains on every workers-th manifest source
+        int workers;
+        // trained frames between averaging rounds
+        size_t every_frames;
+        // rounds a worker may run ahead of the slowest worker, 0 averages synchronously
+        int staleness;
+        // shared directory models are exchanged through with other nodes, empty for a single node
+        std::string shared_dir;
+        std::string node_name;
+        // local rounds between exchanges with other nodes, 0 only exchanges at the end of the run
+        int node_rounds;
+    };
+
+    struct SharedAveraging;
+
+    // averages the weights of worker processes through a POSIX shared memory segment
+    // the segment is created before the workers are forked and is inherited by them
+    class ParameterAverager
+    {
+    public:
+        static const int max_workers = 64;
+
+        ParameterAverager(const AveragingOptions& options);
+        ~ParameterAverager();
+        bool create(const size_t parameters);
+        // called in each worker after the fork
+        void attach(const int rank);
+        bool due(const size_t trained) const;
+        // publishes the worker weights and replaces them with the average
+        void average(classifiers::MLPClassifier& classifier);
+        // publishes the final weights and stops taking part in rounds
+        void finish(const classifiers::MLPClassifier& classifier);
+        // called by a worker that fails, and by the parent when it reaps a worker that exited without finishing
+        void abandon(const int rank);
+        // average of the final weights of the workers that finished, false if none did
+        bool final_average(classifiers::MLPClassifier& classifier);
+        size_t rounds() const;
+    private:
+        void lock();
+        void wait();
+        void complete_round();
+        float* slot(const int rank) const;
+
+        const AveragingOptions _options;
+        SharedAveraging* _shared;
+        float* _parameters;
+        size_t _parameter_count;
+        size_t _mapped_size;
+        int _rank;
+        size_t _last_round_frames;
+        size_t _rounds;
+        std::vector<float> _buffer;
+    };
+
+    // writes this node's model to the shared directory and averages it with the models other nodes left there
+    bool exchange_with_nodes(const std::string& shared_dir,
+                             const std::string& node_name,
+                             classifiers::MLPClassifier& classifier);
+}
+
+#endif // PARAMETER_AVERAGER
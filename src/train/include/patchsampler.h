@@ -0,0 +1,65 @@
+// patchsampler.h
+// Copyright Laurence Emms 2017
+
+#ifndef PATCH_SAMPLER
+#define PATCH_SAMPLER
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "trainingdata.h"
+
+namespace training
+{
+    struct SamplingOptions
+    {
+        // negative patches trained per positive patch, 0 trains every negative patch
+        float negative_ratio;
+        // negative patches trained per negative frame while the ratio allows none
+        int min_negatives;
+        // prefer patches that change across the frame window and reweight them to stay unbiased
+        bool importance;
+        // fraction of the scored negative candidates kept for training, 1 disables hard negative mining
+        float hard_fraction;
+    };
+
+    struct PatchChoice
+    {
+        int x;
+        int y;
+        float weight;
+        float loss;
+    };
+
+    // chooses which patches of a training frame are trained on
+    class PatchSampler
+    {
+    public:
+        PatchSampler(const SamplingOptions& options, const unsigned int seed);
+        // fills choices with the candidate patch centers of the frame
+        // keep is the number of candidates to train on after scoring them with the current model
+        void select(const FrameSample& sample,
+                    const int w,
+                    const int h,
+                    std::vector<PatchChoice>& choices,
+                    size_t& keep);
+        void record(const float target, const size_t count, const size_t scored);
+        size_t positives() const;
+        size_t negatives() const;
+        size_t scored() const;
+        // random generator state and counters, for checkpoints
+        void write_state(std::ostream& stream) const;
+        bool read_state(std::istream& stream);
+    private:
+        float importance(const FrameSample& sample, const int x, const int y, const int w, const int h) const;
+
+        const SamplingOptions _options;
+        std::mt19937 _gen;
+        size_t _positives;
+        size_t _negatives;
+        size_t _scored;
+    };
+}
+
+#endif // PATCH_SAMPLER
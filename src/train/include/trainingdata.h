@@ -0,0 +1,64 @@
+// trainingdata.h
+// Copyright Laurence Emms 2017
+
+#ifndef TRAINING_DATA
+#define TRAINING_DATA
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace training
+{
+    // a labeled video: the input and its marked frames file
+    struct TrainingSource
+    {
+        std::string input_path;
+        std::string marked_path;
+    };
+
+    // reads "<input> <marked>" pairs, one per line, relative paths are relative to the manifest
+    bool read_manifest(const std::string& manifest_path, std::vector<TrainingSource>& sources);
+
+    // the frame window of one training frame, newest frame first
+    struct FrameSample
+    {
+        std::list<cv::Mat> frames;
+        float target;
+        int frame_number;
+        size_t source;
+    };
+
+    // bounded single producer, single consumer queue of frame samples
+    class SampleQueue
+    {
+    public:
+        SampleQueue(const size_t capacity);
+        void push(FrameSample& sample);
+        bool pop(FrameSample& sample);
+        void close();
+    private:
+        const size_t _capacity;
+        bool _closed;
+        std::deque<FrameSample> _samples;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+    };
+
+    // decodes a source and queues a random subset_percentage of its frames
+    // the first skip frames of the subset were trained before a resume and are not queued again
+    bool decode_source(const TrainingSource& source,
+                       const size_t source_index,
+                       const float subset_percentage,
+                       const int f,
+                       const unsigned int seed,
+                       const size_t skip,
+                       SampleQueue& queue,
+                       const bool verbose);
+}
+
+#endif // TRAINING_DATA
@@ -0,0 +1,203 @@
+// checkpoint.cpp
+// Copyright Laurence Emms 2017
+
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace training
+{
+    bool write_checkpoint(const std::string& path,
+                          const std::vector<TrainingSource>& sources,
+                          const TrainingProgress& progress,
+                          const std::string& sampler_state,
+                          const classifiers::MLPClassifier& classifier)
+    {
+        std::string temp_path = path + ".tmp";
+        {
+            std::ofstream stream(temp_path.c_str());
+            if (!stream)
+            {
+                std::cerr << "Failed to open checkpoint: " << temp_path << "\n";
+                return false;
+            }
+            stream << "checkpoint\n";
+            stream << sources.size() << "\n";
+            stream << progress.seed << "\n";
+            stream << progress.trained << "\n";
+            for (size_t s = 0; s < sources.size(); ++s)
+            {
+                stream << progress.consumed[s] << "\t" << sources[s].input_path << "\n";
+            }
+            stream << sampler_state;
+            // full precision so a resumed run continues from exactly the same weights
+            stream << std::setprecision(9);
+            classifier.write(stream);
+            classifier.write_optimizer(stream);
+            stream.flush();
+            if (!stream)
+            {
+                std::cerr << "Failed to write checkpoint: " << temp_path << "\n";
+                return false;
+            }
+        }
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            std::cerr << "Failed to replace checkpoint: " << path << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool read_checkpoint(const std::string& path,
+                         const std::vector<TrainingSource>& sources,
+                         TrainingProgress& progress,
+                         std::string& sampler_state,
+                         classifiers::MLPClassifier& classifier)
+    {
+        std::ifstream stream(path.c_str());
+        if (!stream)
+        {
+            std::cerr << "Failed to open checkpoint: " << path << "\n";
+            return false;
+        }
+        std::string type;
+        size_t source_count = 0;
+        stream >> type >> source_count >> progress.seed >> progress.trained;
+        if (type != "checkpoint")
+        {
+            std::cerr << "Error: Not a checkpoint file: " << path << "\n";
+            return false;
+        }
+        if (source_count != sources.size())
+        {
+            std::cerr << "Error: Checkpoint has " << source_count << " sources, run has " << sources.size() << "\n";
+            return false;
+        }
+        progress.consumed.assign(sources.size(), 0);
+        for (size_t s = 0; s < sources.size(); ++s)
+        {
+            std::string input_path;
+            stream >> progress.consumed[s];
+            stream.ignore(1);
+            std::getline(stream, input_path);
+            if (input_path != sources[s].input_path)
+            {
+                std::cerr << "Error: Checkpoint source " << s << " is " << input_path << " not " << sources[s].input_path << "\n";
+                return false;
+            }
+        }
+        std::getline(stream, sampler_state);
+        sampler_state += "\n";
+        classifier.read(stream);
+        if (classifier.num_layers() <= 0)
+        {
+            std::cerr << "Error: Checkpoint classifier has no layers\n";
+            return false;
+        }
+        if (!classifier.read_optimizer(stream))
+        {
+            std::cerr << "Error: Checkpoint optimizer state could not be restored\n";
+            return false;
+        }
+        return true;
+    }
+
+    CheckpointWriter::CheckpointWriter(const std::string& path, const std::vector<TrainingSource>& sources) :
+        _path(path),
+        _sources(sources),
+        _pending(false),
+        _writing(false),
+        _stop(false),
+        _written(0),
+        _failed(0)
+    {
+        _thread = std::thread(&CheckpointWriter::run, this);
+    }
+
+    CheckpointWriter::~CheckpointWriter()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _condition.notify_all();
+        }
+        _thread.join();
+    }
+
+    bool CheckpointWriter::save(const TrainingProgress& progress,
+                                const std::string& sampler_state,
+                                const classifiers::MLPClassifier& classifier)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending || _writing)
+        {
+            return false;
+        }
+        _progress = progress;
+        _sampler_state = sampler_state;
+        _classifier.reset(new classifiers::MLPClassifier(classifier));
+        _pending = true;
+        _condition.notify_all();
+        return true;
+    }
+
+    void CheckpointWriter::wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_pending || _writing)
+        {
+            _condition.wait(lock);
+        }
+    }
+
+    size_t CheckpointWriter::written() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _written;
+    }
+
+    size_t CheckpointWriter::failed() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _failed;
+    }
+
+    void CheckpointWriter::run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            while (!_pending && !_stop)
+            {
+                _condition.wait(lock);
+            }
+            if (!_pending)
+            {
+                return;
+            }
+            _pending = false;
+            _writing = true;
+            std::unique_ptr<classifiers::MLPClassifier> classifier(_classifier.release());
+            TrainingProgress progress = _progress;
+            std::string sampler_state = _sampler_state;
+            lock.unlock();
+            bool written = write_checkpoint(_path, _sources, progress, sampler_state, *classifier);
+            lock.lock();
+            _writing = false;
+            if (written)
+            {
+                _written++;
+            }
+            else
+            {
+                _failed++;
+            }
+            _condition.notify_all();
+        }
+    }
+}
@@ -0,0 +1,433 @@
+// parameteraverager.cpp
+// Copyright Laurence Emms 2017
+
+#include "parameteraverager.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace training
+{
+    enum WorkerState
+    {
+        WORKER_RUNNING,
+        WORKER_FINISHED,
+        WORKER_FAILED
+    };
+
+    // header of the shared segment, the parameter slots of each worker and the synchronous average follow it
+    struct SharedAveraging
+    {
+        pthread_mutex_t mutex;
+        pthread_cond_t condition;
+        int workers;
+        int active;
+        int arrived;
+        unsigned long long generation;
+        int state[ParameterAverager::max_workers];
+        int contributed[ParameterAverager::max_workers];
+        unsigned long long version[ParameterAverager::max_workers];
+    };
+
+    namespace
+    {
+        size_t aligned_size(const size_t size)
+        {
+            return (size + 63) & ~static_cast<size_t>(63);
+        }
+    }
+
+    ParameterAverager::ParameterAverager(const AveragingOptions& options) :
+        _options(options),
+        _shared(NULL),
+        _parameters(NULL),
+        _parameter_count(0),
+        _mapped_size(0),
+        _rank(0),
+        _last_round_frames(0),
+        _rounds(0)
+    {
+    }
+
+    ParameterAverager::~ParameterAverager()
+    {
+        if (_shared)
+        {
+            munmap(_shared, _mapped_size);
+        }
+    }
+
+    bool ParameterAverager::create(const size_t parameters)
+    {
+        if (_options.workers < 1 || _options.workers > max_workers)
+        {
+            std::cerr << "Workers must be between 1 and " << max_workers << "\n";
+            return false;
+        }
+        _parameter_count = parameters;
+        const size_t header_size = aligned_size(sizeof(SharedAveraging));
+        const size_t slot_size = aligned_size(_parameter_count * sizeof(float));
+        _mapped_size = header_size + slot_size * (_options.workers + 1);
+
+        std::ostringstream name;
+        name << "/videofix-train-" << getpid();
+        int fd = shm_open(name.str().c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            std::cerr << "Failed to create shared memory " << name.str() << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+        // the workers inherit the mapping, the name is not needed once it is mapped
+        shm_unlink(name.str().c_str());
+        if (ftruncate(fd, _mapped_size) != 0)
+        {
+            std::cerr << "Failed to size shared memory: " << std::strerror(errno) << "\n";
+            close(fd);
+            return false;
+        }
+        void* memory = mmap(NULL, _mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+        {
+            std::cerr << "Failed to map shared memory: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        _shared = static_cast<SharedAveraging*>(memory);
+        _parameters = reinterpret_cast<float*>(static_cast<char*>(memory) + header_size);
+
+        // robust so a worker that dies holding the lock does not stall the others
+        pthread_mutexattr_t mutex_attributes;
+        pthread_mutexattr_init(&mutex_attributes);
+        pthread_mutexattr_setpshared(&mutex_attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&mutex_attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&_shared->mutex, &mutex_attributes);
+        pthread_mutexattr_destroy(&mutex_attributes);
+        pthread_condattr_t condition_attributes;
+        pthread_condattr_init(&condition_attributes);
+        pthread_condattr_setpshared(&condition_attributes, PTHREAD_PROCESS_SHARED);
+        pthread_cond_init(&_shared->condition, &condition_attributes);
+        pthread_condattr_destroy(&condition_attributes);
+
+        _shared->workers = _options.workers;
+        _shared->active = _options.workers;
+        _shared->arrived = 0;
+        _shared->generation = 0;
+        for (int r = 0; r < max_workers; ++r)
+        {
+            _shared->state[r] = WORKER_RUNNING;
+            _shared->contributed[r] = 0;
+            _shared->version[r] = 0;
+        }
+        _buffer.resize(_parameter_count);
+        return true;
+    }
+
+    void ParameterAverager::attach(const int rank)
+    {
+        _rank = rank;
+        _last_round_frames = 0;
+        _rounds = 0;
+    }
+
+    bool ParameterAverager::due(const size_t trained) const
+    {
+        return _options.every_frames > 0 && trained - _last_round_frames >= _options.every_frames;
+    }
+
+    float* ParameterAverager::slot(const int rank) const
+    {
+        return _parameters + (aligned_size(_parameter_count * sizeof(float)) / sizeof(float)) * rank;
+    }
+
+    void ParameterAverager::lock()
+    {
+        if (pthread_mutex_lock(&_shared->mutex) == EOWNERDEAD)
+        {
+            pthread_mutex_consistent(&_shared->mutex);
+        }
+    }
+
+    void ParameterAverager::wait()
+    {
+        if (pthread_cond_wait(&_shared->condition, &_shared->mutex) == EOWNERDEAD)
+        {
+            pthread_mutex_consistent(&_shared->mutex);
+        }
+    }
+
+    // averages the slots of the workers that arrived in this round into the slot after the last worker
+    // must be called with the lock held
+    void ParameterAverager::complete_round()
+    {
+        float* average = slot(_shared->workers);
+        int contributors = 0;
+        std::fill(average, average + _parameter_count, 0.0f);
+        for (int r = 0; r < _shared->workers; ++r)
+        {
+            if (!_shared->contributed[r])
+            {
+                continue;
+            }
+            const float* values = slot(r);
+            for (size_t i = 0; i < _parameter_count; ++i)
+            {
+                average[i] += values[i];
+            }
+            _shared->contributed[r] = 0;
+            contributors++;
+        }
+        if (contributors > 0)
+        {
+            const float scale = 1.0f / static_cast<float>(contributors);
+            for (size_t i = 0; i < _parameter_count; ++i)
+            {
+                average[i] *= scale;
+            }
+        }
+        _shared->arrived = 0;
+        _shared->generation++;
+        pthread_cond_broadcast(&_shared->condition);
+    }
+
+    void ParameterAverager::average(classifiers::MLPClassifier& classifier)
+    {
+        if (!_shared)
+        {
+            return;
+        }
+        lock();
+        classifier.get_parameters(slot(_rank));
+        _shared->version[_rank]++;
+        if (_options.staleness == 0)
+        {
+            _shared->contributed[_rank] = 1;
+            _shared->arrived++;
+            unsigned long long generation = _shared->generation;
+            if (_shared->arrived >= _shared->active)
+            {
+                complete_round();
+            }
+            while (_shared->generation == generation)
+            {
+                wait();
+            }
+            // the average is not replaced until every active worker arrives again, including this one
+            pthread_mutex_unlock(&_shared->mutex);
+            classifier.set_parameters(slot(_shared->workers));
+        }
+        else
+        {
+            pthread_cond_broadcast(&_shared->condition);
+            const unsigned long long version = _shared->version[_rank];
+            bool waiting = true;
+            while (waiting)
+            {
+                waiting = false;
+                for (int r = 0; r < _shared->workers; ++r)
+                {
+                    if (_shared->state[r] == WORKER_RUNNING && _shared->version[r] + _options.staleness < version)
+                    {
+                        waiting = true;
+                    }
+                }
+                if (waiting)
+                {
+                    wait();
+                }
+            }
+            // average every running worker's latest published weights, at most staleness rounds old
+            std::fill(_buffer.begin(), _buffer.end(), 0.0f);
+            int contributors = 0;
+            for (int r = 0; r < _shared->workers; ++r)
+            {
+                if (_shared->state[r] != WORKER_RUNNING || _shared->version[r] == 0)
+                {
+                    continue;
+                }
+                const float* values = slot(r);
+                for (size_t i = 0; i < _parameter_count; ++i)
+                {
+                    _buffer[i] += values[i];
+                }
+                contributors++;
+            }
+            pthread_mutex_unlock(&_shared->mutex);
+            const float scale = 1.0f / static_cast<float>(contributors);
+            for (size_t i = 0; i < _parameter_count; ++i)
+            {
+                _buffer[i] *= scale;
+            }
+            classifier.set_parameters(&_buffer[0]);
+        }
+        _rounds++;
+        _last_round_frames += _options.every_frames;
+        if (_rank == 0 && !_options.shared_dir.empty() && _options.node_rounds > 0 && _rounds % _options.node_rounds == 0)
+        {
+            exchange_with_nodes(_options.shared_dir, _options.node_name, classifier);
+        }
+    }
+
+    void ParameterAverager::finish(const classifiers::MLPClassifier& classifier)
+    {
+        if (!_shared)
+        {
+            return;
+        }
+        lock();
+        classifier.get_parameters(slot(_rank));
+        _shared->version[_rank]++;
+        _shared->state[_rank] = WORKER_FINISHED;
+        _shared->active--;
+        if (_shared->arrived > 0 && _shared->arrived >= _shared->active)
+        {
+            complete_round();
+        }
+        pthread_cond_broadcast(&_shared->condition);
+        pthread_mutex_unlock(&_shared->mutex);
+    }
+
+    void ParameterAverager::abandon(const int rank)
+    {
+        if (!_shared)
+        {
+            return;
+        }
+        lock();
+        if (_shared->state[rank] == WORKER_RUNNING)
+        {
+            _shared->state[rank] = WORKER_FAILED;
+            _shared->active--;
+            if (_shared->contributed[rank])
+            {
+                _shared->contributed[rank] = 0;
+                _shared->arrived--;
+            }
+            if (_shared->arrived > 0 && _shared->arrived >= _shared->active)
+            {
+                complete_round();
+            }
+            pthread_cond_broadcast(&_shared->condition);
+        }
+        pthread_mutex_unlock(&_shared->mutex);
+    }
+
+    bool ParameterAverager::final_average(classifiers::MLPClassifier& classifier)
+    {
+        if (!_shared)
+        {
+            return false;
+        }
+        lock();
+        std::fill(_buffer.begin(), _buffer.end(), 0.0f);
+        int contributors = 0;
+        for (int r = 0; r < _shared->workers; ++r)
+        {
+            if (_shared->state[r] != WORKER_FINISHED || _shared->version[r] == 0)
+            {
+                continue;
+            }
+            const float* values = slot(r);
+            for (size_t i = 0; i < _parameter_count; ++i)
+            {
+                _buffer[i] += values[i];
+            }
+            contributors++;
+        }
+        pthread_mutex_unlock(&_shared->mutex);
+        if (contributors == 0)
+        {
+            return false;
+        }
+        const float scale = 1.0f / static_cast<float>(contributors);
+        for (size_t i = 0; i < _parameter_count; ++i)
+        {
+            _buffer[i] *= scale;
+        }
+        classifier.set_parameters(&_buffer[0]);
+        return true;
+    }
+
+    size_t ParameterAverager::rounds() const
+    {
+        return _rounds;
+    }
+
+    bool exchange_with_nodes(const std::string& shared_dir,
+                             const std::string& node_name,
+                             classifiers::MLPClassifier& classifier)
+    {
+        fs::path directory(shared_dir);
+        fs::path own_path = directory / (node_name + ".model");
+        std::string temp_path = own_path.string() + ".tmp";
+        {
+            std::ofstream stream(temp_path.c_str());
+            if (!stream)
+            {
+                std::cerr << "Failed to write node model: " << temp_path << "\n";
+                return false;
+            }
+            stream << std::setprecision(9);
+            classifier.write(stream);
+        }
+        if (std::rename(temp_path.c_str(), own_path.string().c_str()) != 0)
+        {
+            std::cerr << "Failed to publish node model: " << own_path.string() << "\n";
+            return false;
+        }
+
+        const size_t count = classifier.parameter_count();
+        std::vector<float> sum(count);
+        std::vector<float> values(count);
+        classifier.get_parameters(&sum[0]);
+        int nodes = 1;
+        for (fs::directory_iterator it(directory), end; it != end; ++it)
+        {
+            const fs::path& path = it->path();
+            if (path.extension() != ".model" || path.filename() == own_path.filename())
+            {
+                continue;
+            }
+            // other nodes replace their files by rename so a complete model is always read
+            classifiers::MLPClassifier other;
+            std::ifstream stream(path.string().c_str());
+            other.read(stream);
+            bool matches = other.num_layers() == classifier.num_layers() && other.parameter_count() == count;
+            for (int l = 0; matches && l < classifier.num_layers(); ++l)
+            {
+                matches = other.layer_size(l) == classifier.layer_size(l);
+            }
+            if (!matches)
+            {
+                std::cerr << "Skipping node model with a different shape: " << path.string() << "\n";
+                continue;
+            }
+            other.get_parameters(&values[0]);
+            for (size_t i = 0; i < count; ++i)
+            {
+                sum[i] += values[i];
+            }
+            nodes++;
+        }
+        const float scale = 1.0f / static_cast<float>(nodes);
+        for (size_t i = 0; i < count; ++i)
+        {
+            sum[i] *= scale;
+        }
+        classifier.set_parameters(&sum[0]);
+        std::cout << "Averaged with " << nodes - 1 << " other nodes through " << shared_dir << "\n";
+        return true;
+    }
+}
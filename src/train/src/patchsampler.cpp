@@ -0,0 +1,169 @@
+// patchsampler.cpp
+// Copyright Laurence Emms 2017
+
+#include "patchsampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace training
+{
+    PatchSampler::PatchSampler(const SamplingOptions& options, const unsigned int seed) :
+        _options(options),
+        _gen(seed),
+        _positives(0),
+        _negatives(0),
+        _scored(0)
+    {
+    }
+
+    float PatchSampler::importance(const FrameSample& sample, const int x, const int y, const int w, const int h) const
+    {
+        // mean absolute luminance change between the newest and the oldest frame of the window
+        const cv::Mat& newest = sample.frames.front();
+        const cv::Mat& oldest = sample.frames.back();
+        int w_offset = w / 2;
+        int h_offset = h / 2;
+        float difference = 0.0f;
+        for (int y_o = -h_offset; y_o < h_offset; ++y_o)
+        {
+            for (int x_o = -w_offset; x_o < w_offset; ++x_o)
+            {
+                cv::Vec3b n = newest.at<cv::Vec3b>(y + y_o, x + x_o);
+                cv::Vec3b o = oldest.at<cv::Vec3b>(y + y_o, x + x_o);
+                for (int c = 0; c < 3; ++c)
+                {
+                    difference += std::abs(static_cast<float>(n[c]) - static_cast<float>(o[c]));
+                }
+            }
+        }
+        // keep static patches selectable
+        return difference / (3.0f * 255.0f * static_cast<float>(w * h)) + 0.01f;
+    }
+
+    void PatchSampler::select(const FrameSample& sample,
+                              const int w,
+                              const int h,
+                              std::vector<PatchChoice>& choices,
+                              size_t& keep)
+    {
+        choices.clear();
+        const cv::Mat& frame = sample.frames.front();
+        int w_offset = w / 2;
+        int h_offset = h / 2;
+        int stride = w;
+        for (int y = h_offset; y + h_offset < frame.rows; y += stride)
+        {
+            for (int x = w_offset; x + w_offset < frame.cols; x += stride)
+            {
+                PatchChoice choice;
+                choice.x = x;
+                choice.y = y;
+                choice.weight = 1.0f;
+                choice.loss = 0.0f;
+                choices.push_back(choice);
+            }
+        }
+        const size_t patch_count = choices.size();
+        keep = patch_count;
+        // damaged frames are rare, every positive patch is trained on
+        if (sample.target > 0.5f || patch_count == 0)
+        {
+            return;
+        }
+
+        size_t budget = patch_count;
+        if (_options.negative_ratio > 0.0f)
+        {
+            double wanted = static_cast<double>(_options.negative_ratio) * static_cast<double>(_positives) - static_cast<double>(_negatives);
+            budget = static_cast<size_t>(std::max(wanted, static_cast<double>(_options.min_negatives)));
+            budget = std::min(budget, patch_count);
+        }
+        // score a larger pool and keep the hardest patches of it
+        size_t pool = budget;
+        if (_options.hard_fraction < 1.0f)
+        {
+            pool = static_cast<size_t>(std::ceil(static_cast<double>(budget) / std::max(_options.hard_fraction, 0.01f)));
+            pool = std::min(pool, patch_count);
+        }
+        keep = budget;
+        if (pool >= patch_count)
+        {
+            return;
+        }
+
+        if (!_options.importance)
+        {
+            std::shuffle(choices.begin(), choices.end(), _gen);
+            choices.resize(pool);
+            return;
+        }
+
+        // weighted sampling without replacement: keep the largest u^(1/importance) keys
+        std::vector<float> importances(patch_count);
+        float importance_sum = 0.0f;
+        for (size_t i = 0; i < patch_count; ++i)
+        {
+            importances[i] = importance(sample, choices[i].x, choices[i].y, w, h);
+            importance_sum += importances[i];
+        }
+        std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+        std::vector<std::pair<float, size_t> > keys(patch_count);
+        for (size_t i = 0; i < patch_count; ++i)
+        {
+            float u = std::max(dist(_gen), 1e-7f);
+            keys[i] = std::make_pair(std::log(u) / importances[i], i);
+        }
+        std::partial_sort(keys.begin(), keys.begin() + pool, keys.end(), std::greater<std::pair<float, size_t> >());
+        const float mean_importance = importance_sum / static_cast<float>(patch_count);
+        std::vector<PatchChoice> selected(pool);
+        for (size_t i = 0; i < pool; ++i)
+        {
+            const size_t index = keys[i].second;
+            selected[i] = choices[index];
+            // inverse inclusion probability relative to uniform sampling, clamped to bound the variance
+            selected[i].weight = std::max(0.1f, std::min(10.0f, mean_importance / importances[index]));
+        }
+        choices.swap(selected);
+    }
+
+    void PatchSampler::record(const float target, const size_t count, const size_t scored)
+    {
+        if (target > 0.5f)
+        {
+            _positives += count;
+        }
+        else
+        {
+            _negatives += count;
+        }
+        _scored += scored;
+    }
+
+    size_t PatchSampler::positives() const
+    {
+        return _positives;
+    }
+
+    size_t PatchSampler::negatives() const
+    {
+        return _negatives;
+    }
+
+    size_t PatchSampler::scored() const
+    {
+        return _scored;
+    }
+
+    void PatchSampler::write_state(std::ostream& stream) const
+    {
+        stream << _positives << " " << _negatives << " " << _scored << " " << _gen << "\n";
+    }
+
+    bool PatchSampler::read_state(std::istream& stream)
+    {
+        stream >> _positives >> _negatives >> _scored >> _gen;
+        return static_cast<bool>(stream);
+    }
+}
@@ -1,6 +1,7 @@
 // train.cpp
 // Copyright Laurence Emms 2017
 
+#include <cerrno>
 #include <cmath>
 #include <iostream>
 #include <array>
@@ -8,147 +9,272 @@
 #include <algorithm>
 #include <list>
 #include <random>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <opencv2/opencv.hpp>
 
 #include <mlpclassifier.h>
+#include <patchinput.h>
+
+#include "trainingdata.h"
+#include "patchsampler.h"
+#include "checkpoint.h"
+#include "parameteraverager.h"
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
+template <typename Classifier>
+void train_frame(Classifier& classifier,
+                 training::PatchSampler& sampler,
+                 const training::FrameSample& sample,
+                 const int w,
+                 const int h,
+                 const int f)
+{
+    std::vector<float> target_vec;
+    target_vec.push_back(sample.target);
+
+    std::vector<training::PatchChoice> choices;
+    size_t keep = 0;
+    sampler.select(sample, w, h, choices, keep);
+
+    std::vector<float> input_vector(w * f * h + 1);
+    input_vector[w * h * f] = -1.0f; // bias node
+    size_t scored = 0;
+    if (keep < choices.size())
+    {
+        // hard negative mining: only train on the candidates the current model gets most wrong
+        std::vector<float> output_vector;
+        for (size_t i = 0; i < choices.size(); ++i)
+        {
+            classifiers::fill_input(input_vector, sample.frames, choices[i].x, choices[i].y, w, h);
+            classifier.classify(input_vector, output_vector);
+            float error = output_vector.empty() ? 0.0f : sample.target - output_vector[0];
+            choices[i].loss = error * error;
+        }
+        scored = choices.size();
+        std::partial_sort(choices.begin(), choices.begin() + keep, choices.end(),
+                          [](const training::PatchChoice& a, const training::PatchChoice& b)
+                          {
+                              return a.loss > b.loss;
+                          });
+        choices.resize(keep);
+    }
+
+    for (size_t i = 0; i < choices.size(); ++i)
+    {
+        classifiers::fill_input(input_vector, sample.frames, choices[i].x, choices[i].y, w, h);
+        classifier.train(input_vector, target_vec, choices[i].weight);
+    }
+    sampler.record(sample.target, choices.size(), scored);
+}
+
+struct CheckpointOptions
+{
+    // checkpoint after this many trained frames or seconds, 0 disables the trigger
+    size_t every_frames;
+    double every_seconds;
+};
+
+// sources are decoded by up to `decoders` threads at once, decoder d takes sources d, d + decoders, ...
+// training takes one frame from each active decoder in turn so concurrently open sources are mixed evenly,
+// the order only depends on the sources and checkpoints are taken between rounds so a resumed run repeats it exactly
+// progress holds the frames already trained per source when resuming and is updated as training runs
 template <typename Classifier>
 bool train(Classifier& classifier,
-           const std::vector<bool>& marked,
-           const std::vector<int>& subset,
-           const std::string& input_path,
+           const std::vector<training::TrainingSource>& sources,
+           const int decoders,
+           const float subset_percentage,
+           training::PatchSampler& sampler,
+           training::TrainingProgress& progress,
+           training::CheckpointWriter* checkpoints,
+           const CheckpointOptions& checkpointing,
+           training::ParameterAverager* averager,
            const int w,
            const int h,
            const int f,
            const bool verbose)
 {
-    if (subset.empty())
+    if (sources.empty())
     {
-        std::cerr << "Subset is empty\n";
+        std::cerr << "No training sources\n";
         return false;
     }
-    cv::VideoCapture cap(input_path);
-    if (!cap.isOpened())
+    const int slots = std::max(1, std::min(decoders, static_cast<int>(sources.size())));
+    const size_t queue_depth = 2;
+    std::vector<std::unique_ptr<training::SampleQueue> > queues;
+    for (int d = 0; d < slots; ++d)
     {
-        std::cerr << "Failed to open video capture\n";
-        return false;
+        queues.push_back(std::unique_ptr<training::SampleQueue>(new training::SampleQueue(queue_depth)));
     }
 
-    const double fourcc_d = cap.get(CV_CAP_PROP_FOURCC);
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_d);
-    std::cout << "FourCC: " << fourcc << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    std::cout << "FPS: " << static_cast<int>(cap.get(CV_CAP_PROP_FPS)) << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
-
-    // count frames
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-
-    std::list<cv::Mat> prev_frames;
-    int subset_index = 0;
-    for (int fn = 0; fn < frame_count; ++fn)
-    {
-        cv::Mat frame;
-        if (!cap.read(frame))
-        {
-            std::cout << "Frame empty: "<< fn << "\n";
-            continue;
-        }
-        prev_frames.push_front(frame.clone());
-        if (fn == 0)
+    std::atomic<int> failed(0);
+    std::vector<std::thread> threads;
+    for (int d = 0; d < slots; ++d)
+    {
+        threads.push_back(std::thread([&, d]()
         {
-            // preload f frames
-            for (int i = 0; i < f - 1; ++i)
+            for (size_t s = static_cast<size_t>(d); s < sources.size(); s += static_cast<size_t>(slots))
             {
-                prev_frames.push_front(frame.clone());
+                if (!training::decode_source(sources[s], s, subset_percentage, f, progress.seed + static_cast<unsigned int>(s), progress.consumed[s], *queues[d], verbose))
+                {
+                    failed++;
+                }
             }
-        }
-        while (static_cast<int>(prev_frames.size()) > f)
-        {
-            prev_frames.pop_back();
-        }
-        if (fn <= subset[subset_index])
+            queues[d]->close();
+        }));
+    }
+
+    std::vector<bool> active(slots, true);
+    int active_count = slots;
+    size_t trained = 0;
+    size_t last_checkpoint = progress.trained;
+    std::chrono::steady_clock::time_point last_checkpoint_time = std::chrono::steady_clock::now();
+    training::FrameSample sample;
+    while (active_count > 0)
+    {
+        for (int d = 0; d < slots; ++d)
         {
-            continue;
+            if (!active[d])
+            {
+                continue;
+            }
+            if (!queues[d]->pop(sample))
+            {
+                active[d] = false;
+                active_count--;
+                continue;
+            }
+            if (verbose)
+            {
+                std::cout << "Training frame " << sample.frame_number << " of " << sources[sample.source].input_path << "\n";
+            }
+            train_frame(classifier, sampler, sample, w, h, f);
+            trained++;
+            progress.trained++;
+            progress.consumed[sample.source]++;
+            if (verbose)
+            {
+                std::cout << "Frame trained\n";
+            }
+            if (averager && averager->due(trained))
+            {
+                averager->average(classifier);
+            }
         }
-        if (verbose)
+        // a round takes one frame from every active decoder, resuming starts a new round
+        if (checkpoints)
         {
-            std::cout << "Frame number: " << fn << " / " << frame_count << "\n";
-            double msec = cap.get(CV_CAP_PROP_POS_MSEC);
-            double seconds = std::floor(msec / 1000.0);
-            double minutes = std::floor(seconds / 60.0);
-            double hours = std::floor(minutes / 60.0);
-            minutes -= hours * 60.0;
-            seconds -= minutes * 60.0;
-            msec -= seconds * 1000.0;
-            std::cout << "Time: " << std::setfill('0') << std::setw(2) << static_cast<int>(hours) << ":" << std::setw(2) << static_cast<int>(minutes) << ":" << std::setw(2) << static_cast<int>(seconds) << ":" << std::setw(4) << static_cast<int>(msec) << "\n";
+            bool due = checkpointing.every_frames > 0 && progress.trained - last_checkpoint >= checkpointing.every_frames;
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint_time).count();
+            due = due || (checkpointing.every_seconds > 0.0 && elapsed >= checkpointing.every_seconds);
+            std::ostringstream sampler_state;
+            if (due)
+            {
+                sampler.write_state(sampler_state);
+            }
+            // a busy writer leaves the checkpoint due so it is retried after the next round
+            if (due && checkpoints->save(progress, sampler_state.str(), classifier))
+            {
+                last_checkpoint = progress.trained;
+                last_checkpoint_time = std::chrono::steady_clock::now();
+                if (verbose)
+                {
+                    std::cout << "Checkpoint queued after " << progress.trained << " frames\n";
+                }
+            }
         }
-        float target_value = 0.0f;
-        if (marked[fn])
+    }
+    for (size_t t = 0; t < threads.size(); ++t)
+    {
+        threads[t].join();
+    }
+    std::cout << "Trained on " << trained << " frames from " << sources.size() << " sources\n";
+    std::cout << "Trained patches: " << sampler.positives() << " positive, " << sampler.negatives() << " negative, " << sampler.scored() << " scored for mining\n";
+    if (failed > 0)
+    {
+        std::cerr << failed << " sources failed to decode\n";
+        return false;
+    }
+    std::cout << "Training complete\n";
+    return true;
+}
+
+// trains on sources, resuming from the checkpoint when sampler_state is set, and checkpoints as configured
+bool run_training(classifiers::MLPClassifier& classifier,
+                  const std::vector<training::TrainingSource>& sources,
+                  const int decoders,
+                  const float subset_percentage,
+                  const training::SamplingOptions& sampling,
+                  training::TrainingProgress& progress,
+                  const std::string& sampler_state,
+                  const std::string& checkpoint_path,
+                  const CheckpointOptions& checkpointing,
+                  training::ParameterAverager* averager,
+                  const int w,
+                  const int h,
+                  const int f,
+                  const bool verbose)
+{
+    training::PatchSampler sampler(sampling, progress.seed);
+    if (!sampler_state.empty())
+    {
+        std::istringstream sampler_stream(sampler_state);
+        if (!sampler.read_state(sampler_stream))
         {
-            target_value = 1.0f;
+            std::cerr << "Error: Checkpoint sampler state is invalid\n";
+            return false;
         }
-        std::vector<float> target_vec;
-        target_vec.push_back(target_value);
-        int w_offset = w / 2;
-        int h_offset = h / 2;
-        int fw = frame.cols;
-        int fh = frame.rows;
-
-        std::vector<float> input_vector(w * f * h + 1);
-        input_vector[w * h * f] = -1.0f; // bias node
-        int stride = w;
-        for (int y = h_offset; y + h_offset < fh; y += stride)
-        {
-            for (int x = w_offset; x + w_offset < fw; x += stride)
-            {
-                std::list<cv::Mat>::iterator current_frame = prev_frames.begin();
+    }
 
-                int it_f = 0;
-                while (current_frame != prev_frames.end())
-                {
-                    int it_y = 0;
-                    for (int y_o = -h_offset; y_o < h_offset; ++y_o)
-                    {
-                        int it_x = 0;
-                        for (int x_o = -w_offset; x_o < w_offset; ++x_o)
-                        {
-                            cv::Vec3b texel = current_frame->at<cv::Vec3b>(y + y_o, x + x_o);
-                            float luminance = (0.2126f * static_cast<float>(texel[0]) + 0.7512f * static_cast<float>(texel[1]) + 0.0722f * static_cast<float>(texel[2])) / 255.0f;
-                            input_vector[it_x + it_y * w + it_f * w * h] = luminance;
-                            it_x++;
-                        }
-                        it_y++;
-                    }
-                    current_frame++;
-                    it_f++;
-                }
+    std::unique_ptr<training::CheckpointWriter> checkpoints;
+    if (!checkpoint_path.empty())
+    {
+        std::cout << "Checkpointing to: " << checkpoint_path << "\n";
+        checkpoints.reset(new training::CheckpointWriter(checkpoint_path, sources));
+    }
 
-                classifier.train(input_vector, target_vec);
-            }
+    std::cout << "Training on " << sources.size() << " videos with " << decoders << " decoders\n";
+    bool trained = train(classifier,
+                         sources,
+                         decoders,
+                         subset_percentage,
+                         sampler,
+                         progress,
+                         checkpoints.get(),
+                         checkpointing,
+                         averager,
+                         w,
+                         h,
+                         f,
+                         verbose);
+    if (checkpoints)
+    {
+        // a failed run keeps its last periodic checkpoint to resume from
+        checkpoints->wait();
+        if (trained)
+        {
+            std::ostringstream final_state;
+            sampler.write_state(final_state);
+            checkpoints->save(progress, final_state.str(), classifier);
+            checkpoints->wait();
         }
-        if (verbose)
+        std::cout << "Wrote " << checkpoints->written() << " checkpoints\n";
+        if (checkpoints->failed() > 0)
         {
-            std::cout << "Frame trained\n";
+            std::cerr << checkpoints->failed() << " checkpoints failed to write\n";
         }
-        subset_index++;
     }
-    cap.release();
-    std::cout << "Training complete\n";
-    return true;
+    return trained;
 }
 
 int main(int argc, char** argv)
@@ -157,6 +283,22 @@ int main(int argc, char** argv)
     std::cout << "Train\n";
     std::cout << "by Laurence Emms\n";
 
+    int decoders = 2;
+    training::SamplingOptions sampling;
+    sampling.negative_ratio = 0.0f;
+    sampling.min_negatives = 16;
+    sampling.importance = false;
+    sampling.hard_fraction = 1.0f;
+    classifiers::OptimizerOptions optimizer;
+    classifiers::LearningRateSchedule schedule;
+    CheckpointOptions checkpointing;
+    checkpointing.every_frames = 0;
+    checkpointing.every_seconds = 0.0;
+    training::AveragingOptions averaging;
+    averaging.workers = 1;
+    averaging.every_frames = 50;
+    averaging.staleness = 0;
+    averaging.node_rounds = 0;
     po::options_description desc("Options");
     desc.add_options()
         ("help,h", "Print help message")
@@ -165,6 +307,34 @@ int main(int argc, char** argv)
         ("classifier,c", po::value<std::string>(), "Classifier file")
         ("marked", po::value<std::string>(), "Marked frames file")
         ("subset", po::value<std::string>(), "Subset file")
+        ("manifest", po::value<std::string>(), "Train on every \"<input> <marked>\" pair listed in this file")
+        ("decoders", po::value<int>(&decoders), "Manifest videos decoded in parallel")
+        ("negative-ratio", po::value<float>(&sampling.negative_ratio), "Negative patches trained per positive patch, 0 trains every patch")
+        ("min-negatives", po::value<int>(&sampling.min_negatives), "Negative patches trained per frame before enough positives are seen")
+        ("importance", "Prefer negative patches that change across the frame window")
+        ("hard-fraction", po::value<float>(&sampling.hard_fraction), "Score negative candidates with the model and keep only this hardest fraction")
+        ("optimizer", po::value<std::string>(), "Weight update rule: sgd, momentum, nesterov or adam")
+        ("learning-rate", po::value<float>(), "Base learning rate, stored in the classifier file")
+        ("momentum", po::value<float>(&optimizer.momentum), "Momentum for the momentum and nesterov optimizers")
+        ("beta1", po::value<float>(&optimizer.beta1), "Adam first moment decay")
+        ("beta2", po::value<float>(&optimizer.beta2), "Adam second moment decay")
+        ("schedule", po::value<std::string>(), "Learning rate schedule: constant, step or cosine")
+        ("warmup", po::value<size_t>(&schedule.warmup_steps), "Updates to ramp the learning rate up from zero")
+        ("step-size", po::value<size_t>(&schedule.step_size), "Updates between step schedule decays")
+        ("gamma", po::value<float>(&schedule.gamma), "Step schedule decay factor")
+        ("schedule-steps", po::value<size_t>(&schedule.total_steps), "Updates the cosine schedule anneals over")
+        ("min-lr", po::value<float>(&schedule.min_rate), "Final learning rate of the cosine schedule")
+        ("checkpoint", po::value<std::string>(), "Checkpoint file, defaults to <classifier>.checkpoint")
+        ("checkpoint-frames", po::value<size_t>(&checkpointing.every_frames), "Checkpoint every N trained frames")
+        ("checkpoint-seconds", po::value<double>(&checkpointing.every_seconds), "Checkpoint every T seconds")
+        ("resume", "Continue the run saved in the checkpoint file")
+        ("workers", po::value<int>(&averaging.workers), "Worker processes, each trains on a shard of the manifest")
+        ("average-frames", po::value<size_t>(&averaging.every_frames), "Trained frames between worker weight averaging rounds")
+        ("staleness", po::value<int>(&averaging.staleness), "Rounds a worker may run ahead of the slowest, 0 averages synchronously")
+        ("shared-dir", po::value<std::string>(&averaging.shared_dir), "Shared directory to average models with other nodes through")
+        ("node", po::value<std::string>(&averaging.node_name), "Name of this node in the shared directory, defaults to the host name")
+        ("node-rounds", po::value<int>(&averaging.node_rounds), "Averaging rounds between exchanges with other nodes, 0 exchanges at the end only")
+        ("precision", po::value<std::string>(), "Weight storage of the written classifier: fp32, fp16 or bf16, training is always fp32")
         ("verbose", "Force verbose output")
         ;
     po::variables_map vm;
@@ -183,7 +353,8 @@ int main(int argc, char** argv)
         return 0;
     }
 
-    if (vm.count("input") == 0)
+    bool use_manifest = vm.count("manifest") != 0;
+    if (!use_manifest && vm.count("input") == 0)
     {
         std::cerr << "Input file not specified\n";
         return 1;
@@ -195,49 +366,155 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    if (vm.count("marked") == 0)
+    if (!use_manifest && vm.count("marked") == 0)
     {
         std::cerr << "Marked file not specified\n";
         return 1;
     }
 
-    if (vm.count("subset") == 0)
+    if (!use_manifest && vm.count("subset") == 0)
     {
         std::cerr << "Subset file not specified\n";
         return 1;
     }
 
-    fs::path input_path(vm["input"].as<std::string>());
-    fs::path classifier_path(vm["classifier"].as<std::string>());
-    fs::path marked_path(vm["marked"].as<std::string>());
-    fs::path subset_path(vm["subset"].as<std::string>());
-    
-    if (!fs::exists(input_path.string()))
+    sampling.importance = vm.count("importance") != 0;
+    if (sampling.negative_ratio < 0.0f || sampling.min_negatives < 0)
     {
-        std::cerr << "Input file does not exist: " << input_path.string() << "\n";
+        std::cerr << "Negative ratio and minimum negatives must not be negative\n";
+        return 1;
+    }
+    if (sampling.hard_fraction <= 0.0f || sampling.hard_fraction > 1.0f)
+    {
+        std::cerr << "Hard fraction must be in (0, 1]\n";
         return 1;
     }
 
-    if (!fs::exists(marked_path.string()))
+    if (vm.count("optimizer") != 0 && !classifiers::parse_optimizer_type(vm["optimizer"].as<std::string>(), optimizer.type))
+    {
+        std::cerr << "Unknown optimizer: " << vm["optimizer"].as<std::string>() << "\n";
+        return 1;
+    }
+    if (vm.count("schedule") != 0 && !classifiers::parse_schedule_type(vm["schedule"].as<std::string>(), schedule.type))
+    {
+        std::cerr << "Unknown learning rate schedule: " << vm["schedule"].as<std::string>() << "\n";
+        return 1;
+    }
+    if (schedule.type == classifiers::SCHEDULE_STEP && schedule.step_size == 0)
+    {
+        std::cerr << "Step schedule requires --step-size\n";
+        return 1;
+    }
+    if (schedule.type == classifiers::SCHEDULE_COSINE && schedule.total_steps <= schedule.warmup_steps)
+    {
+        std::cerr << "Cosine schedule requires --schedule-steps greater than --warmup\n";
+        return 1;
+    }
+
+    classifiers::WeightPrecision output_precision = classifiers::PRECISION_FP32;
+    if (vm.count("precision") != 0 && !classifiers::parse_precision(vm["precision"].as<std::string>(), output_precision))
+    {
+        std::cerr << "Unknown weight precision: " << vm["precision"].as<std::string>() << "\n";
+        return 1;
+    }
+
+    if (decoders < 1)
+    {
+        std::cerr << "At least one decoder is required\n";
+        return 1;
+    }
+
+    if (averaging.workers < 1 || averaging.workers > training::ParameterAverager::max_workers)
+    {
+        std::cerr << "Workers must be between 1 and " << training::ParameterAverager::max_workers << "\n";
+        return 1;
+    }
+    if (averaging.staleness < 0 || averaging.node_rounds < 0)
     {
-        std::cerr << "Marked file does not exist: " << marked_path.string() << "\n";
+        std::cerr << "Staleness and node rounds must not be negative\n";
         return 1;
     }
+    if (!averaging.shared_dir.empty())
+    {
+        if (!fs::is_directory(averaging.shared_dir))
+        {
+            std::cerr << "Shared directory does not exist: " << averaging.shared_dir << "\n";
+            return 1;
+        }
+        if (averaging.node_name.empty())
+        {
+            char host_name[256] = {0};
+            gethostname(host_name, sizeof(host_name) - 1);
+            averaging.node_name = host_name;
+        }
+    }
 
-    std::cout << "Reading input file: " << input_path.string() << "\n";
-    cv::VideoCapture cap(input_path.string());
-    if (!cap.isOpened())
+    fs::path classifier_path(vm["classifier"].as<std::string>());
+    fs::path optimizer_path(classifier_path.string() + ".optimizer");
+    fs::path checkpoint_path(vm.count("checkpoint") != 0 ? vm["checkpoint"].as<std::string>() : classifier_path.string() + ".checkpoint");
+    bool resume = vm.count("resume") != 0;
+    bool checkpoint = resume || checkpointing.every_frames > 0 || checkpointing.every_seconds > 0.0 || vm.count("checkpoint") != 0;
+    if (resume && averaging.workers == 1 && !fs::exists(checkpoint_path))
     {
-        std::cerr << "Failed to open video capture\n";
+        std::cerr << "Checkpoint file does not exist: " << checkpoint_path.string() << "\n";
         return 1;
     }
 
+    std::vector<training::TrainingSource> sources;
+    if (use_manifest)
+    {
+        fs::path manifest_path(vm["manifest"].as<std::string>());
+        std::cout << "Reading manifest: " << manifest_path.string() << "\n";
+        if (!training::read_manifest(manifest_path.string(), sources))
+        {
+            return 1;
+        }
+        std::cout << "Manifest lists " << sources.size() << " videos\n";
+    }
+    else
+    {
+        training::TrainingSource source;
+        source.input_path = vm["input"].as<std::string>();
+        source.marked_path = vm["marked"].as<std::string>();
+        if (!fs::exists(source.input_path))
+        {
+            std::cerr << "Input file does not exist: " << source.input_path << "\n";
+            return 1;
+        }
+
+        if (!fs::exists(source.marked_path))
+        {
+            std::cerr << "Marked file does not exist: " << source.marked_path << "\n";
+            return 1;
+        }
+        sources.push_back(source);
+    }
+
     int w = 8;
     int h = 8;
     int f = 4;
 
+    // choose a subset of the frames to train with
+    float subset_percentage = 0.1f;
+    training::TrainingProgress progress;
+    progress.seed = static_cast<unsigned int>(std::time(0));
+    progress.trained = 0;
+    progress.consumed.assign(sources.size(), 0);
+    std::string sampler_state;
+
     classifiers::MLPClassifier classifier;
-    if (fs::exists(classifier_path.string()))
+    // worker processes each resume from their own checkpoint
+    if (resume && averaging.workers == 1)
+    {
+        std::cout << "Resuming from checkpoint: " << checkpoint_path.string() << "\n";
+        classifier.set_optimizer(optimizer);
+        if (!training::read_checkpoint(checkpoint_path.string(), sources, progress, sampler_state, classifier))
+        {
+            return 1;
+        }
+        std::cout << "Resuming after " << progress.trained << " trained frames and " << classifier.steps() << " updates\n";
+    }
+    else if (fs::exists(classifier_path.string()))
     {
         std::cout << "Reading classifier file: " << classifier_path.string() << "\n";
         std::ifstream classifier_file(classifier_path.string().c_str());
@@ -253,6 +530,11 @@ int main(int argc, char** argv)
         {
             std::cout << l << ": " << classifier.layer_size(l) << "\n";
         }
+        if (classifier.precision() != classifiers::PRECISION_FP32)
+        {
+            std::cout << "Converting " << classifiers::precision_name(classifier.precision()) << " weights to fp32 for training\n";
+            classifier.set_precision(classifiers::PRECISION_FP32);
+        }
     }
     else
     {
@@ -263,72 +545,202 @@ int main(int argc, char** argv)
         layer_sizes.push_back(1);
         classifier.init(layer_sizes);
     }
-
-    std::cout << "Input format:\n";
-    const int fourcc_i = static_cast<int>(cap.get(CV_CAP_PROP_FOURCC));
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_i);
-    std::cout << "FourCC: " << fourcc << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    double fps = cap.get(CV_CAP_PROP_FPS);
-    std::cout << "FPS: " << fps << "\n";
-    double estimated_frame_count = cap.get(CV_CAP_PROP_FRAME_COUNT);
-    std::cout << "Estimated frame count: " << estimated_frame_count << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
-
-    // count frames
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-    cap.release();
-
-    std::cout << "Reading marked data from: " << marked_path.string() << "\n";
-    std::vector<bool> marked(frame_count, false);
-    if (fs::exists(marked_path))
-    {
-        std::ifstream marked_file(marked_path.string().c_str());
-        int frame = 0;
-        while (marked_file >> frame)
+    if (vm.count("learning-rate") != 0)
+    {
+        classifier.set_learning_rate(vm["learning-rate"].as<float>());
+    }
+    classifier.set_optimizer(optimizer);
+    classifier.set_schedule(schedule);
+    if (!resume && fs::exists(classifier_path) && fs::exists(optimizer_path))
+    {
+        std::cout << "Reading optimizer state: " << optimizer_path.string() << "\n";
+        std::ifstream optimizer_file(optimizer_path.string().c_str());
+        if (classifier.read_optimizer(optimizer_file))
         {
-            marked[frame] = true;
+            std::cout << "Continuing from update " << classifier.steps() << "\n";
         }
     }
-
-    // choose a subset of the frames to train with
-    float subset_percentage = 0.1f;
-    size_t subset_size = static_cast<size_t>(static_cast<float>(frame_count) * subset_percentage);
-    std::vector<int> indices(frame_count);
-    std::iota(indices.begin(), indices.end(), 0);
-    std::random_shuffle(indices.begin(), indices.end());
-    std::vector<int> subset(subset_size);
-    std::copy(indices.begin(), indices.begin() + subset_size, subset.begin());
-    std::sort(subset.begin(), subset.end());
+    std::cout << "Optimizer: " << classifiers::optimizer_name(optimizer.type) << " learning rate: " << classifier.current_learning_rate() << "\n";
 
     bool verbose = vm.count("verbose") != 0;
 
-    std::cout << "Training on input file: " << input_path.string() << "\n";
-    if (!train(classifier,
-               marked,
-               subset,
-               input_path.string(),
-               w,
-               h,
-               f,
-               verbose))
-    {
-        std::cerr << "Failed to train on video: " << input_path.string() << "\n";
-        return 1;
+    std::unique_ptr<training::ParameterAverager> averager;
+    if (averaging.workers > 1 || !averaging.shared_dir.empty())
+    {
+        averager.reset(new training::ParameterAverager(averaging));
+        if (!averager->create(classifier.parameter_count()))
+        {
+            return 1;
+        }
     }
 
-    std::cout << "Writing classifier data to: " << marked_path.string() << "\n";
+    if (averaging.workers == 1)
+    {
+        if (averager)
+        {
+            averager->attach(0);
+        }
+        if (!run_training(classifier,
+                          sources,
+                          decoders,
+                          subset_percentage,
+                          sampling,
+                          progress,
+                          sampler_state,
+                          checkpoint ? checkpoint_path.string() : std::string(),
+                          checkpointing,
+                          averager.get(),
+                          w,
+                          h,
+                          f,
+                          verbose))
+        {
+            std::cerr << "Failed to train\n";
+            return 1;
+        }
+    }
+    else
+    {
+        const int workers = std::min(averaging.workers, static_cast<int>(sources.size()));
+        if (workers < averaging.workers)
+        {
+            std::cout << "Only " << workers << " workers have manifest sources to train on\n";
+        }
+        std::cout << "Training with " << workers << " worker processes, averaging every " << averaging.every_frames << " frames";
+        if (averaging.staleness > 0)
+        {
+            std::cout << " with staleness " << averaging.staleness;
+        }
+        std::cout << "\n";
+        std::cout.flush();
+        std::vector<pid_t> pids(averaging.workers, -1);
+        for (int r = 0; r < averaging.workers; ++r)
+        {
+            if (r >= workers)
+            {
+                // a worker without sources must not hold up synchronous rounds
+                averager->abandon(r);
+                continue;
+            }
+            pids[r] = fork();
+            if (pids[r] < 0)
+            {
+                std::cerr << "Failed to start worker " << r << "\n";
+                averager->abandon(r);
+                continue;
+            }
+            if (pids[r] == 0)
+            {
+                averager->attach(r);
+                std::vector<training::TrainingSource> shard;
+                for (size_t s = r; s < sources.size(); s += workers)
+                {
+                    shard.push_back(sources[s]);
+                }
+                training::TrainingProgress worker_progress;
+                worker_progress.seed = progress.seed + static_cast<unsigned int>(r);
+                worker_progress.trained = 0;
+                worker_progress.consumed.assign(shard.size(), 0);
+                std::string worker_sampler_state;
+                std::ostringstream worker_checkpoint;
+                if (checkpoint)
+                {
+                    worker_checkpoint << checkpoint_path.string() << "." << r;
+                }
+                if (resume && fs::exists(worker_checkpoint.str()))
+                {
+                    std::cout << "Worker " << r << " resuming from checkpoint: " << worker_checkpoint.str() << "\n";
+                    if (!training::read_checkpoint(worker_checkpoint.str(), shard, worker_progress, worker_sampler_state, classifier))
+                    {
+                        averager->abandon(r);
+                        _exit(1);
+                    }
+                }
+                bool trained = run_training(classifier,
+                                            shard,
+                                            decoders,
+                                            subset_percentage,
+                                            sampling,
+                                            worker_progress,
+                                            worker_sampler_state,
+                                            worker_checkpoint.str(),
+                                            checkpointing,
+                                            averager.get(),
+                                            w,
+                                            h,
+                                            f,
+                                            verbose);
+                // the other workers stop waiting on a failed one straight away rather than when the parent reaps it
+                if (trained)
+                {
+                    averager->finish(classifier);
+                }
+                else
+                {
+                    averager->abandon(r);
+                }
+                std::cout.flush();
+                _exit(trained ? 0 : 1);
+            }
+        }
+        // workers are reaped as they exit so one that crashed is abandoned while the others still run
+        int failed = 0;
+        int running = static_cast<int>(std::count_if(pids.begin(), pids.end(), [](const pid_t pid) { return pid > 0; }));
+        while (running > 0)
+        {
+            int status = 0;
+            pid_t pid = waitpid(-1, &status, 0);
+            if (pid < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            std::vector<pid_t>::iterator worker = std::find(pids.begin(), pids.end(), pid);
+            if (worker == pids.end())
+            {
+                continue;
+            }
+            const int r = static_cast<int>(worker - pids.begin());
+            running--;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                std::cerr << "Worker " << r << " failed\n";
+                averager->abandon(r);
+                failed++;
+            }
+        }
+        if (failed > 0 || !averager->final_average(classifier))
+        {
+            std::cerr << "Failed to train\n";
+            return 1;
+        }
+        // worker optimizer state is kept in the worker checkpoints, it is not averaged
+        if (fs::exists(optimizer_path))
+        {
+            fs::remove(optimizer_path);
+        }
+    }
+
+    if (!averaging.shared_dir.empty())
+    {
+        training::exchange_with_nodes(averaging.shared_dir, averaging.node_name, classifier);
+    }
+
+    if (averaging.workers == 1)
+    {
+        std::cout << "Writing optimizer state to: " << optimizer_path.string() << " after " << classifier.steps() << " updates, learning rate " << classifier.current_learning_rate() << "\n";
+        std::ofstream optimizer_file(optimizer_path.string().c_str());
+        classifier.write_optimizer(optimizer_file);
+    }
+    classifier.set_precision(output_precision);
+    std::cout << "Writing " << classifiers::precision_name(output_precision) << " classifier data to: " << classifier_path.string() << "\n";
     std::ofstream classifier_file(classifier_path.string().c_str());
     classifier.write(classifier_file);
 
-    std::cout << "Finished training on video: " << input_path.string() << "\n";
+    std::cout << "Finished training\n";
 
     cv::waitKey(0);
 
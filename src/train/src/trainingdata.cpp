@@ -0,0 +1,230 @@
+// trainingdata.cpp
+// Copyright Laurence Emms 2017
+
+#include "trainingdata.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <videosource.h>
+
+namespace fs = boost::filesystem;
+
+namespace training
+{
+    bool read_manifest(const std::string& manifest_path, std::vector<TrainingSource>& sources)
+    {
+        std::ifstream manifest_file(manifest_path.c_str());
+        if (!manifest_file)
+        {
+            std::cerr << "Failed to open manifest: " << manifest_path << "\n";
+            return false;
+        }
+        fs::path base = fs::path(manifest_path).parent_path();
+        std::string line;
+        int line_number = 0;
+        while (std::getline(manifest_file, line))
+        {
+            line_number++;
+            boost::algorithm::trim(line);
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+            // tab separated pairs allow spaces in paths
+            std::vector<std::string> fields;
+            if (line.find('\t') != std::string::npos)
+            {
+                boost::split(fields, line, boost::is_any_of("\t"), boost::token_compress_on);
+            }
+            else
+            {
+                boost::split(fields, line, boost::is_any_of(" "), boost::token_compress_on);
+            }
+            if (fields.size() != 2)
+            {
+                std::cerr << "Invalid manifest line " << line_number << ": " << line << "\n";
+                return false;
+            }
+            TrainingSource source;
+            fs::path input_path(fields[0]);
+            fs::path marked_path(fields[1]);
+            source.input_path = input_path.is_absolute() ? input_path.string() : (base / input_path).string();
+            source.marked_path = marked_path.is_absolute() ? marked_path.string() : (base / marked_path).string();
+            if (!fs::exists(source.input_path))
+            {
+                std::cerr << "Input file does not exist: " << source.input_path << "\n";
+                return false;
+            }
+            if (!fs::exists(source.marked_path))
+            {
+                std::cerr << "Marked file does not exist: " << source.marked_path << "\n";
+                return false;
+            }
+            sources.push_back(source);
+        }
+        return true;
+    }
+
+    SampleQueue::SampleQueue(const size_t capacity) : _capacity(std::max<size_t>(1, capacity)), _closed(false)
+    {
+    }
+
+    void SampleQueue::push(FrameSample& sample)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_samples.size() >= _capacity)
+        {
+            _condition.wait(lock);
+        }
+        _samples.push_back(FrameSample());
+        _samples.back().frames.swap(sample.frames);
+        _samples.back().target = sample.target;
+        _samples.back().frame_number = sample.frame_number;
+        _samples.back().source = sample.source;
+        _condition.notify_all();
+    }
+
+    bool SampleQueue::pop(FrameSample& sample)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_samples.empty() && !_closed)
+        {
+            _condition.wait(lock);
+        }
+        if (_samples.empty())
+        {
+            return false;
+        }
+        sample.frames.swap(_samples.front().frames);
+        sample.target = _samples.front().target;
+        sample.frame_number = _samples.front().frame_number;
+        sample.source = _samples.front().source;
+        _samples.pop_front();
+        _condition.notify_all();
+        return true;
+    }
+
+    void SampleQueue::close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _condition.notify_all();
+    }
+
+    bool decode_source(const TrainingSource& source,
+                       const size_t source_index,
+                       const float subset_percentage,
+                       const int f,
+                       const unsigned int seed,
+                       const size_t skip,
+                       SampleQueue& queue,
+                       const bool verbose)
+    {
+        videoio::VideoSource video;
+        if (!video.open(source.input_path))
+        {
+            return false;
+        }
+
+        if (video.streamed())
+        {
+            std::cerr << "Training needs a regular video file, not a raw video pipe: " << source.input_path << "\n";
+            return false;
+        }
+        const int frame_count = video.frame_count();
+        std::cout << "Decoding " << source.input_path << ", frame count: " << frame_count << "\n";
+
+        std::vector<bool> marked(frame_count, false);
+        std::ifstream marked_file(source.marked_path.c_str());
+        int marked_frame = 0;
+        while (marked_file >> marked_frame)
+        {
+            if (marked_frame >= 0 && marked_frame < frame_count)
+            {
+                marked[marked_frame] = true;
+            }
+        }
+
+        // choose a subset of the frames to train with
+        size_t subset_size = static_cast<size_t>(static_cast<float>(frame_count) * subset_percentage);
+        std::vector<int> indices(frame_count);
+        std::iota(indices.begin(), indices.end(), 0);
+        std::mt19937 gen(seed);
+        std::shuffle(indices.begin(), indices.end(), gen);
+        std::vector<int> subset(indices.begin(), indices.begin() + subset_size);
+        std::sort(subset.begin(), subset.end());
+        if (skip >= subset.size())
+        {
+            std::cout << "Already trained on " << source.input_path << "\n";
+            return true;
+        }
+
+        std::list<cv::Mat> prev_frames;
+        size_t subset_index = 0;
+        size_t skipped = 0;
+        // nothing after the last subset frame needs to be decoded
+        for (int fn = 0; fn < frame_count && subset_index < subset.size(); ++fn)
+        {
+            cv::Mat frame;
+            if (!video.read(frame))
+            {
+                std::cout << "Frame empty: "<< fn << "\n";
+                // a subset frame that failed to decode is skipped rather than waited for
+                while (subset_index < subset.size() && subset[subset_index] <= fn)
+                {
+                    subset_index++;
+                    skipped++;
+                }
+                continue;
+            }
+            prev_frames.push_front(frame);
+            if (static_cast<int>(prev_frames.size()) == 1)
+            {
+                // preload f frames
+                for (int i = 0; i < f - 1; ++i)
+                {
+                    prev_frames.push_front(frame);
+                }
+            }
+            while (static_cast<int>(prev_frames.size()) > f)
+            {
+                prev_frames.pop_back();
+            }
+            if (subset[subset_index] > fn)
+            {
+                continue;
+            }
+            subset_index++;
+            // decode sequentially through trained frames rather than seeking so the window matches the original run
+            if (subset_index <= skip)
+            {
+                continue;
+            }
+            if (verbose)
+            {
+                std::cout << "Queued frame " << fn << " / " << frame_count << " of " << source.input_path << "\n";
+            }
+            // the source only decodes into a buffer again once every sample holding it is released, so the window is shared without copying
+            FrameSample sample;
+            sample.frames = prev_frames;
+            sample.target = marked[fn] ? 1.0f : 0.0f;
+            sample.frame_number = fn;
+            sample.source = source_index;
+            queue.push(sample);
+        }
+        if (skipped > 0)
+        {
+            std::cout << "Skipped " << skipped << " training frames that failed to decode in " << source.input_path << "\n";
+        }
+        return true;
+    }
+}
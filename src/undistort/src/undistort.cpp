@@ -9,6 +9,9 @@
 #include <boost/algorithm/string.hpp>
 #include <opencv2/opencv.hpp>
 
+#include <videosink.h>
+#include <videosource.h>
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -30,9 +33,10 @@ void rotate(cv::Mat& mat, int angle)
     }
 }
 
-bool process_video(cv::VideoWriter& output_video,
+// frames are read until the source runs dry, so a raw video pipe with no frame count is processed in full
+bool process_video(videoio::VideoSink& output_video,
                    const cv::Size& output_size,
-                   const std::string& input_path,
+                   videoio::VideoSource& source,
                    const int output_width,
                    const int output_height,
                    const float aspect_ratio,
@@ -47,36 +51,16 @@ bool process_video(cv::VideoWriter& output_video,
                    const bool show,
                    const bool verbose)
 {
-    cv::VideoCapture cap(input_path);
-    if (!cap.isOpened())
-    {
-        std::cerr << "Failed to open video capture\n";
-        return false;
-    }
+    const int frame_count = source.frame_count();
 
-    const double fourcc_d = cap.get(CV_CAP_PROP_FOURCC);
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_d);
-    std::cout << "FourCC: " << fourcc << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    std::cout << "FPS: " << static_cast<int>(cap.get(CV_CAP_PROP_FPS)) << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
-
-    // count frames
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-
-    for (int fn = 0; fn < frame_count; ++fn)
+    int fn = 0;
+    cv::Mat frame;
+    while (source.read(frame))
     {
         if (verbose)
         {
             std::cout << "Frame number: " << fn << " / " << frame_count << "\n";
-            double msec = cap.get(CV_CAP_PROP_POS_MSEC);
+            double msec = source.msec();
             double seconds = std::floor(msec / 1000.0);
             double minutes = std::floor(seconds / 60.0);
             double hours = std::floor(minutes / 60.0);
@@ -85,12 +69,6 @@ bool process_video(cv::VideoWriter& output_video,
             msec -= seconds * 1000.0;
             std::cout << "Time: " << std::setfill('0') << std::setw(2) << static_cast<int>(hours) << ":" << std::setw(2) << static_cast<int>(minutes) << ":" << std::setw(2) << static_cast<int>(seconds) << ":" << std::setw(4) << static_cast<int>(msec) << "\n";
         }
-        cv::Mat frame;
-        if (!cap.read(frame))
-        {
-            std::cout << "Frame empty: "<< fn << "\n";
-            continue;
-        }
         int fw = frame.cols;
         int fh = frame.rows;
         rotate(frame, rotation_angle);
@@ -209,8 +187,9 @@ bool process_video(cv::VideoWriter& output_video,
             cv::imshow("Display window", disp);
             cv::waitKey(15);
         }
+        fn++;
     }
-    cap.release();
+    std::cout << "Frames processed: " << fn << "\n";
     std::cout << "Video processing complete\n";
     return true;
 }
@@ -233,7 +212,7 @@ int main(int argc, char** argv)
         ("help,h", "Print help message")
         ("version,v", "Print version number")
         ("input,i", po::value<std::string>(), "Input video file")
-        ("output,o", po::value<std::string>(), "Output video file")
+        ("output,o", po::value<std::string>(), "Output video file, a .vraw path writes uncompressed frames for the next tool")
         ("show,s", "Display output")
         ("force,f", "Force overwriting output")
         ("rotation,r", po::value<int>(&rotation_angle), "Rotate image by this angle (CW in degrees)")
@@ -246,6 +225,14 @@ int main(int argc, char** argv)
         ("gain", po::value<float>(&target_gain), "Gain")
         ("bias", po::value<float>(&target_bias), "Bias")
         ("gamma", po::value<float>(&target_gamma), "Gamma")
+        ("gstreamer", "Decode and encode with GStreamer pipelines instead of OpenCV when built with GStreamer")
+        ("ffmpeg", "Encode by piping frames into an ffmpeg process, falls back to OpenCV when ffmpeg is not installed")
+        ("codec", po::value<std::string>()->default_value("libx264"), "ffmpeg video encoder")
+        ("preset", po::value<std::string>()->default_value("medium"), "ffmpeg encoder preset, empty for the encoder default")
+        ("crf", po::value<int>()->default_value(18), "ffmpeg constant rate factor, negative for the encoder default")
+        ("pipe-bgr", "Pipe packed BGR frames to ffmpeg instead of converting them to YUV 4:2:0 first")
+        ("queue-depth", po::value<int>()->default_value(8), "Frames buffered ahead of the GStreamer or ffmpeg encoder")
+        ("io-threads", po::value<int>()->default_value(0), "GStreamer and ffmpeg decoder, converter and encoder threads, 0 to let each decide")
         ;
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -323,32 +310,37 @@ int main(int argc, char** argv)
         trimmed_paths.push_back(path);
     }
 
-    cv::VideoCapture cap(trimmed_paths[0]);
-    if (!cap.isOpened())
+    videoio::BackendOptions backend = videoio::default_backend();
+    if (vm.count("gstreamer") != 0)
     {
-        std::cerr << "Failed to open video capture\n";
-        return 1;
+        backend.backend = videoio::Backend::GStreamer;
+    }
+    backend.queue_depth = std::max(1, vm["queue-depth"].as<int>());
+    backend.threads = std::max(0, vm["io-threads"].as<int>());
+    backend.codec = vm["codec"].as<std::string>();
+    backend.preset = vm["preset"].as<std::string>();
+    backend.crf = vm["crf"].as<int>();
+    backend.pipe_yuv = vm.count("pipe-bgr") == 0;
+    // ffmpeg only encodes, the input is still decoded by the backend chosen above
+    videoio::BackendOptions output_backend = backend;
+    if (vm.count("ffmpeg") != 0)
+    {
+        output_backend.backend = videoio::Backend::FFmpeg;
     }
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
 
-    //count frames
-    int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
-    cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
+    // each input is opened once, the first one also gives the output format
+    videoio::VideoSource source;
+    if (!source.open(trimmed_paths[0], backend))
+    {
+        return 1;
+    }
 
     std::cout << "Input format:\n";
-    const int fourcc_i = static_cast<int>(cap.get(CV_CAP_PROP_FOURCC));
-    const char* fourcc = reinterpret_cast<const char*>(&fourcc_i);
-    std::cout << "FourCC: " << fourcc << "\n";
-    std::cout << "Frame count (approx): " << frame_count << "\n";
-    int frame_width = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_WIDTH));
-    int frame_height = static_cast<int>(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-    std::cout << "Frame width: " << frame_width << "\n";
-    std::cout << "Frame height: " << frame_height << "\n";
-    double fps = cap.get(CV_CAP_PROP_FPS);
-    std::cout << "FPS: " << fps << "\n";
-    std::cout << "Frame format: " << static_cast<int>(cap.get(CV_CAP_PROP_FORMAT)) << "\n";
-    std::cout << "ISO Speed: " << static_cast<int>(cap.get(CV_CAP_PROP_ISO_SPEED)) << "\n";
-    cap.release();
+    source.print_info();
+    const int fourcc_i = source.fourcc();
+    const int frame_width = source.width();
+    const int frame_height = source.height();
+    const double fps = source.fps();
 
     int output_width = frame_width;
     int output_height = frame_height;
@@ -375,9 +367,8 @@ int main(int argc, char** argv)
     std::cout << "xy scale: " << xscale << ", " << yscale << "\n";
 
     cv::Size output_size(output_width, output_height);
-    cv::VideoWriter output_video;
-    output_video.open(output_path.string(), fourcc_i, fps, output_size, true);
-    if (!output_video.isOpened())
+    videoio::VideoSink output_video;
+    if (!output_video.open(output_path.string(), fourcc_i, fps, output_size, output_backend))
     {
         std::cerr << "Failed to open output video: " << output_path.string() << "\n";
         return 1;
@@ -416,9 +407,18 @@ int main(int argc, char** argv)
     for (size_t i = 0; i < trimmed_paths.size(); ++i)
     {
         std::cout << "Processing input file " << i << ": " << trimmed_paths[i] << "\n";
+        if (i > 0)
+        {
+            if (!source.open(trimmed_paths[i], backend))
+            {
+                output_video.close();
+                return 1;
+            }
+            source.print_info();
+        }
         if (!process_video(output_video,
                            output_size,
-                           trimmed_paths[i],
+                           source,
                            output_width,
                            output_height,
                            aspect_ratio,
@@ -434,11 +434,11 @@ int main(int argc, char** argv)
                            verbose))
         {
             std::cerr << "Failed to process input file: " << i << "\n";
-            output_video.release();
+            output_video.close();
             return 1;
         }
     }
-    output_video.release();
+    output_video.close();
     std::cout << "Finished writing video: " << output_path.string() << "\n";
 
     cv::waitKey(0);
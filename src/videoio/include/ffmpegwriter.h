@@ -0,0 +1,48 @@
+// ffmpegwriter.h
+// Copyright Laurence Emms 2017
+
+#ifndef FFMPEG_WRITER
+#define FFMPEG_WRITER
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+#include "videobackend.h"
+
+namespace videoio
+{
+    // pipes raw frames into an ffmpeg subprocess, a writer thread feeds the pipe so encoding overlaps processing
+    class FFmpegWriter
+    {
+    public:
+        FFmpegWriter();
+        ~FFmpegWriter();
+        bool open(const std::string& path, const double fps, const cv::Size& size, const BackendOptions& options);
+        bool is_open() const;
+        // the frame is queued without copying, blocks while queue_depth frames are waiting
+        void write(const cv::Mat& frame);
+        // writes the queued frames and waits for ffmpeg to finish the file, false if anything failed
+        bool close();
+    private:
+        void run();
+
+        FILE* _pipe;
+        cv::Size _size;
+        bool _yuv;
+        size_t _max_queued;
+        bool _stop;
+        bool _failed;
+        std::deque<cv::Mat> _queue;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        std::thread _thread;
+    };
+}
+
+#endif // FFMPEG_WRITER
@@ -0,0 +1,57 @@
+// frameindex.h
+// Copyright Laurence Emms 2017
+
+#ifndef FRAME_INDEX
+#define FRAME_INDEX
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace videoio
+{
+    // exact frame layout of a video, kept in a sidecar next to it so it is only built once
+    struct FrameIndex
+    {
+        std::uint64_t source_size;
+        std::int64_t source_mtime;
+        int frame_count;
+        // display order frame numbers of the keyframes, ascending
+        std::vector<int> keyframes;
+        // presentation time of every frame in milliseconds from the first frame
+        std::vector<double> timestamps;
+        // a keyframe is followed in decode order by frames shown before it, so GOPs cannot be cut apart cleanly
+        bool open_gop;
+
+        // the keyframe at or before fn, 0 when there is none
+        int keyframe_before(const int fn) const;
+    };
+
+    // single quotes text for the shell commands that run ffmpeg and ffprobe
+    std::string shell_quote(const std::string& text);
+
+    std::string index_path(const std::string& input_path);
+
+    // reads the sidecar, or builds it from the ffprobe packet index and writes it when it is missing or stale,
+    // a video that failed to index is not probed again until it changes
+    bool load_index(const std::string& input_path, FrameIndex& index);
+
+    // the packet index is read without decoding any frames
+    bool build_index(const std::string& input_path, FrameIndex& index);
+
+    // the sidecar must match the size and modification time of the video
+    bool read_index(const std::string& path, const std::string& input_path, FrameIndex& index);
+    bool write_index(const std::string& path, const FrameIndex& index);
+
+    // the exact count from the index, the approximate count from seeking the capture to the end when there is none
+    int count_frames(const std::string& input_path, cv::VideoCapture& cap);
+    // seeks the capture to the end and back, for videos without an index
+    int approximate_frame_count(cv::VideoCapture& cap);
+
+    // positions the capture so the next read returns frame fn by seeking to the keyframe before it and reading forward
+    bool seek_frame(cv::VideoCapture& cap, const FrameIndex& index, const int fn);
+}
+
+#endif // FRAME_INDEX
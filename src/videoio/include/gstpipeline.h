@@ -0,0 +1,68 @@
+// gstpipeline.h
+// Copyright Laurence Emms 2017
+
+#ifndef GST_PIPELINE
+#define GST_PIPELINE
+
+#ifdef WITH_GSTREAMER
+
+#include <cstdint>
+#include <string>
+
+#include <gst/gst.h>
+#include <opencv2/opencv.hpp>
+
+#include "videobackend.h"
+
+namespace videoio
+{
+    // decodes through decodebin into an appsink that hands out packed BGR frames
+    class GstReader
+    {
+    public:
+        GstReader();
+        ~GstReader();
+        bool open(const std::string& path, const BackendOptions& options);
+        void close();
+        int width() const;
+        int height() const;
+        double fps() const;
+        // decodes into the caller's buffer, which is only reallocated when its size or type does not match
+        bool read(cv::Mat& frame, double& msec);
+        // the next read returns the first frame at or after msec
+        bool seek(const double msec);
+    private:
+        GstElement* _pipeline;
+        GstElement* _sink;
+        int _width;
+        int _height;
+        double _fps;
+        // decoder threads, read when decodebin adds its decoder
+        int _threads;
+    };
+
+    // encodes frames pushed into an appsrc with x264, muxed by the output extension
+    class GstWriter
+    {
+    public:
+        GstWriter();
+        ~GstWriter();
+        bool open(const std::string& path, const double fps, const cv::Size& size, const BackendOptions& options);
+        bool is_open() const;
+        // the frame is handed to the pipeline without copying and released once it is encoded,
+        // blocks while queue_depth frames are waiting
+        void write(const cv::Mat& frame);
+        // drains the pipeline and finalizes the container
+        void close();
+    private:
+        GstElement* _pipeline;
+        GstElement* _source;
+        int _fps_n;
+        int _fps_d;
+        std::uint64_t _frames;
+    };
+}
+
+#endif // WITH_GSTREAMER
+
+#endif // GST_PIPELINE
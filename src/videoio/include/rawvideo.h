@@ -0,0 +1,67 @@
+// rawvideo.h
+// Copyright Laurence Emms 2017
+
+#ifndef RAW_VIDEO
+#define RAW_VIDEO
+
+#include <cstdio>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+namespace videoio
+{
+    // uncompressed BGR frames after a small header, passed between tools without codec cost or generation loss
+    // a path ending in .vraw is read and written in this format by VideoSource and VideoSink
+    bool is_raw_video(const std::string& path);
+
+    // regular files are memory mapped, a named pipe is read forward only and has no frame count until it ends
+    class RawReader
+    {
+    public:
+        RawReader();
+        ~RawReader();
+        bool open(const std::string& path);
+        void close();
+        int fourcc() const;
+        int width() const;
+        int height() const;
+        double fps() const;
+        // -1 when reading from a pipe
+        int frame_count() const;
+        bool seek(const int fn);
+        // copies the next frame into the caller's buffer, which is only reallocated when its size or type does not match
+        bool read(cv::Mat& frame);
+    private:
+        int _fd;
+        const unsigned char* _mapped;
+        size_t _mapped_size;
+        int _fourcc;
+        int _width;
+        int _height;
+        double _fps;
+        size_t _frame_bytes;
+        int _frame_count;
+        int _position;
+    };
+
+    // frames are written with one sequential write each, to a file or a named pipe
+    class RawWriter
+    {
+    public:
+        RawWriter();
+        ~RawWriter();
+        // the source FourCC is carried in the header so the final stage can encode with it
+        bool open(const std::string& path, const int fourcc, const double fps, const cv::Size& size);
+        bool is_open() const;
+        void write(const cv::Mat& frame);
+        // false if any write failed
+        bool close();
+    private:
+        FILE* _file;
+        cv::Size _size;
+        bool _failed;
+    };
+}
+
+#endif // RAW_VIDEO
@@ -0,0 +1,50 @@
+// videobackend.h
+// Copyright Laurence Emms 2017
+
+#ifndef VIDEO_BACKEND
+#define VIDEO_BACKEND
+
+#include <string>
+
+namespace videoio
+{
+    // FFmpeg only encodes, sources opened with it decode through OpenCV
+    enum class Backend
+    {
+        OpenCV,
+        GStreamer,
+        FFmpeg
+    };
+
+    struct BackendOptions
+    {
+        Backend backend;
+        // frames buffered between the stages of a pipeline
+        int queue_depth;
+        // decoder, converter and encoder threads, 0 lets each element decide
+        int threads;
+        // ffmpeg encoder, an empty preset or a negative crf leaves the encoder default
+        std::string codec;
+        std::string preset;
+        int crf;
+        // frames are converted to planar YUV 4:2:0 before they are piped, half the bytes of packed BGR
+        bool pipe_yuv;
+        // ffmpeg output stream, an empty profile or level leaves the encoder default
+        std::string profile;
+        std::string level;
+        std::string pix_fmt;
+        // libx264 options as key=value:key=value, empty for none
+        std::string x264_params;
+        // exact frame rate such as 30000/1001 used instead of the fps of the sink, empty to use the fps
+        std::string frame_rate;
+        // mp4 and mov track timescale, 0 leaves the muxer default
+        int timescale;
+    };
+
+    // OpenCV with default queue and thread settings
+    BackendOptions default_backend();
+    // the requested backend, or OpenCV when it was not built in or ffmpeg is not installed
+    Backend available_backend(const Backend backend);
+}
+
+#endif // VIDEO_BACKEND
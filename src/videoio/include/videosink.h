@@ -0,0 +1,46 @@
+// videosink.h
+// Copyright Laurence Emms 2017
+
+#ifndef VIDEO_SINK
+#define VIDEO_SINK
+
+#include <memory>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "ffmpegwriter.h"
+#include "gstpipeline.h"
+#include "rawvideo.h"
+#include "videobackend.h"
+
+namespace videoio
+{
+    // encodes frames with the backend chosen when it is opened, falling back to cv::VideoWriter
+    class VideoSink
+    {
+    public:
+        VideoSink();
+        ~VideoSink();
+        bool open(const std::string& path, const int fourcc, const double fps, const cv::Size& size);
+        // fourcc only applies to OpenCV, GStreamer encodes H.264 into a container picked by the extension
+        // and ffmpeg uses the codec and stream settings of the options, raw video paths are written directly whatever the backend
+        bool open(const std::string& path, const int fourcc, const double fps, const cv::Size& size, const BackendOptions& options);
+        bool is_open() const;
+        // the backend actually encoding after any fallback, raw video reports OpenCV
+        Backend backend() const;
+        // the frame may be shared with a backend queue until it is encoded and must not be written to afterwards
+        void write(const cv::Mat& frame);
+        // finalizes the output, frames still queued in the backend are encoded first, false if the backend failed to finish it
+        bool close();
+    private:
+        cv::VideoWriter _writer;
+        std::unique_ptr<FFmpegWriter> _ffmpeg;
+        std::unique_ptr<RawWriter> _raw;
+#ifdef WITH_GSTREAMER
+        std::unique_ptr<GstWriter> _gst;
+#endif
+    };
+}
+
+#endif // VIDEO_SINK
@@ -0,0 +1,85 @@
+// videosource.h
+// Copyright Laurence Emms 2017
+
+#ifndef VIDEO_SOURCE
+#define VIDEO_SOURCE
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "frameindex.h"
+#include "gstpipeline.h"
+#include "rawvideo.h"
+#include "videobackend.h"
+
+namespace videoio
+{
+    // a video opened once with its metadata read up front, frames are decoded into a pool of reused buffers
+    class VideoSource
+    {
+    public:
+        VideoSource();
+        ~VideoSource();
+        bool open(const std::string& path);
+        // metadata and the frame count always come from OpenCV and the index, frames from the chosen backend,
+        // raw video paths are read directly whatever the backend
+        bool open(const std::string& path, const BackendOptions& options);
+        void close();
+        bool is_open() const;
+        const std::string& path() const;
+
+        int fourcc() const;
+        int width() const;
+        int height() const;
+        double fps() const;
+        // exact when the video is indexed, approximate otherwise, 0 for a raw video pipe
+        int frame_count() const;
+        // a raw video pipe, read forward only until it runs dry
+        bool streamed() const;
+        bool indexed() const;
+        const FrameIndex& index() const;
+        // the metadata block logged when a video is opened
+        void print_info() const;
+
+        // the next read returns frame fn, the position is unchanged when the seek fails
+        bool seek(const int fn);
+        // reads return frames in [first, end), a negative end reads to the end of the video
+        bool set_range(const int first, const int end);
+        // a pooled buffer is only decoded into again once every Mat handed out for it has been released,
+        // a frame that fails to decode is still counted so the position stays on the next frame
+        bool read(cv::Mat& frame);
+        // frame number the next read returns
+        int position() const;
+        // timestamp in milliseconds of the frame last read
+        double msec() const;
+    private:
+        cv::Mat& acquire();
+        bool decode(cv::Mat& buffer, double& msec);
+
+        std::string _path;
+        bool _open;
+        cv::VideoCapture _cap;
+        std::unique_ptr<RawReader> _raw;
+#ifdef WITH_GSTREAMER
+        std::unique_ptr<GstReader> _gst;
+#endif
+        FrameIndex _index;
+        bool _indexed;
+        int _fourcc;
+        int _width;
+        int _height;
+        double _fps;
+        int _format;
+        int _iso_speed;
+        int _frame_count;
+        int _position;
+        int _end;
+        double _msec;
+        std::vector<cv::Mat> _pool;
+    };
+}
+
+#endif // VIDEO_SOURCE
@@ -0,0 +1,191 @@
+// ffmpegwriter.cpp
+// Copyright Laurence Emms 2017
+
+#include "ffmpegwriter.h"
+#include "frameindex.h"
+
+#include <algorithm>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+
+namespace videoio
+{
+    namespace
+    {
+        // a larger pipe lets ffmpeg read whole frames between context switches
+        const int pipe_bytes = 1 << 20;
+    }
+
+    FFmpegWriter::FFmpegWriter() :
+        _pipe(nullptr),
+        _yuv(false),
+        _max_queued(1),
+        _stop(false),
+        _failed(false)
+    {
+    }
+
+    FFmpegWriter::~FFmpegWriter()
+    {
+        close();
+    }
+
+    bool FFmpegWriter::open(const std::string& path, const double fps, const cv::Size& size, const BackendOptions& options)
+    {
+        close();
+        _size = size;
+        // 4:2:0 needs even dimensions
+        _yuv = options.pipe_yuv && size.width % 2 == 0 && size.height % 2 == 0;
+        std::ostringstream command;
+        command << "ffmpeg -hide_banner -loglevel error -y -f rawvideo -pix_fmt " << (_yuv ? "yuv420p" : "bgr24")
+                << " -s " << size.width << "x" << size.height << " -framerate ";
+        if (!options.frame_rate.empty())
+        {
+            command << shell_quote(options.frame_rate);
+        }
+        else
+        {
+            command << std::setprecision(12) << (fps > 0.0 ? fps : 30.0);
+        }
+        command << " -i - -an -c:v " << shell_quote(options.codec);
+        if (!options.preset.empty())
+        {
+            command << " -preset " << shell_quote(options.preset);
+        }
+        if (options.crf >= 0)
+        {
+            command << " -crf " << options.crf;
+        }
+        if (!options.profile.empty())
+        {
+            command << " -profile:v " << shell_quote(options.profile);
+        }
+        if (!options.level.empty())
+        {
+            command << " -level " << shell_quote(options.level);
+        }
+        if (!options.x264_params.empty())
+        {
+            command << " -x264-params " << shell_quote(options.x264_params);
+        }
+        command << " -threads " << options.threads
+                << " -pix_fmt " << shell_quote(options.pix_fmt.empty() ? std::string("yuv420p") : options.pix_fmt);
+        if (options.timescale > 0)
+        {
+            command << " -video_track_timescale " << options.timescale;
+        }
+        command << " " << shell_quote(path);
+
+        // a failed ffmpeg shows up as a write error rather than terminating the process
+        std::signal(SIGPIPE, SIG_IGN);
+        _pipe = popen(command.str().c_str(), "w");
+        if (_pipe == nullptr)
+        {
+            std::cerr << "Failed to start ffmpeg: " << command.str() << "\n";
+            return false;
+        }
+#ifdef F_SETPIPE_SZ
+        fcntl(fileno(_pipe), F_SETPIPE_SZ, pipe_bytes);
+#endif
+        _max_queued = static_cast<size_t>(std::max(1, options.queue_depth));
+        _stop = false;
+        _failed = false;
+        _thread = std::thread(&FFmpegWriter::run, this);
+        return true;
+    }
+
+    bool FFmpegWriter::is_open() const
+    {
+        return _pipe != nullptr;
+    }
+
+    void FFmpegWriter::write(const cv::Mat& frame)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_queue.size() >= _max_queued && !_failed)
+        {
+            _condition.wait(lock);
+        }
+        if (_failed)
+        {
+            return;
+        }
+        _queue.push_back(frame);
+        _condition.notify_all();
+    }
+
+    bool FFmpegWriter::close()
+    {
+        if (_pipe == nullptr)
+        {
+            return true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _condition.notify_all();
+        }
+        _thread.join();
+        int status = pclose(_pipe);
+        _pipe = nullptr;
+        _queue.clear();
+        if (status != 0)
+        {
+            std::cerr << "ffmpeg exited with status " << status << "\n";
+            return false;
+        }
+        return !_failed;
+    }
+
+    void FFmpegWriter::run()
+    {
+        cv::Mat converted;
+        while (true)
+        {
+            cv::Mat frame;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (_queue.empty() && !_stop)
+                {
+                    _condition.wait(lock);
+                }
+                if (_queue.empty())
+                {
+                    return;
+                }
+                frame = _queue.front();
+                _queue.pop_front();
+                _condition.notify_all();
+            }
+
+            // ffmpeg reads fixed size frames, a mismatched one would shift every frame after it
+            if (frame.cols != _size.width || frame.rows != _size.height)
+            {
+                std::cerr << "Skipping frame of size " << frame.cols << "x" << frame.rows << " for ffmpeg output of size " << _size.width << "x" << _size.height << "\n";
+                continue;
+            }
+            if (_yuv)
+            {
+                cv::cvtColor(frame, converted, cv::COLOR_BGR2YUV_I420);
+                frame = converted;
+            }
+            else if (!frame.isContinuous())
+            {
+                frame = frame.clone();
+            }
+            const size_t bytes = frame.total() * frame.elemSize();
+            if (std::fwrite(frame.ptr(), 1, bytes, _pipe) != bytes)
+            {
+                std::cerr << "Failed to write frame to ffmpeg\n";
+                std::lock_guard<std::mutex> lock(_mutex);
+                _failed = true;
+                _queue.clear();
+                _condition.notify_all();
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,300 @@
+// frameindex.cpp
+// Copyright Laurence Emms 2017
+
+#include "frameindex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace videoio
+{
+    namespace
+    {
+        bool source_stamp(const std::string& input_path, std::uint64_t& size, std::int64_t& mtime)
+        {
+            boost::system::error_code error;
+            size = static_cast<std::uint64_t>(fs::file_size(input_path, error));
+            if (error)
+            {
+                return false;
+            }
+            mtime = static_cast<std::int64_t>(fs::last_write_time(input_path, error));
+            return !error;
+        }
+
+        struct Packet
+        {
+            double time;
+            bool key;
+        };
+
+        // size and modification time of videos ffprobe could not index, so they are not probed again
+        std::mutex failed_mutex;
+        std::map<std::string, std::pair<std::uint64_t, std::int64_t> > failed_indexes;
+    }
+
+    std::string shell_quote(const std::string& text)
+    {
+        std::string quoted = "'";
+        for (char c : text)
+        {
+            if (c == '\'')
+            {
+                quoted += "'\\''";
+            }
+            else
+            {
+                quoted += c;
+            }
+        }
+        return quoted + "'";
+    }
+
+    int FrameIndex::keyframe_before(const int fn) const
+    {
+        std::vector<int>::const_iterator it = std::upper_bound(keyframes.begin(), keyframes.end(), fn);
+        if (it == keyframes.begin())
+        {
+            return 0;
+        }
+        return *(it - 1);
+    }
+
+    std::string index_path(const std::string& input_path)
+    {
+        return input_path + ".index";
+    }
+
+    bool load_index(const std::string& input_path, FrameIndex& index)
+    {
+        const std::string path = index_path(input_path);
+        if (read_index(path, input_path, index))
+        {
+            return true;
+        }
+        std::pair<std::uint64_t, std::int64_t> stamp;
+        if (!source_stamp(input_path, stamp.first, stamp.second))
+        {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(failed_mutex);
+            std::map<std::string, std::pair<std::uint64_t, std::int64_t> >::const_iterator it = failed_indexes.find(input_path);
+            if (it != failed_indexes.end() && it->second == stamp)
+            {
+                return false;
+            }
+        }
+        if (!build_index(input_path, index))
+        {
+            std::lock_guard<std::mutex> lock(failed_mutex);
+            failed_indexes[input_path] = stamp;
+            return false;
+        }
+        // an unwritable directory only costs rebuilding the index next time
+        if (!write_index(path, index))
+        {
+            std::cerr << "Failed to write frame index: " << path << "\n";
+        }
+        return true;
+    }
+
+    bool build_index(const std::string& input_path, FrameIndex& index)
+    {
+        if (!source_stamp(input_path, index.source_size, index.source_mtime))
+        {
+            return false;
+        }
+
+        std::string command = "ffprobe -v error -select_streams v:0 -show_entries packet=pts_time,flags -of csv=p=0 " + shell_quote(input_path) + " 2>/dev/null";
+        FILE* pipe = popen(command.c_str(), "r");
+        if (pipe == nullptr)
+        {
+            return false;
+        }
+
+        // packets arrive in decode order, sorting by presentation time gives the display order frame numbers
+        std::vector<Packet> packets;
+        bool valid = true;
+        char line[256];
+        while (fgets(line, sizeof(line), pipe) != nullptr)
+        {
+            std::string text(line);
+            size_t comma = text.find(',');
+            if (comma == std::string::npos)
+            {
+                continue;
+            }
+            char* end = nullptr;
+            Packet packet;
+            packet.time = std::strtod(text.c_str(), &end);
+            if (end == text.c_str())
+            {
+                // packets without timestamps cannot be placed in display order
+                valid = false;
+                continue;
+            }
+            packet.key = text.find('K', comma) != std::string::npos;
+            packets.push_back(packet);
+        }
+        if (pclose(pipe) != 0 || !valid || packets.empty())
+        {
+            return false;
+        }
+
+        // leading frames of an open GOP follow their keyframe in decode order but are shown before it
+        index.open_gop = false;
+        bool keyframe_seen = false;
+        double keyframe_time = 0.0;
+        for (const Packet& packet : packets)
+        {
+            if (packet.key)
+            {
+                keyframe_seen = true;
+                keyframe_time = packet.time;
+            }
+            else if (keyframe_seen && packet.time < keyframe_time)
+            {
+                index.open_gop = true;
+            }
+        }
+
+        std::stable_sort(packets.begin(), packets.end(), [](const Packet& a, const Packet& b)
+        {
+            return a.time < b.time;
+        });
+        index.frame_count = static_cast<int>(packets.size());
+        index.keyframes.clear();
+        index.timestamps.resize(packets.size());
+        for (size_t i = 0; i < packets.size(); ++i)
+        {
+            index.timestamps[i] = (packets[i].time - packets[0].time) * 1000.0;
+            if (packets[i].key)
+            {
+                index.keyframes.push_back(static_cast<int>(i));
+            }
+        }
+        return true;
+    }
+
+    bool read_index(const std::string& path, const std::string& input_path, FrameIndex& index)
+    {
+        std::ifstream index_file(path.c_str());
+        if (!index_file)
+        {
+            return false;
+        }
+        std::string type;
+        index_file >> type;
+        // older sidecars without the GOP structure are rebuilt
+        if (type != "frameindex2")
+        {
+            return false;
+        }
+        std::uint64_t source_size = 0;
+        std::int64_t source_mtime = 0;
+        if (!source_stamp(input_path, source_size, source_mtime))
+        {
+            return false;
+        }
+        size_t keyframe_count = 0;
+        index_file >> index.source_size >> index.source_mtime >> index.open_gop >> index.frame_count >> keyframe_count;
+        if (!index_file || index.source_size != source_size || index.source_mtime != source_mtime || index.frame_count < 0)
+        {
+            return false;
+        }
+        index.keyframes.resize(keyframe_count);
+        for (size_t i = 0; i < keyframe_count; ++i)
+        {
+            index_file >> index.keyframes[i];
+        }
+        index.timestamps.resize(index.frame_count);
+        for (int i = 0; i < index.frame_count; ++i)
+        {
+            index_file >> index.timestamps[i];
+        }
+        return static_cast<bool>(index_file);
+    }
+
+    bool write_index(const std::string& path, const FrameIndex& index)
+    {
+        // written through a temporary file so a reader never sees a partial index
+        std::string temp_path = path + ".tmp";
+        {
+            std::ofstream index_file(temp_path.c_str());
+            if (!index_file)
+            {
+                return false;
+            }
+            index_file << "frameindex2\n";
+            index_file << index.source_size << "\n" << index.source_mtime << "\n" << (index.open_gop ? 1 : 0) << "\n";
+            index_file << index.frame_count << "\n" << index.keyframes.size() << "\n";
+            for (int keyframe : index.keyframes)
+            {
+                index_file << keyframe << "\n";
+            }
+            index_file << std::setprecision(17);
+            for (double timestamp : index.timestamps)
+            {
+                index_file << timestamp << "\n";
+            }
+            if (!index_file)
+            {
+                std::remove(temp_path.c_str());
+                return false;
+            }
+        }
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    int count_frames(const std::string& input_path, cv::VideoCapture& cap)
+    {
+        FrameIndex index;
+        if (load_index(input_path, index))
+        {
+            return index.frame_count;
+        }
+        return approximate_frame_count(cap);
+    }
+
+    int approximate_frame_count(cv::VideoCapture& cap)
+    {
+        cap.set(CV_CAP_PROP_POS_AVI_RATIO, 1);
+        int frame_count = static_cast<int>(cap.get(CV_CAP_PROP_POS_FRAMES));
+        cap.set(CV_CAP_PROP_POS_AVI_RATIO, 0);
+        return frame_count;
+    }
+
+    bool seek_frame(cv::VideoCapture& cap, const FrameIndex& index, const int fn)
+    {
+        // seeks land reliably on keyframes, the frames after one are counted off by grabbing without converting
+        const int keyframe = index.keyframes.empty() ? fn : index.keyframe_before(fn);
+        if (!cap.set(CV_CAP_PROP_POS_FRAMES, keyframe))
+        {
+            return false;
+        }
+        for (int i = keyframe; i < fn; ++i)
+        {
+            if (!cap.grab())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,367 @@
+// gstpipeline.cpp
+// Copyright Laurence Emms 2017
+
+#include "gstpipeline.h"
+
+#ifdef WITH_GSTREAMER
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+namespace fs = boost::filesystem;
+
+namespace videoio
+{
+    namespace
+    {
+        std::once_flag gst_initialized;
+
+        void init_gstreamer()
+        {
+            std::call_once(gst_initialized, []()
+            {
+                gst_init(nullptr, nullptr);
+            });
+        }
+
+        // thread properties differ between element versions, only the ones an element has are set
+        void set_threads(GstElement* element, const char* property, const int threads)
+        {
+            if (element != nullptr && g_object_class_find_property(G_OBJECT_GET_CLASS(element), property) != nullptr)
+            {
+                g_object_set(element, property, threads, nullptr);
+            }
+        }
+
+        // decodebin creates the decoder once the stream type is known
+        void on_element_added(GstBin*, GstBin*, GstElement* element, gpointer data)
+        {
+            set_threads(element, "max-threads", *static_cast<const int*>(data));
+        }
+
+        GstElement* launch(const std::string& description)
+        {
+            GError* error = nullptr;
+            GstElement* pipeline = gst_parse_launch(description.c_str(), &error);
+            if (error != nullptr)
+            {
+                std::cerr << "Failed to create GStreamer pipeline: " << error->message << "\n";
+                g_error_free(error);
+                if (pipeline != nullptr)
+                {
+                    gst_object_unref(pipeline);
+                }
+                return nullptr;
+            }
+            return pipeline;
+        }
+
+        GstElement* element(GstElement* pipeline, const char* name)
+        {
+            return gst_bin_get_by_name(GST_BIN(pipeline), name);
+        }
+
+        void report_error(GstMessage* message)
+        {
+            GError* error = nullptr;
+            gchar* debug = nullptr;
+            gst_message_parse_error(message, &error, &debug);
+            std::cerr << "GStreamer error: " << (error != nullptr ? error->message : "unknown") << "\n";
+            if (error != nullptr)
+            {
+                g_error_free(error);
+            }
+            g_free(debug);
+        }
+
+        bool pending_error(GstElement* pipeline)
+        {
+            GstBus* bus = gst_element_get_bus(pipeline);
+            GstMessage* message = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+            gst_object_unref(bus);
+            if (message == nullptr)
+            {
+                return false;
+            }
+            report_error(message);
+            gst_message_unref(message);
+            return true;
+        }
+
+        void release_frame(gpointer data)
+        {
+            delete static_cast<cv::Mat*>(data);
+        }
+
+        const char* muxer(const std::string& path)
+        {
+            std::string extension = boost::algorithm::to_lower_copy(fs::path(path).extension().string());
+            if (extension == ".mkv")
+            {
+                return "matroskamux";
+            }
+            if (extension == ".avi")
+            {
+                return "avimux";
+            }
+            if (extension == ".mov")
+            {
+                return "qtmux";
+            }
+            return "mp4mux";
+        }
+    }
+
+    GstReader::GstReader() :
+        _pipeline(nullptr),
+        _sink(nullptr),
+        _width(0),
+        _height(0),
+        _fps(0.0),
+        _threads(0)
+    {
+    }
+
+    GstReader::~GstReader()
+    {
+        close();
+    }
+
+    bool GstReader::open(const std::string& path, const BackendOptions& options)
+    {
+        close();
+        init_gstreamer();
+        std::ostringstream description;
+        // the caps filter makes decodebin link its video pad, the queue alone would accept an audio pad first
+        description << "filesrc name=source ! decodebin ! video/x-raw ! queue max-size-buffers=" << options.queue_depth << " max-size-bytes=0 max-size-time=0 ! "
+                    << "videoconvert name=convert ! video/x-raw,format=BGR ! "
+                    << "appsink name=sink sync=false max-buffers=" << options.queue_depth;
+        _pipeline = launch(description.str());
+        if (_pipeline == nullptr)
+        {
+            return false;
+        }
+        GstElement* source = element(_pipeline, "source");
+        g_object_set(source, "location", path.c_str(), nullptr);
+        gst_object_unref(source);
+        GstElement* convert = element(_pipeline, "convert");
+        set_threads(convert, "n-threads", options.threads);
+        gst_object_unref(convert);
+        _threads = options.threads;
+        g_signal_connect(_pipeline, "deep-element-added", G_CALLBACK(on_element_added), &_threads);
+        _sink = element(_pipeline, "sink");
+
+        // the first frame prerolls in the paused state and gives the negotiated size and rate
+        gst_element_set_state(_pipeline, GST_STATE_PAUSED);
+        if (gst_element_get_state(_pipeline, nullptr, nullptr, GST_CLOCK_TIME_NONE) == GST_STATE_CHANGE_FAILURE)
+        {
+            pending_error(_pipeline);
+            std::cerr << "Failed to open GStreamer pipeline: " << path << "\n";
+            close();
+            return false;
+        }
+        GstSample* sample = gst_app_sink_pull_preroll(GST_APP_SINK(_sink));
+        if (sample == nullptr)
+        {
+            std::cerr << "No video frames in: " << path << "\n";
+            close();
+            return false;
+        }
+        GstVideoInfo info;
+        gst_video_info_from_caps(&info, gst_sample_get_caps(sample));
+        _width = GST_VIDEO_INFO_WIDTH(&info);
+        _height = GST_VIDEO_INFO_HEIGHT(&info);
+        _fps = GST_VIDEO_INFO_FPS_D(&info) > 0 ? static_cast<double>(GST_VIDEO_INFO_FPS_N(&info)) / GST_VIDEO_INFO_FPS_D(&info) : 0.0;
+        gst_sample_unref(sample);
+
+        // the prerolled frame is also the first sample pulled once playing
+        gst_element_set_state(_pipeline, GST_STATE_PLAYING);
+        return true;
+    }
+
+    void GstReader::close()
+    {
+        if (_pipeline != nullptr)
+        {
+            gst_element_set_state(_pipeline, GST_STATE_NULL);
+            gst_object_unref(_sink);
+            gst_object_unref(_pipeline);
+            _sink = nullptr;
+            _pipeline = nullptr;
+        }
+    }
+
+    int GstReader::width() const
+    {
+        return _width;
+    }
+
+    int GstReader::height() const
+    {
+        return _height;
+    }
+
+    double GstReader::fps() const
+    {
+        return _fps;
+    }
+
+    bool GstReader::read(cv::Mat& frame, double& msec)
+    {
+        GstSample* sample = gst_app_sink_pull_sample(GST_APP_SINK(_sink));
+        if (sample == nullptr)
+        {
+            // end of stream, or a decode error which is reported once
+            pending_error(_pipeline);
+            return false;
+        }
+        GstBuffer* buffer = gst_sample_get_buffer(sample);
+        GstVideoInfo info;
+        GstMapInfo map;
+        if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) || !gst_buffer_map(buffer, &map, GST_MAP_READ))
+        {
+            gst_sample_unref(sample);
+            return false;
+        }
+        const int width = GST_VIDEO_INFO_WIDTH(&info);
+        const int height = GST_VIDEO_INFO_HEIGHT(&info);
+        const size_t stride = GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+        const unsigned char* data = map.data + GST_VIDEO_INFO_PLANE_OFFSET(&info, 0);
+        frame.create(height, width, CV_8UC3);
+        for (int y = 0; y < height; ++y)
+        {
+            std::memcpy(frame.ptr(y), data + y * stride, static_cast<size_t>(width) * 3);
+        }
+        msec = GST_BUFFER_PTS_IS_VALID(buffer) ? static_cast<double>(GST_BUFFER_PTS(buffer)) / GST_MSECOND : 0.0;
+        gst_buffer_unmap(buffer, &map);
+        gst_sample_unref(sample);
+        return true;
+    }
+
+    bool GstReader::seek(const double msec)
+    {
+        const gint64 position = static_cast<gint64>(msec * GST_MSECOND + 0.5);
+        if (!gst_element_seek_simple(_pipeline, GST_FORMAT_TIME, static_cast<GstSeekFlags>(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE), std::max<gint64>(0, position)))
+        {
+            std::cerr << "GStreamer seek failed: " << msec << " ms\n";
+            return false;
+        }
+        // the flushing seek completes once the pipeline has prerolled again
+        return gst_element_get_state(_pipeline, nullptr, nullptr, GST_CLOCK_TIME_NONE) != GST_STATE_CHANGE_FAILURE;
+    }
+
+    GstWriter::GstWriter() :
+        _pipeline(nullptr),
+        _source(nullptr),
+        _fps_n(0),
+        _fps_d(1),
+        _frames(0)
+    {
+    }
+
+    GstWriter::~GstWriter()
+    {
+        close();
+    }
+
+    bool GstWriter::open(const std::string& path, const double fps, const cv::Size& size, const BackendOptions& options)
+    {
+        close();
+        init_gstreamer();
+        std::ostringstream description;
+        description << "appsrc name=source format=time block=true ! queue max-size-buffers=" << options.queue_depth << " max-size-bytes=0 max-size-time=0 ! "
+                    << "videoconvert name=convert ! x264enc name=encoder ! h264parse ! " << muxer(path) << " ! filesink name=sink";
+        _pipeline = launch(description.str());
+        if (_pipeline == nullptr)
+        {
+            return false;
+        }
+        GstElement* sink = element(_pipeline, "sink");
+        g_object_set(sink, "location", path.c_str(), nullptr);
+        gst_object_unref(sink);
+        GstElement* convert = element(_pipeline, "convert");
+        set_threads(convert, "n-threads", options.threads);
+        gst_object_unref(convert);
+        GstElement* encoder = element(_pipeline, "encoder");
+        set_threads(encoder, "threads", options.threads);
+        gst_object_unref(encoder);
+
+        gst_util_double_to_fraction(fps > 0.0 ? fps : 30.0, &_fps_n, &_fps_d);
+        _source = element(_pipeline, "source");
+        GstCaps* caps = gst_caps_new_simple("video/x-raw",
+                                           "format", G_TYPE_STRING, "BGR",
+                                           "width", G_TYPE_INT, size.width,
+                                           "height", G_TYPE_INT, size.height,
+                                           "framerate", GST_TYPE_FRACTION, _fps_n, _fps_d,
+                                           nullptr);
+        // writers block once queue_depth frames are waiting for the encoder
+        const guint64 max_bytes = static_cast<guint64>(std::max(1, options.queue_depth)) * size.width * size.height * 3;
+        g_object_set(_source, "caps", caps, "max-bytes", max_bytes, nullptr);
+        gst_caps_unref(caps);
+
+        if (gst_element_set_state(_pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+        {
+            pending_error(_pipeline);
+            std::cerr << "Failed to start GStreamer pipeline: " << path << "\n";
+            close();
+            return false;
+        }
+        _frames = 0;
+        return true;
+    }
+
+    bool GstWriter::is_open() const
+    {
+        return _pipeline != nullptr;
+    }
+
+    void GstWriter::write(const cv::Mat& frame)
+    {
+        // the pipeline holds a reference to the frame until the encoder has consumed it
+        cv::Mat* held = new cv::Mat(frame.isContinuous() ? frame : frame.clone());
+        const gsize bytes = held->total() * held->elemSize();
+        GstBuffer* buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, held->data, bytes, 0, bytes, held, release_frame);
+        GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(_frames, static_cast<guint64>(_fps_d) * GST_SECOND, _fps_n);
+        GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale(1, static_cast<guint64>(_fps_d) * GST_SECOND, _fps_n);
+        _frames++;
+        if (gst_app_src_push_buffer(GST_APP_SRC(_source), buffer) != GST_FLOW_OK)
+        {
+            pending_error(_pipeline);
+        }
+    }
+
+    void GstWriter::close()
+    {
+        if (_pipeline == nullptr)
+        {
+            return;
+        }
+        gst_app_src_end_of_stream(GST_APP_SRC(_source));
+        GstBus* bus = gst_element_get_bus(_pipeline);
+        GstMessage* message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (message != nullptr)
+        {
+            if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR)
+            {
+                report_error(message);
+            }
+            gst_message_unref(message);
+        }
+        gst_object_unref(bus);
+        gst_element_set_state(_pipeline, GST_STATE_NULL);
+        gst_object_unref(_source);
+        gst_object_unref(_pipeline);
+        _source = nullptr;
+        _pipeline = nullptr;
+    }
+}
+
+#endif // WITH_GSTREAMER
@@ -0,0 +1,305 @@
+// rawvideo.cpp
+// Copyright Laurence Emms 2017
+
+#include "rawvideo.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace videoio
+{
+    // file layout: header, then width * height * 3 bytes per frame until the end of the file
+    namespace
+    {
+        const char raw_magic[8] = {'V', 'R', 'A', 'W', '0', '0', '1', '\0'};
+
+        struct Header
+        {
+            char magic[8];
+            std::int32_t fourcc;
+            std::int32_t width;
+            std::int32_t height;
+            std::int32_t reserved;
+            double fps;
+        };
+
+        bool read_fully(const int fd, void* data, const size_t bytes)
+        {
+            unsigned char* out = static_cast<unsigned char*>(data);
+            size_t done = 0;
+            while (done < bytes)
+            {
+                ssize_t count = ::read(fd, out + done, bytes - done);
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count <= 0)
+                {
+                    return false;
+                }
+                done += static_cast<size_t>(count);
+            }
+            return true;
+        }
+    }
+
+    bool is_raw_video(const std::string& path)
+    {
+        return boost::algorithm::to_lower_copy(fs::path(path).extension().string()) == ".vraw";
+    }
+
+    RawReader::RawReader() :
+        _fd(-1),
+        _mapped(nullptr),
+        _mapped_size(0),
+        _fourcc(0),
+        _width(0),
+        _height(0),
+        _fps(0.0),
+        _frame_bytes(0),
+        _frame_count(0),
+        _position(0)
+    {
+    }
+
+    RawReader::~RawReader()
+    {
+        close();
+    }
+
+    bool RawReader::open(const std::string& path)
+    {
+        close();
+        _fd = ::open(path.c_str(), O_RDONLY);
+        if (_fd < 0)
+        {
+            std::cerr << "Failed to open raw video: " << path << "\n";
+            return false;
+        }
+        struct stat status;
+        if (fstat(_fd, &status) != 0)
+        {
+            std::cerr << "Failed to stat raw video: " << path << "\n";
+            close();
+            return false;
+        }
+
+        Header header;
+        if (S_ISREG(status.st_mode))
+        {
+            _mapped_size = static_cast<size_t>(status.st_size);
+            if (_mapped_size < sizeof(Header))
+            {
+                std::cerr << "Raw video is truncated: " << path << "\n";
+                close();
+                return false;
+            }
+            // frames are copied out into the caller's buffers, so the mapping is read only and read ahead sequentially
+            void* memory = mmap(NULL, _mapped_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+            if (memory == MAP_FAILED)
+            {
+                std::cerr << "Failed to map raw video: " << path << "\n";
+                _mapped_size = 0;
+                close();
+                return false;
+            }
+            madvise(memory, _mapped_size, MADV_SEQUENTIAL);
+            _mapped = static_cast<const unsigned char*>(memory);
+            std::memcpy(&header, _mapped, sizeof(Header));
+        }
+        else if (!read_fully(_fd, &header, sizeof(Header)))
+        {
+            std::cerr << "Failed to read raw video header: " << path << "\n";
+            close();
+            return false;
+        }
+
+        if (std::memcmp(header.magic, raw_magic, sizeof(raw_magic)) != 0 || header.width <= 0 || header.height <= 0)
+        {
+            std::cerr << "Not a raw video: " << path << "\n";
+            close();
+            return false;
+        }
+        _fourcc = header.fourcc;
+        _width = header.width;
+        _height = header.height;
+        _fps = header.fps;
+        _frame_bytes = static_cast<size_t>(_width) * _height * 3;
+        // a partly written last frame is ignored
+        _frame_count = _mapped != nullptr ? static_cast<int>((_mapped_size - sizeof(Header)) / _frame_bytes) : -1;
+        _position = 0;
+        return true;
+    }
+
+    void RawReader::close()
+    {
+        if (_mapped != nullptr)
+        {
+            munmap(const_cast<unsigned char*>(_mapped), _mapped_size);
+            _mapped = nullptr;
+            _mapped_size = 0;
+        }
+        if (_fd >= 0)
+        {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    int RawReader::fourcc() const
+    {
+        return _fourcc;
+    }
+
+    int RawReader::width() const
+    {
+        return _width;
+    }
+
+    int RawReader::height() const
+    {
+        return _height;
+    }
+
+    double RawReader::fps() const
+    {
+        return _fps;
+    }
+
+    int RawReader::frame_count() const
+    {
+        return _frame_count;
+    }
+
+    bool RawReader::seek(const int fn)
+    {
+        if (_mapped != nullptr)
+        {
+            if (fn < 0 || fn > _frame_count)
+            {
+                return false;
+            }
+            _position = fn;
+            return true;
+        }
+        if (fn < _position)
+        {
+            std::cerr << "Cannot seek backwards in a raw video pipe\n";
+            return false;
+        }
+        std::vector<unsigned char> skipped(_frame_bytes);
+        while (_position < fn)
+        {
+            if (!read_fully(_fd, skipped.data(), _frame_bytes))
+            {
+                return false;
+            }
+            _position++;
+        }
+        return true;
+    }
+
+    bool RawReader::read(cv::Mat& frame)
+    {
+        if (_mapped != nullptr && _position >= _frame_count)
+        {
+            return false;
+        }
+        frame.create(_height, _width, CV_8UC3);
+        if (!frame.isContinuous())
+        {
+            frame = cv::Mat(_height, _width, CV_8UC3);
+        }
+        if (_mapped != nullptr)
+        {
+            std::memcpy(frame.ptr(), _mapped + sizeof(Header) + static_cast<size_t>(_position) * _frame_bytes, _frame_bytes);
+        }
+        else if (!read_fully(_fd, frame.ptr(), _frame_bytes))
+        {
+            return false;
+        }
+        _position++;
+        return true;
+    }
+
+    RawWriter::RawWriter() :
+        _file(nullptr),
+        _failed(false)
+    {
+    }
+
+    RawWriter::~RawWriter()
+    {
+        close();
+    }
+
+    bool RawWriter::open(const std::string& path, const int fourcc, const double fps, const cv::Size& size)
+    {
+        close();
+        _file = std::fopen(path.c_str(), "wb");
+        if (_file == nullptr)
+        {
+            std::cerr << "Failed to write raw video: " << path << "\n";
+            return false;
+        }
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, raw_magic, sizeof(raw_magic));
+        header.fourcc = fourcc;
+        header.width = size.width;
+        header.height = size.height;
+        header.fps = fps;
+        _size = size;
+        _failed = std::fwrite(&header, sizeof(header), 1, _file) != 1;
+        return !_failed;
+    }
+
+    bool RawWriter::is_open() const
+    {
+        return _file != nullptr;
+    }
+
+    void RawWriter::write(const cv::Mat& frame)
+    {
+        if (_failed)
+        {
+            return;
+        }
+        // readers find frames by offset, a mismatched one would shift every frame after it
+        if (frame.cols != _size.width || frame.rows != _size.height || frame.type() != CV_8UC3)
+        {
+            std::cerr << "Skipping frame of size " << frame.cols << "x" << frame.rows << " for raw output of size " << _size.width << "x" << _size.height << "\n";
+            return;
+        }
+        const cv::Mat packed = frame.isContinuous() ? frame : frame.clone();
+        const size_t bytes = packed.total() * packed.elemSize();
+        if (std::fwrite(packed.ptr(), 1, bytes, _file) != bytes)
+        {
+            std::cerr << "Failed to write raw video frame\n";
+            _failed = true;
+        }
+    }
+
+    bool RawWriter::close()
+    {
+        if (_file == nullptr)
+        {
+            return true;
+        }
+        bool closed = std::fclose(_file) == 0;
+        _file = nullptr;
+        return closed && !_failed;
+    }
+}
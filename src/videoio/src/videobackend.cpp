@@ -0,0 +1,42 @@
+// videobackend.cpp
+// Copyright Laurence Emms 2017
+
+#include "videobackend.h"
+
+#include <cstdlib>
+#include <iostream>
+
+namespace videoio
+{
+    BackendOptions default_backend()
+    {
+        BackendOptions options;
+        options.backend = Backend::OpenCV;
+        options.queue_depth = 8;
+        options.threads = 0;
+        options.codec = "libx264";
+        options.preset = "medium";
+        options.crf = 18;
+        options.pipe_yuv = true;
+        options.pix_fmt = "yuv420p";
+        options.timescale = 0;
+        return options;
+    }
+
+    Backend available_backend(const Backend backend)
+    {
+#ifndef WITH_GSTREAMER
+        if (backend == Backend::GStreamer)
+        {
+            std::cerr << "Built without GStreamer, using OpenCV video I/O\n";
+            return Backend::OpenCV;
+        }
+#endif
+        if (backend == Backend::FFmpeg && std::system("ffmpeg -version > /dev/null 2>&1") != 0)
+        {
+            std::cerr << "ffmpeg not found, using OpenCV video I/O\n";
+            return Backend::OpenCV;
+        }
+        return backend;
+    }
+}
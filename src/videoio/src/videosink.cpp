@@ -0,0 +1,143 @@
+// videosink.cpp
+// Copyright Laurence Emms 2017
+
+#include "videosink.h"
+
+#include <iostream>
+
+namespace videoio
+{
+    VideoSink::VideoSink()
+    {
+    }
+
+    VideoSink::~VideoSink()
+    {
+        close();
+    }
+
+    bool VideoSink::open(const std::string& path, const int fourcc, const double fps, const cv::Size& size)
+    {
+        return open(path, fourcc, fps, size, default_backend());
+    }
+
+    bool VideoSink::open(const std::string& path, const int fourcc, const double fps, const cv::Size& size, const BackendOptions& options)
+    {
+        close();
+        if (is_raw_video(path))
+        {
+            _raw.reset(new RawWriter());
+            if (_raw->open(path, fourcc, fps, size))
+            {
+                return true;
+            }
+            _raw.reset();
+            return false;
+        }
+        const Backend backend = available_backend(options.backend);
+        if (backend == Backend::FFmpeg)
+        {
+            _ffmpeg.reset(new FFmpegWriter());
+            if (_ffmpeg->open(path, fps, size, options))
+            {
+                return true;
+            }
+            _ffmpeg.reset();
+            std::cerr << "Failed to open ffmpeg writer, using OpenCV video I/O\n";
+        }
+        if (backend == Backend::GStreamer)
+        {
+#ifdef WITH_GSTREAMER
+            _gst.reset(new GstWriter());
+            if (_gst->open(path, fps, size, options))
+            {
+                return true;
+            }
+            _gst.reset();
+            std::cerr << "Failed to open GStreamer writer, using OpenCV video I/O\n";
+#endif
+        }
+        return _writer.open(path, fourcc, fps, size, true);
+    }
+
+    bool VideoSink::is_open() const
+    {
+        if (_raw)
+        {
+            return _raw->is_open();
+        }
+        if (_ffmpeg)
+        {
+            return _ffmpeg->is_open();
+        }
+#ifdef WITH_GSTREAMER
+        if (_gst)
+        {
+            return _gst->is_open();
+        }
+#endif
+        return _writer.isOpened();
+    }
+
+    Backend VideoSink::backend() const
+    {
+        if (_ffmpeg)
+        {
+            return Backend::FFmpeg;
+        }
+#ifdef WITH_GSTREAMER
+        if (_gst)
+        {
+            return Backend::GStreamer;
+        }
+#endif
+        return Backend::OpenCV;
+    }
+
+    void VideoSink::write(const cv::Mat& frame)
+    {
+        if (_raw)
+        {
+            _raw->write(frame);
+            return;
+        }
+        if (_ffmpeg)
+        {
+            _ffmpeg->write(frame);
+            return;
+        }
+#ifdef WITH_GSTREAMER
+        if (_gst)
+        {
+            _gst->write(frame);
+            return;
+        }
+#endif
+        _writer.write(frame);
+    }
+
+    bool VideoSink::close()
+    {
+        bool finished = true;
+        if (_raw && !_raw->close())
+        {
+            std::cerr << "Failed to finish raw video output\n";
+            finished = false;
+        }
+        _raw.reset();
+        if (_ffmpeg && !_ffmpeg->close())
+        {
+            std::cerr << "Failed to finish ffmpeg output\n";
+            finished = false;
+        }
+        _ffmpeg.reset();
+#ifdef WITH_GSTREAMER
+        _gst.reset();
+#endif
+        if (_writer.isOpened())
+        {
+            _writer.release();
+        }
+        return finished;
+    }
+}
@@ -0,0 +1,308 @@
+// videosource.cpp
+// Copyright Laurence Emms 2017
+
+#include "videosource.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace videoio
+{
+    namespace
+    {
+        // frames held by callers, such as a window of previous frames, keep their buffers out of the pool
+        const size_t max_pool_size = 32;
+
+        bool unshared(const cv::Mat& frame)
+        {
+#if CV_MAJOR_VERSION >= 3
+            return frame.u != nullptr && frame.u->refcount == 1;
+#else
+            return frame.refcount != nullptr && *frame.refcount == 1;
+#endif
+        }
+    }
+
+    VideoSource::VideoSource() :
+        _open(false),
+        _indexed(false),
+        _fourcc(0),
+        _width(0),
+        _height(0),
+        _fps(0.0),
+        _format(0),
+        _iso_speed(0),
+        _frame_count(0),
+        _position(0),
+        _end(-1),
+        _msec(0.0)
+    {
+    }
+
+    VideoSource::~VideoSource()
+    {
+        close();
+    }
+
+    bool VideoSource::open(const std::string& path)
+    {
+        return open(path, default_backend());
+    }
+
+    bool VideoSource::open(const std::string& path, const BackendOptions& options)
+    {
+        close();
+        _position = 0;
+        _end = -1;
+        _msec = 0.0;
+        if (is_raw_video(path))
+        {
+            // raw video is read directly whatever the backend
+            _raw.reset(new RawReader());
+            if (!_raw->open(path))
+            {
+                _raw.reset();
+                return false;
+            }
+            _path = path;
+            _fourcc = _raw->fourcc();
+            _width = _raw->width();
+            _height = _raw->height();
+            _fps = _raw->fps();
+            _format = 0;
+            _iso_speed = 0;
+            _frame_count = std::max(0, _raw->frame_count());
+            _open = true;
+            return true;
+        }
+
+        if (!_cap.open(path))
+        {
+            std::cerr << "Failed to open video capture: " << path << "\n";
+            return false;
+        }
+        _path = path;
+        _fourcc = static_cast<int>(_cap.get(CV_CAP_PROP_FOURCC));
+        _width = static_cast<int>(_cap.get(CV_CAP_PROP_FRAME_WIDTH));
+        _height = static_cast<int>(_cap.get(CV_CAP_PROP_FRAME_HEIGHT));
+        _fps = _cap.get(CV_CAP_PROP_FPS);
+        _format = static_cast<int>(_cap.get(CV_CAP_PROP_FORMAT));
+        _iso_speed = static_cast<int>(_cap.get(CV_CAP_PROP_ISO_SPEED));
+        _indexed = load_index(path, _index);
+        _frame_count = _indexed ? _index.frame_count : approximate_frame_count(_cap);
+        _open = true;
+
+        // only GStreamer decodes, other backends read through the capture
+        if (options.backend == Backend::GStreamer && available_backend(options.backend) == Backend::GStreamer)
+        {
+#ifdef WITH_GSTREAMER
+            _gst.reset(new GstReader());
+            if (_gst->open(path, options))
+            {
+                // the capture was only needed for the metadata
+                _cap.release();
+            }
+            else
+            {
+                _gst.reset();
+                std::cerr << "Failed to open GStreamer reader, using OpenCV video I/O\n";
+            }
+#endif
+        }
+        return true;
+    }
+
+    void VideoSource::close()
+    {
+        _raw.reset();
+#ifdef WITH_GSTREAMER
+        _gst.reset();
+#endif
+        if (_cap.isOpened())
+        {
+            _cap.release();
+        }
+        _open = false;
+        _pool.clear();
+        _indexed = false;
+        _frame_count = 0;
+    }
+
+    bool VideoSource::is_open() const
+    {
+        return _open;
+    }
+
+    const std::string& VideoSource::path() const
+    {
+        return _path;
+    }
+
+    int VideoSource::fourcc() const
+    {
+        return _fourcc;
+    }
+
+    int VideoSource::width() const
+    {
+        return _width;
+    }
+
+    int VideoSource::height() const
+    {
+        return _height;
+    }
+
+    double VideoSource::fps() const
+    {
+        return _fps;
+    }
+
+    int VideoSource::frame_count() const
+    {
+        return _frame_count;
+    }
+
+    bool VideoSource::streamed() const
+    {
+        return _raw && _raw->frame_count() < 0;
+    }
+
+    bool VideoSource::indexed() const
+    {
+        return _indexed;
+    }
+
+    const FrameIndex& VideoSource::index() const
+    {
+        return _index;
+    }
+
+    void VideoSource::print_info() const
+    {
+        const char* fourcc = reinterpret_cast<const char*>(&_fourcc);
+        std::cout << "FourCC: " << std::string(fourcc, 4) << "\n";
+        std::cout << "Frame count: ";
+        if (streamed())
+        {
+            std::cout << "unknown until the pipe ends\n";
+        }
+        else
+        {
+            std::cout << _frame_count << (_indexed || _raw ? "" : " (approx)") << "\n";
+        }
+        std::cout << "Frame width: " << _width << "\n";
+        std::cout << "Frame height: " << _height << "\n";
+        std::cout << "FPS: " << _fps << "\n";
+        std::cout << "Frame format: " << _format << "\n";
+        std::cout << "ISO Speed: " << _iso_speed << "\n";
+    }
+
+    bool VideoSource::seek(const int fn)
+    {
+        if (fn == _position)
+        {
+            return true;
+        }
+        bool seeked = false;
+        if (_raw)
+        {
+            seeked = _raw->seek(fn);
+        }
+#ifdef WITH_GSTREAMER
+        else if (_gst)
+        {
+            // index timestamps are relative to the first frame, as is the stream time GStreamer seeks in
+            bool timed = _indexed && fn < static_cast<int>(_index.timestamps.size());
+            seeked = _gst->seek(timed ? _index.timestamps[fn] : (_fps > 0.0 ? fn * 1000.0 / _fps : 0.0));
+        }
+#endif
+        else
+        {
+            seeked = _indexed ? seek_frame(_cap, _index, fn) : _cap.set(CV_CAP_PROP_POS_FRAMES, fn);
+        }
+        // a failed seek leaves the position where it was
+        if (seeked)
+        {
+            _position = fn;
+        }
+        return seeked;
+    }
+
+    bool VideoSource::set_range(const int first, const int end)
+    {
+        _end = end;
+        return seek(first);
+    }
+
+    bool VideoSource::read(cv::Mat& frame)
+    {
+        if (_end >= 0 && _position >= _end)
+        {
+            return false;
+        }
+        cv::Mat& buffer = acquire();
+        double msec = 0.0;
+        if (!decode(buffer, msec))
+        {
+            // the decoder has moved past a frame it could not decode, callers that skip it keep counting with the source
+            _position++;
+            return false;
+        }
+        _msec = _indexed && _position < static_cast<int>(_index.timestamps.size()) ? _index.timestamps[_position] : msec;
+        _position++;
+        frame = buffer;
+        return true;
+    }
+
+    int VideoSource::position() const
+    {
+        return _position;
+    }
+
+    double VideoSource::msec() const
+    {
+        return _msec;
+    }
+
+    cv::Mat& VideoSource::acquire()
+    {
+        for (cv::Mat& buffer : _pool)
+        {
+            if (unshared(buffer))
+            {
+                return buffer;
+            }
+        }
+        if (_pool.size() < max_pool_size)
+        {
+            _pool.push_back(cv::Mat(_height, _width, CV_8UC3));
+            return _pool.back();
+        }
+        // every buffer is held elsewhere, the oldest is detached and replaced so the pool stays bounded
+        _pool.erase(_pool.begin());
+        _pool.push_back(cv::Mat(_height, _width, CV_8UC3));
+        return _pool.back();
+    }
+
+    bool VideoSource::decode(cv::Mat& buffer, double& msec)
+    {
+        if (_raw)
+        {
+            msec = _fps > 0.0 ? _position * 1000.0 / _fps : 0.0;
+            return _raw->read(buffer);
+        }
+#ifdef WITH_GSTREAMER
+        if (_gst)
+        {
+            return _gst->read(buffer, msec);
+        }
+#endif
+        if (!_cap.read(buffer))
+        {
+            return false;
+        }
+        msec = _cap.get(CV_CAP_PROP_POS_MSEC);
+        return true;
+    }
+}